@@ -0,0 +1,302 @@
+// Throughput of the processing path on a synthetic access log.
+// Every result is printed as one JSON object per line:
+// {"benchmark":"parse","size":1000000,"items":1000000,"seconds":0.1,"items_per_second":1e7,"mib_per_second":1300}
+#include "loggen.h"
+#include "accesslog.h"
+#include "TimestampDecoder.h"
+#include "LogReader.h"
+#include "XRayClient.h"
+#include "TopDestinations.h"
+#include "Notifier.h"
+#include "TelegramBot.h"
+#include "Config.h"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+#include <boost/log/core.hpp>
+#include <boost/program_options.hpp>
+
+
+namespace po = boost::program_options;
+using Clock = std::chrono::steady_clock;
+
+const std::size_t BATCH_BYTES = 16 * 1024 * 1024;
+// Lines appended to the log between two passes of processAccessLog
+const std::size_t PASS_LINES = 10000;
+
+// Keeps results of the measured loops alive
+static volatile std::int64_t g_sink;
+
+static void report(const char* name, std::size_t size, std::size_t items, double seconds, std::size_t bytes) {
+    std::printf("{\"benchmark\":\"%s\",\"size\":%zu,\"items\":%zu,\"seconds\":%.6f,\"items_per_second\":%.0f,\"mib_per_second\":%.1f}\n",
+        name, size, items, seconds, seconds > 0 ? items / seconds : 0.0,
+        seconds > 0 ? bytes / 1048576.0 / seconds : 0.0);
+    std::fflush(stdout);
+}
+
+static std::size_t writeLog(const std::string& path, std::size_t lines, const loggen::Options& options) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    loggen::Generator generator(options);
+    std::string buffer;
+    std::size_t bytes = 0;
+    for (std::size_t i = 0; i < lines; ++i) {
+        generator.next(buffer);
+        if (buffer.size() >= 1 << 20) {
+            file.write(buffer.data(), buffer.size());
+            bytes += buffer.size();
+            buffer.clear();
+        }
+    }
+    file.write(buffer.data(), buffer.size());
+    bytes += buffer.size();
+    if (!file) {
+        throw std::runtime_error("Cannot write " + path);
+    }
+    return bytes;
+}
+
+// Calls `work` with batches of lines read from the file, only `work` is timed
+template <class Work>
+static double overBatches(const std::string& path, Work&& work) {
+    LogReader reader(path, SIZE_MAX);
+    std::vector<std::string_view> lines;
+    Clock::duration spent{};
+    while (reader.readLines(lines, BATCH_BYTES) > 0) {
+        auto started = Clock::now();
+        work(lines);
+        spent += Clock::now() - started;
+        lines.clear();
+    }
+    return std::chrono::duration<double>(spent).count();
+}
+
+static void benchRead(const std::string& path, std::size_t size, std::size_t bytes) {
+    LogReader reader(path, SIZE_MAX);
+    std::vector<std::string_view> lines;
+    std::size_t count = 0;
+    auto started = Clock::now();
+    while (reader.readLines(lines, BATCH_BYTES) > 0) {
+        count += lines.size();
+        lines.clear();
+    }
+    report("read", size, count, std::chrono::duration<double>(Clock::now() - started).count(), bytes);
+}
+
+static void benchParse(const std::string& path, std::size_t size, std::size_t bytes) {
+    std::size_t count = 0;
+    std::size_t matched = 0;
+    double seconds = overBatches(path, [&](const std::vector<std::string_view>& lines) {
+        for (const auto& line : lines) {
+            accesslog::Entry entry;
+            matched += accesslog::parseLine(line, entry) && entry.accepted && !entry.email.empty();
+        }
+        count += lines.size();
+    });
+    report("parse", size, count, seconds, bytes);
+    g_sink = matched;
+}
+
+static void benchRegex(const std::string& path, std::size_t size, std::size_t bytes) {
+    // The matcher used before accesslog::parseLine
+    const std::regex logPattern(
+        R"((\d{4}/\d{2}/\d{2} \d{2}:\d{2}:\d{2}\.\d+) )"
+        R"(from (\d{1,3}\.\d{1,3}\.\d{1,3}\.\d{1,3}):\d+ )"
+        R"(accepted [^\s]+ (\[vless_tls >> direct\]) )"
+        R"(email: ([^\s]+))"
+    );
+    std::size_t count = 0;
+    std::size_t matched = 0;
+    double seconds = overBatches(path, [&](const std::vector<std::string_view>& lines) {
+        for (const auto& line : lines) {
+            std::match_results<std::string_view::const_iterator> matches;
+            matched += std::regex_search(line.begin(), line.end(), matches, logPattern);
+        }
+        count += lines.size();
+    });
+    report("regex", size, count, seconds, bytes);
+    g_sink = matched;
+}
+
+static void benchTimestamp(const std::string& path, std::size_t size, std::size_t bytes) {
+    TimestampDecoder decoder;
+    std::vector<std::string_view> timestamps;
+    std::size_t count = 0;
+    std::int64_t checksum = 0;
+    LogReader reader(path, SIZE_MAX);
+    std::vector<std::string_view> lines;
+    Clock::duration spent{};
+    while (reader.readLines(lines, BATCH_BYTES) > 0) {
+        timestamps.clear();
+        for (const auto& line : lines) {
+            accesslog::Entry entry;
+            if (accesslog::parseLine(line, entry)) {
+                timestamps.push_back(entry.timestamp);
+            }
+        }
+        auto started = Clock::now();
+        for (auto timestamp : timestamps) {
+            checksum += decoder.decode(timestamp);
+        }
+        spent += Clock::now() - started;
+        count += timestamps.size();
+        lines.clear();
+    }
+    report("timestamp", size, count, std::chrono::duration<double>(spent).count(), bytes);
+    g_sink = checksum;
+}
+
+static void benchDestinations(const std::string& path, std::size_t size, const loggen::Options& options) {
+    TopDestinations destinations(options.users);
+    std::unordered_map<std::string, UserId, StringHash, std::equal_to<>> ids;
+    std::vector<std::pair<UserId, std::string_view>> accepted;
+    std::size_t count = 0;
+    LogReader reader(path, SIZE_MAX);
+    std::vector<std::string_view> lines;
+    Clock::duration spent{};
+    while (reader.readLines(lines, BATCH_BYTES) > 0) {
+        accepted.clear();
+        for (const auto& line : lines) {
+            accesslog::Entry entry;
+            if (accesslog::parseLine(line, entry) && entry.accepted && !entry.email.empty()) {
+                auto it = ids.find(entry.email);
+                if (it == ids.end()) {
+                    it = ids.emplace(std::string(entry.email), static_cast<UserId>(ids.size() % options.users)).first;
+                }
+                accepted.emplace_back(it->second, entry.destination);
+            }
+        }
+        auto started = Clock::now();
+        for (const auto& [user, destination] : accepted) {
+            destinations.add(user, destination);
+        }
+        destinations.compact();
+        spent += Clock::now() - started;
+        count += accepted.size();
+        lines.clear();
+    }
+    report("destinations", size, count, std::chrono::duration<double>(spent).count(), 0);
+    g_sink = static_cast<std::int64_t>(destinations.names());
+}
+
+static void benchProcess(const std::string& dir, std::size_t size, const loggen::Options& options) {
+    Config config;
+    config.accessLogPath = dir + "/xray-monitor-bench-process.log";
+    for (std::size_t user = 0; user < options.users; ++user) {
+        User u{ "00000000-0000-0000-0000-" + std::to_string(user), loggen::email(user), "vless" };
+        config.users[u.email] = u;
+    }
+    for (const auto& [tag, weight] : options.inbounds) {
+        config.userInbounds.push_back(tag);
+    }
+    config.outboundTags.push_back(options.outbound);
+    std::ofstream(config.accessLogPath, std::ios::trunc);
+    XRayClient client(config);
+    client.processAccessLog();
+
+    loggen::Generator generator(options);
+    std::string buffer;
+    std::size_t bytes = 0;
+    Clock::duration spent{};
+    for (std::size_t done = 0; done < size; done += PASS_LINES) {
+        buffer.clear();
+        for (std::size_t i = done; i < size && i < done + PASS_LINES; ++i) {
+            generator.next(buffer);
+        }
+        std::ofstream(config.accessLogPath, std::ios::binary | std::ios::app).write(buffer.data(), buffer.size());
+        bytes += buffer.size();
+        auto started = Clock::now();
+        client.processAccessLog();
+        spent += Clock::now() - started;
+    }
+    report("process", size, size, std::chrono::duration<double>(spent).count(), bytes);
+    ::unlink(config.accessLogPath.c_str());
+}
+
+static void benchMessage(std::size_t size, const loggen::Options& options) {
+    TelegramBot bot("", "");
+    Notifier notifier(bot, 0);
+    std::size_t users = std::min(size, options.users);
+    Peer peer;
+    peer.id = "00000000-0000-0000-0000-000000000000";
+    peer.ip = "203.0.113.1";
+    peer.lastTime = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    auto started = Clock::now();
+    for (std::size_t user = 0; user < users; ++user) {
+        peer.email = loggen::email(user);
+        notifier.connected(peer);
+    }
+    notifier.flush(true);
+    report("message", size, users, std::chrono::duration<double>(Clock::now() - started).count(), 0);
+}
+
+static std::vector<std::size_t> parseSizes(const std::string& text) {
+    std::vector<std::size_t> sizes;
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            sizes.push_back(std::stoull(item));
+        }
+    }
+    return sizes;
+}
+
+int main(int argc, char* argv[]) {
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help,h", "Show help message")
+        ("sizes,s", po::value<std::string>()->default_value("10000,1000000"), "Comma separated numbers of lines, e.g. 10000,1000000,100000000")
+        ("users,u", po::value<std::size_t>()->default_value(1000), "Number of users")
+        ("inbounds", po::value<std::string>()->default_value("vless_tls"), "Inbound tags with weights: tag[:weight],...")
+        ("rejected", po::value<double>()->default_value(0.1), "Share of rejected lines")
+        ("ipv6", po::value<double>()->default_value(0.1), "Share of IPv6 sources")
+        ("dir,d", po::value<std::string>()->default_value("/tmp"), "Directory for generated logs")
+        ("regex-limit", po::value<std::size_t>()->default_value(1000000), "Largest size to run the std::regex baseline on");
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+    }
+    catch (const po::error& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    if (vm.count("help")) {
+        std::cout << "Usage: xray-monitor-bench [options]\n\n" << desc << std::endl;
+        return 0;
+    }
+    // Only the measured code should run
+    boost::log::core::get()->set_logging_enabled(false);
+
+    loggen::Options options;
+    options.users = vm["users"].as<std::size_t>();
+    options.inbounds = loggen::parseInbounds(vm["inbounds"].as<std::string>());
+    options.rejectedShare = vm["rejected"].as<double>();
+    options.ipv6Share = vm["ipv6"].as<double>();
+    const std::string& dir = vm["dir"].as<std::string>();
+
+    for (std::size_t size : parseSizes(vm["sizes"].as<std::string>())) {
+        std::string path = dir + "/xray-monitor-bench-" + std::to_string(size) + ".log";
+        std::size_t bytes = writeLog(path, size, options);
+        benchRead(path, size, bytes);
+        benchParse(path, size, bytes);
+        if (size <= vm["regex-limit"].as<std::size_t>()) {
+            benchRegex(path, size, bytes);
+        }
+        benchTimestamp(path, size, bytes);
+        benchDestinations(path, size, options);
+        ::unlink(path.c_str());
+        benchProcess(dir, size, options);
+        benchMessage(size, options);
+    }
+    return 0;
+}
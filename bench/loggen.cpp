@@ -0,0 +1,118 @@
+#include "loggen.h"
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+
+
+static const char* DESTINATIONS[] = {
+    "tcp:www.google.com:443", "tcp:api.telegram.org:443", "udp:8.8.8.8:53", "tcp:www.youtube.com:443",
+    "tcp:example.com:80", "tcp:mail.example.org:25", "udp:1.1.1.1:443", "tcp:cdn.example.net:443",
+};
+
+std::vector<std::pair<std::string, unsigned int>> loggen::parseInbounds(const std::string& text) {
+    std::vector<std::pair<std::string, unsigned int>> inbounds;
+    std::size_t pos = 0;
+    while (pos <= text.size()) {
+        std::size_t end = text.find(',', pos);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+        std::string item = text.substr(pos, end - pos);
+        pos = end + 1;
+        if (item.empty()) {
+            continue;
+        }
+        std::size_t colon = item.find(':');
+        unsigned int weight = 1;
+        if (colon != std::string::npos) {
+            weight = static_cast<unsigned int>(std::stoul(item.substr(colon + 1)));
+            item.resize(colon);
+        }
+        inbounds.emplace_back(item, weight);
+    }
+    if (inbounds.empty()) {
+        throw std::runtime_error("No inbound tags in " + text);
+    }
+    return inbounds;
+}
+
+std::string loggen::email(std::size_t user) {
+    return "user" + std::to_string(user) + "@example.com";
+}
+
+loggen::Generator::Generator(const Options& options) : options(options), rng(options.seed) {
+    std::vector<unsigned int> weights;
+    for (const auto& [tag, weight] : options.inbounds) {
+        weights.push_back(weight);
+    }
+    inboundPick = std::discrete_distribution<std::size_t>(weights.begin(), weights.end());
+    std::time_t start = options.start ? options.start : std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    startMicros = static_cast<std::int64_t>(start) * 1000000;
+}
+
+void loggen::Generator::appendTimestamp(std::string& out, std::int64_t micros) {
+    std::int64_t second = micros / 1000000;
+    if (second != cachedSecond) {
+        std::time_t t = static_cast<std::time_t>(second);
+        std::tm tm {};
+        localtime_r(&t, &tm);
+        std::snprintf(secondText, sizeof(secondText), "%04d/%02d/%02d %02d:%02d:%02d",
+            tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+        cachedSecond = second;
+    }
+    char fraction[8];
+    std::snprintf(fraction, sizeof(fraction), ".%06d", static_cast<int>(micros % 1000000));
+    out += secondText;
+    out += fraction;
+}
+
+void loggen::Generator::appendSource(std::string& out, std::size_t user, std::uint64_t r) {
+    // A user has a few devices, each with a stable address
+    std::uint64_t device = user * 4 + (r >> 40) % 4;
+    std::uint64_t h = device * 0x9E3779B97F4A7C15ULL;
+    char buf[64];
+    if (static_cast<double>((r >> 8) % 10000) < options.ipv6Share * 10000) {
+        std::snprintf(buf, sizeof(buf), "[2001:db8:%x:%x::%x]:%u",
+            static_cast<unsigned>(h >> 48), static_cast<unsigned>((h >> 32) & 0xffff),
+            static_cast<unsigned>(h & 0xffff), static_cast<unsigned>(1024 + r % 60000));
+    }
+    else {
+        std::snprintf(buf, sizeof(buf), "%u.%u.%u.%u:%u",
+            static_cast<unsigned>(h >> 56) % 223 + 1, static_cast<unsigned>((h >> 48) & 0xff),
+            static_cast<unsigned>((h >> 40) & 0xff), static_cast<unsigned>((h >> 32) % 254 + 1),
+            static_cast<unsigned>(1024 + r % 60000));
+    }
+    out += buf;
+}
+
+void loggen::Generator::next(std::string& out) {
+    std::uint64_t r = rng();
+    std::size_t user = static_cast<std::size_t>(rng() % options.users);
+    appendTimestamp(out, startMicros + static_cast<std::int64_t>(index * 1000000 / options.rate));
+    ++index;
+
+    out += " from ";
+    appendSource(out, user, r);
+    if (static_cast<double>((r >> 20) % 10000) < options.rejectedShare * 10000) {
+        out += " rejected  proxy/vless/encoding: invalid request user id\n";
+        return;
+    }
+    out += " accepted ";
+    if ((r >> 28) % 4 == 0) {
+        // Long tail of hosts seen a few times each
+        char buf[48];
+        std::snprintf(buf, sizeof(buf), "tcp:s%u.example.net:%u",
+            static_cast<unsigned>((r >> 32) % 100000), static_cast<unsigned>(1024 + (r >> 4) % 16));
+        out += buf;
+    }
+    else {
+        out += DESTINATIONS[(r >> 16) % (sizeof(DESTINATIONS) / sizeof(DESTINATIONS[0]))];
+    }
+    out += " [";
+    out += options.inbounds[inboundPick(rng)].first;
+    out += " >> ";
+    out += options.outbound;
+    out += "] email: ";
+    out += email(user);
+    out += '\n';
+}
@@ -0,0 +1,54 @@
+#ifndef LOGGEN_H
+#define LOGGEN_H
+
+#include <cstdint>
+#include <ctime>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+// Synthetic xray access log in the format written by xray itself:
+// accepted lines of known users to a few popular and many rare destinations,
+// rejected lines, IPv4 and IPv6 sources.
+namespace loggen {
+    struct Options {
+        std::size_t users = 1000;
+        // Lines per second of log time
+        double rate = 1000;
+        double rejectedShare = 0.1;
+        double ipv6Share = 0.1;
+        // Inbound tag and its weight
+        std::vector<std::pair<std::string, unsigned int>> inbounds = { { "vless_tls", 1 } };
+        std::string outbound = "direct";
+        std::uint32_t seed = 42;
+        // Time of the first line, now if 0
+        std::time_t start = 0;
+    };
+
+    // Parses "tag[:weight],tag[:weight]"
+    std::vector<std::pair<std::string, unsigned int>> parseInbounds(const std::string& text);
+    std::string email(std::size_t user);
+
+    class Generator {
+    public:
+        Generator(const Options& options);
+        // Appends one line with its newline
+        void next(std::string& out);
+
+    private:
+        Options options;
+        std::mt19937_64 rng;
+        std::discrete_distribution<std::size_t> inboundPick;
+        std::int64_t startMicros;
+        std::uint64_t index = 0;
+        std::int64_t cachedSecond = -1;
+        char secondText[20];
+
+        void appendTimestamp(std::string& out, std::int64_t micros);
+        void appendSource(std::string& out, std::size_t user, std::uint64_t r);
+    };
+}
+
+#endif
@@ -0,0 +1,76 @@
+// Writes a synthetic xray access log
+#include "loggen.h"
+#include <fstream>
+#include <iostream>
+#include <boost/program_options.hpp>
+
+
+namespace po = boost::program_options;
+
+int main(int argc, char* argv[]) {
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help,h", "Show help message")
+        ("output,o", po::value<std::string>()->default_value("-"), "Output file, - for stdout")
+        ("lines,n", po::value<std::size_t>()->default_value(1000000), "Number of lines")
+        ("users,u", po::value<std::size_t>()->default_value(1000), "Number of users")
+        ("rate,r", po::value<double>()->default_value(1000), "Lines per second of log time")
+        ("rejected", po::value<double>()->default_value(0.1), "Share of rejected lines")
+        ("ipv6", po::value<double>()->default_value(0.1), "Share of IPv6 sources")
+        ("inbounds", po::value<std::string>()->default_value("vless_tls"), "Inbound tags with weights: tag[:weight],...")
+        ("outbound", po::value<std::string>()->default_value("direct"), "Outbound tag")
+        ("start", po::value<long long>()->default_value(0), "Unix time of the first line, now if 0")
+        ("seed", po::value<std::uint32_t>()->default_value(42), "Random seed");
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+    }
+    catch (const po::error& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    if (vm.count("help")) {
+        std::cout << "Usage: xray-monitor-loggen [options]\n\n" << desc << std::endl;
+        return 0;
+    }
+
+    loggen::Options options;
+    options.users = vm["users"].as<std::size_t>();
+    options.rate = vm["rate"].as<double>();
+    options.rejectedShare = vm["rejected"].as<double>();
+    options.ipv6Share = vm["ipv6"].as<double>();
+    options.inbounds = loggen::parseInbounds(vm["inbounds"].as<std::string>());
+    options.outbound = vm["outbound"].as<std::string>();
+    options.start = static_cast<std::time_t>(vm["start"].as<long long>());
+    options.seed = vm["seed"].as<std::uint32_t>();
+    if (options.users == 0 || options.rate <= 0) {
+        std::cerr << "Users and rate must be positive" << std::endl;
+        return 1;
+    }
+
+    std::ofstream file;
+    const std::string& output = vm["output"].as<std::string>();
+    if (output != "-") {
+        file.open(output, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            std::cerr << "Cannot open " << output << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& out = output == "-" ? std::cout : file;
+
+    loggen::Generator generator(options);
+    std::string buffer;
+    std::size_t lines = vm["lines"].as<std::size_t>();
+    for (std::size_t i = 0; i < lines; ++i) {
+        generator.next(buffer);
+        if (buffer.size() >= 1 << 20) {
+            out.write(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    }
+    out.write(buffer.data(), buffer.size());
+    return out ? 0 : 1;
+}
@@ -0,0 +1,221 @@
+#include "Agent.h"
+#include "utils.h"
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <boost/log/trivial.hpp>
+
+
+namespace net = boost::asio;
+using tcp = net::ip::tcp;
+
+namespace {
+    const std::size_t BATCH_LIMIT = 500;
+    // Events coming in a burst go into one batch
+    const auto BATCH_DELAY = std::chrono::milliseconds(100);
+    const auto RECONNECT_MIN = std::chrono::seconds(1);
+    const auto RECONNECT_MAX = std::chrono::seconds(60);
+    const auto CONNECT_TIMEOUT = std::chrono::seconds(10);
+    // A collector that does not answer for that long is given up
+    const auto IO_TIMEOUT = std::chrono::seconds(30);
+}
+
+AgentClient::AgentClient(const std::string& collector, const std::string& node, const std::string& token,
+    const std::string& spoolPath, bool compress)
+    : node(node), token(token), compress(compress), spool(spoolPath) {
+    auto [collectorHost, collectorPort] = utils::splitHostPort(collector);
+    host = collectorHost;
+    port = std::to_string(collectorPort);
+    worker = std::thread([this] { run(); });
+}
+
+AgentClient::~AgentClient() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        // Interrupts the connection attempt or the exchange of the worker
+        ioContext.stop();
+    }
+    cv.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+void AgentClient::send(fleet::Event event) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        spool.push(std::move(event));
+    }
+    cv.notify_all();
+}
+
+bool AgentClient::pause(std::chrono::steady_clock::duration duration) {
+    std::unique_lock<std::mutex> lock(mutex);
+    return !cv.wait_for(lock, duration, [this] { return stopping; });
+}
+
+void AgentClient::run() {
+    std::chrono::seconds backoff = RECONNECT_MIN;
+    for (;;) {
+        try {
+            auto socket = connect();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!socket || stopping) {
+                    return;
+                }
+            }
+            backoff = RECONNECT_MIN;
+            session(*socket);
+        }
+        catch (const std::exception& e) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping) {
+                // Interrupted by the destructor
+                return;
+            }
+            BOOST_LOG_TRIVIAL(warning)
+                << "Connection to the collector " << host << ":" << port << " failed, retrying in "
+                << backoff.count() << " s: " << std::string(e.what());
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping) {
+                return;
+            }
+        }
+        if (!pause(backoff)) {
+            return;
+        }
+        backoff = std::min(backoff * 2, std::chrono::seconds(RECONNECT_MAX));
+    }
+}
+
+std::shared_ptr<tcp::socket> AgentClient::connect() {
+    // Asynchronous to be both limited in time and stopped by the destructor.
+    // Handlers hold their state, they may run after a timeout
+    struct Attempt {
+        tcp::resolver resolver;
+        std::shared_ptr<tcp::socket> socket;
+        boost::system::error_code result = net::error::timed_out;
+
+        explicit Attempt(net::io_context& ioContext)
+            : resolver(ioContext), socket(std::make_shared<tcp::socket>(ioContext)) {}
+    };
+    auto attempt = std::make_shared<Attempt>(ioContext);
+    attempt->resolver.async_resolve(host, port,
+        [attempt](const boost::system::error_code& ec, tcp::resolver::results_type endpoints) {
+            if (ec) {
+                attempt->result = ec;
+                return;
+            }
+            net::async_connect(*attempt->socket, endpoints,
+                [attempt](const boost::system::error_code& ec, const tcp::endpoint&) {
+                    attempt->result = ec;
+                });
+        });
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping) {
+            return nullptr;
+        }
+        ioContext.restart();
+    }
+    ioContext.run_for(CONNECT_TIMEOUT);
+    if (attempt->result) {
+        attempt->resolver.cancel();
+        boost::system::error_code ignored;
+        attempt->socket->close(ignored);
+        throw boost::system::system_error(attempt->result);
+    }
+    tcp::socket& socket = *attempt->socket;
+    socket.set_option(tcp::no_delay(true));
+    // A dead peer is noticed even while there is nothing to send
+    socket.set_option(net::socket_base::keep_alive(true));
+    return attempt->socket;
+}
+
+template <class Start>
+void AgentClient::await(tcp::socket& socket, Start&& start) {
+    // Like connect(): the handler may run after a timeout, with the next run
+    auto result = std::make_shared<boost::system::error_code>(net::error::timed_out);
+    start([result](const boost::system::error_code& ec, std::size_t) { *result = ec; });
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!stopping) {
+            ioContext.restart();
+        }
+    }
+    ioContext.run_for(IO_TIMEOUT);
+    if (*result) {
+        // Cancels the operation if it is still pending
+        boost::system::error_code ignored;
+        socket.close(ignored);
+        throw boost::system::system_error(*result);
+    }
+}
+
+void AgentClient::write(tcp::socket& socket, const std::string& frame) {
+    await(socket, [&](auto handler) { net::async_write(socket, net::buffer(frame), handler); });
+}
+
+std::string AgentClient::readFrame(tcp::socket& socket, fleet::FrameType expected) {
+    char header[fleet::HEADER_SIZE];
+    await(socket, [&](auto handler) { net::async_read(socket, net::buffer(header), handler); });
+    fleet::FrameType type;
+    std::uint32_t size = 0;
+    fleet::parseHeader(header, type, size);
+    std::string payload(size, '\0');
+    await(socket, [&](auto handler) { net::async_read(socket, net::buffer(payload), handler); });
+    if (type != expected) {
+        throw std::runtime_error("Unexpected frame from the collector");
+    }
+    return payload;
+}
+
+void AgentClient::session(tcp::socket& socket) {
+    fleet::Hello hello;
+    hello.node = node;
+    hello.token = token;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        hello.lastSeq = spool.lastSeq();
+    }
+    write(socket, fleet::hello(hello));
+    std::uint64_t known = fleet::parseSeq(readFrame(socket, fleet::FrameType::Welcome));
+    std::size_t pending = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // Delivered before, the acknowledgement was lost with the previous connection
+        spool.ack(known);
+        pending = spool.size();
+    }
+    BOOST_LOG_TRIVIAL(info)
+        << "Connected to the collector " << host << ":" << port << " as " << node
+        << ", " << pending << " events to send";
+
+    for (;;) {
+        std::vector<fleet::Event> events;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (!waitEvents(lock)) {
+                return;
+            }
+            events = spool.after(spool.ackedSeq(), BATCH_LIMIT);
+        }
+        write(socket, fleet::batch(events, compress));
+        std::uint64_t acked = fleet::parseSeq(readFrame(socket, fleet::FrameType::Ack));
+        std::lock_guard<std::mutex> lock(mutex);
+        spool.ack(acked);
+        BOOST_LOG_TRIVIAL(trace) << "Collector acknowledged events up to " << acked;
+    }
+}
+
+bool AgentClient::waitEvents(std::unique_lock<std::mutex>& lock) {
+    cv.wait(lock, [this] { return stopping || spool.size() > 0; });
+    if (!stopping && spool.size() < BATCH_LIMIT) {
+        cv.wait_for(lock, BATCH_DELAY, [this] { return stopping || spool.size() >= BATCH_LIMIT; });
+    }
+    return !stopping;
+}
@@ -0,0 +1,65 @@
+#ifndef AGENT_H
+#define AGENT_H
+
+#include "FleetProtocol.h"
+#include "Spool.h"
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <boost/asio.hpp>
+
+
+// Streams events of this node to the collector over one persistent TCP
+// connection from a background thread. send() only puts an event into the
+// spool; it is removed from there once the collector acknowledges it, so
+// events survive reconnects (and restarts with a spool file). An event may
+// be delivered twice, the collector drops repeated sequence numbers.
+class AgentClient {
+public:
+    // `collector` is host:port, `token` the shared secret it expects
+    AgentClient(const std::string& collector, const std::string& node, const std::string& token,
+        const std::string& spoolPath, bool compress);
+    ~AgentClient();
+    AgentClient(const AgentClient&) = delete;
+    AgentClient& operator=(const AgentClient&) = delete;
+
+    void send(fleet::Event event);
+
+private:
+    std::string host;
+    std::string port;
+    std::string node;
+    std::string token;
+    bool compress;
+
+    // Guards the spool and the flag
+    std::mutex mutex;
+    std::condition_variable cv;
+    Spool spool;
+    bool stopping = false;
+    std::thread worker;
+
+    // Runs the I/O of the worker thread, stopped by the destructor
+    boost::asio::io_context ioContext;
+
+    void run();
+    // Null if stopping
+    std::shared_ptr<boost::asio::ip::tcp::socket> connect();
+    // Returns once the agent is stopping, throws when the connection fails
+    void session(boost::asio::ip::tcp::socket& socket);
+    // Runs the operation `start` begins on the io_context, throws when it
+    // fails or takes longer than the I/O timeout (the socket is closed then)
+    template <class Start>
+    void await(boost::asio::ip::tcp::socket& socket, Start&& start);
+    void write(boost::asio::ip::tcp::socket& socket, const std::string& frame);
+    std::string readFrame(boost::asio::ip::tcp::socket& socket, fleet::FrameType expected);
+    // Waits for events up to the batch size, false if stopping
+    bool waitEvents(std::unique_lock<std::mutex>& lock);
+    // False if interrupted by the shutdown
+    bool pause(std::chrono::steady_clock::duration duration);
+};
+
+#endif
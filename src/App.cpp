@@ -3,26 +3,47 @@
 #include "utils.h"
 #include "Config.h"
 #include "version.h"
+#include "Profiler.h"
+#include "BotCommands.h"
 #include <csignal>
+#include <latch>
 #include <thread>
+#include <algorithm>
 #include <sstream>
+#include <boost/asio/post.hpp>
 #include <boost/log/trivial.hpp>
 
 
 // Static member for signal handling
 static App* g_appInstance = nullptr;
 
-App::App(const Config& config) : config(config) {}
+const auto PROFILE_INTERVAL = std::chrono::minutes(5);
+// Enough for tens of instances: a pass over an idle log takes microseconds
+const unsigned int POOL_THREADS_LIMIT = 4;
+// Agent: online users are sent again this often, well within FleetState::PRESENCE_TIMEOUT
+const auto PRESENCE_REFRESH_INTERVAL = std::chrono::hours(1);
+// The snapshot for scrapes and bot commands is rebuilt at most this often:
+// it allocates per active user, and --watch may iterate many times a second
+const auto PUBLISH_INTERVAL = std::chrono::seconds(1);
+
+App::App(const Config& config) : config(config), fleetState(config.maxNodes) {}
 
 int App::run() {
     initialize();
 
     bool firstIteration = true;
+    auto lastSave = std::chrono::steady_clock::now();
+    auto lastProfile = std::chrono::steady_clock::now();
+    auto lastDestinations = std::chrono::steady_clock::now();
+    auto lastPresence = std::chrono::steady_clock::now();
+    // The first iteration publishes
+    std::chrono::steady_clock::time_point lastPublish;
 
     while (!shutdownRequested) {
         try {
-            // Parse access log for IP addresses
-            xrayClient->processAccessLog();
+            reloadUsers();
+            // Parse access logs for IP addresses
+            processInstances();
             if (firstIteration) {
                 sendStartupMessage();
                 firstIteration = false;
@@ -31,10 +52,47 @@ int App::run() {
                 sendNewConnectionMessage();
                 sendDisconnectionMessage();
             }
-            // Sleep for interval, for feedback on SIGTERM, every second
-            for (int i = 0; i < config.interval && !shutdownRequested; ++i) {
-                std::this_thread::sleep_for(std::chrono::seconds(1));
+            sendConcurrentIpsMessage();
+            sendConnectionRateMessage();
+            sendProbesMessage();
+            if (agent) {
+                forwardSuspicious();
+                if (std::chrono::steady_clock::now() - lastPresence >= PRESENCE_REFRESH_INTERVAL) {
+                    forwardOnline();
+                    lastPresence = std::chrono::steady_clock::now();
+                }
+            }
+            if (collector) {
+                processFleetEvents();
+            }
+            notifier->flush();
+            if (history) {
+                history->maintain(std::time(nullptr));
+            }
+            // Bot commands read the same snapshot as scrapes
+            if ((metricsServer || config.telegramCommands)
+                && std::chrono::steady_clock::now() - lastPublish >= PUBLISH_INTERVAL) {
+                publishMetrics();
+                lastPublish = std::chrono::steady_clock::now();
+            }
+            if (config.destinationsInterval > 0
+                && std::chrono::steady_clock::now() - lastDestinations >= std::chrono::hours(config.destinationsInterval)) {
+                sendDestinationsMessage();
+                lastDestinations = std::chrono::steady_clock::now();
+            }
+            if (std::chrono::steady_clock::now() - lastSave >= std::chrono::seconds(config.stateInterval)) {
+                saveState();
+                lastSave = std::chrono::steady_clock::now();
+            }
+            if (reportRequested.exchange(false)) {
+                BOOST_LOG_TRIVIAL(info) << profiler::report();
+                lastProfile = std::chrono::steady_clock::now();
             }
+            else if (std::chrono::steady_clock::now() - lastProfile >= PROFILE_INTERVAL) {
+                logProfile();
+                lastProfile = std::chrono::steady_clock::now();
+            }
+            waitNextIteration();
         }
         catch (const std::exception& e) {
             BOOST_LOG_TRIVIAL(error) << "Error in main loop: " << std::string(e.what());
@@ -42,6 +100,16 @@ int App::run() {
     }
 
     // Shutdown
+    configWatcher.reset();
+    collector.reset();
+    // Events not delivered yet stay in the spool
+    agent.reset();
+    if (history) {
+        history->closeSessions(std::time(nullptr));
+        history.reset();
+    }
+    saveState();
+    notifier->flush(true);
     std::string completed = "🏁 Xray connection monitoring completed";
     BOOST_LOG_TRIVIAL(error) << completed;
     if (telegramBot->isEnabled()) {
@@ -51,18 +119,109 @@ int App::run() {
 }
 
 void App::initialize() {
-    initLogging(config.logFilePath, config.logLevelStr);
+    LogSink::Options logFile;
+    logFile.path = config.logFilePath;
+    logFile.maxSize = static_cast<std::uint64_t>(config.logMaxSize) * 1024 * 1024;
+    logFile.rotateInterval = std::chrono::hours(config.logRotateHours);
+    logFile.keepFiles = config.logKeepFiles;
+    logFile.fsyncInterval = std::chrono::seconds(config.logFsyncInterval);
+    logFile.blockOnOverflow = config.logBlock;
+    initLogging(config.logLevelStr, logFile);
     BOOST_LOG_TRIVIAL(info) << "Starting XRay Monitor " << VERSION_STRING;
 
-    config.parseConfigFile();
-    BOOST_LOG_TRIVIAL(info)
-        << "XRay config loaded successfully. API endpoint: "
-        << config.apiAddress << ":"
-        << std::to_string(config.apiPort);
+    if (!config.geoipPaths.empty()) {
+        geoIp = std::make_unique<GeoIp>(config.geoipPaths);
+    }
+
+    std::vector<std::string> accessLogPaths;
+    for (auto& instanceConfig : config.instances()) {
+        auto instance = std::make_unique<Instance>();
+        Config& c = instance->config;
+        c = std::move(instanceConfig);
+        c.parseConfigFile();
+        BOOST_LOG_TRIVIAL(info)
+            << "XRay config " << c.xrayConfigPath << " loaded successfully. API endpoint: "
+            << c.apiAddress << ":"
+            << std::to_string(c.apiPort);
+
+        instance->xrayClient = std::make_unique<XRayClient>(c, geoIp.get());
+        if (c.stateFilePath.empty() || !instance->xrayClient->loadState(c.stateFilePath)) {
+            instance->xrayClient->backfill();
+        }
+        if (c.statsService && c.apiPort > 0) {
+            instance->statsClient = std::make_unique<XRayStatsClient>(c.apiAddress, c.apiPort);
+        }
+        accessLogPaths.push_back(c.accessLogPath);
+        instances.push_back(std::move(instance));
+    }
+    if (instances.size() > 1) {
+        unsigned int threads = std::min({ static_cast<unsigned int>(instances.size()),
+            std::max(std::thread::hardware_concurrency(), 1u), POOL_THREADS_LIMIT });
+        pool = std::make_unique<boost::asio::thread_pool>(threads);
+        BOOST_LOG_TRIVIAL(info) << "Monitoring " << instances.size() << " xray instances with " << threads << " threads";
+    }
 
     // Initialize components
-    xrayClient = std::make_unique<XRayClient>(config);
-    telegramBot = std::make_unique<TelegramBot>(config.telegramToken, config.telegramChannel);
+    if (!config.metricsListen.empty()) {
+        metricsServer = std::make_unique<MetricsServer>(config.metricsListen);
+    }
+    if (!config.agent.empty()) {
+        if (!config.telegramToken.empty()) {
+            BOOST_LOG_TRIVIAL(warning) << "Telegram options are ignored by an agent, the collector notifies";
+        }
+        telegramBot = std::make_unique<TelegramBot>("", "");
+        agent = std::make_unique<AgentClient>(config.agent, config.nodeName, config.fleetToken, config.spoolFilePath, config.agentCompress);
+        BOOST_LOG_TRIVIAL(info) << "Streaming events to the collector " << config.agent << " as " << config.nodeName;
+    }
+    else {
+        telegramBot = std::make_unique<TelegramBot>(config.telegramToken, config.telegramChannel);
+        if (config.telegramCommands) {
+            telegramBot->startCommands(config.telegramAdmins, commands::answer);
+            BOOST_LOG_TRIVIAL(info) << "Answering Telegram bot commands";
+        }
+    }
+    notifier = std::make_unique<Notifier>(*telegramBot, config.notifyWindow);
+    if (config.watch) {
+        try {
+            logWatcher = std::make_unique<LogWatcher>(accessLogPaths, config.debounce);
+            for (const auto& path : accessLogPaths) {
+                BOOST_LOG_TRIVIAL(info) << "Watching access log for changes: " << path;
+            }
+        }
+        catch (const std::exception& e) {
+            BOOST_LOG_TRIVIAL(warning)
+                << "Falling back to polling: "
+                << std::string(e.what());
+        }
+    }
+
+    if (!config.historyDir.empty()) {
+        history = std::make_unique<History>(config.historyDir, config.historyDays);
+    }
+
+    if (!config.collector.empty()) {
+        collector = std::make_unique<Collector>(config.collector, config.fleetToken, [this] {
+            if (logWatcher) {
+                logWatcher->wakeup();
+            }
+        });
+        if (geoIp) {
+            fleetGeoCache = std::make_unique<GeoCache>(*geoIp);
+        }
+    }
+
+    if (config.reloadInterval > 0 && !instances.empty()) {
+        std::vector<const Config*> configs;
+        for (const auto& instance : instances) {
+            configs.push_back(&instance->config);
+        }
+        configWatcher = std::make_unique<ConfigWatcher>(configs, config.reloadInterval, [this] {
+            // Applied right away instead of after the next log change
+            if (logWatcher) {
+                logWatcher->wakeup();
+            }
+        });
+    }
 
     // Setup signal handlers
     setupSignalHandlers();
@@ -72,20 +231,343 @@ void App::setupSignalHandlers() {
     g_appInstance = this;
     std::signal(SIGINT, App::signalHandler);
     std::signal(SIGTERM, App::signalHandler);
+    std::signal(SIGUSR1, App::signalHandler);
 }
 
 void App::stop() {
     shutdownRequested = true;
+    if (logWatcher) {
+        logWatcher->wakeup();
+    }
+}
+
+void App::waitNextIteration() {
+    if (logWatcher) {
+        // The timeout only matters for disconnection detection and collected notifications
+        int timeoutMs = static_cast<int>(config.interval) * 1000;
+        if (notifier->hasPending()) {
+            timeoutMs = std::min(timeoutMs, notifier->msUntilFlush());
+        }
+        logWatcher->wait(timeoutMs);
+        return;
+    }
+    // Sleep for interval, for feedback on SIGTERM, every second
+    for (unsigned int i = 0; i < config.interval && !shutdownRequested; ++i) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+}
+
+void App::saveState() {
+    for (const auto& instance : instances) {
+        const std::string& path = instance->config.stateFilePath;
+        if (path.empty()) {
+            continue;
+        }
+        try {
+            instance->xrayClient->saveState(path);
+            BOOST_LOG_TRIVIAL(trace) << "State saved to " << path;
+        }
+        catch (const std::exception& e) {
+            BOOST_LOG_TRIVIAL(error)
+                << "Error saving state: "
+                << std::string(e.what());
+        }
+    }
+}
+
+void App::processInstances() {
+    if (instances.empty()) {
+        // A collector only
+        return;
+    }
+    if (!pool) {
+        processInstance(*instances.front());
+        return;
+    }
+    std::latch done(static_cast<std::ptrdiff_t>(instances.size()));
+    for (auto& instance : instances) {
+        boost::asio::post(*pool, [this, &instance, &done] {
+            processInstance(*instance);
+            done.count_down();
+        });
+    }
+    done.wait();
+}
+
+void App::processInstance(Instance& instance) {
+    try {
+        if (instance.statsClient && std::chrono::steady_clock::now() - instance.lastStats >= std::chrono::seconds(config.interval)) {
+            queryStats(instance);
+            instance.lastStats = std::chrono::steady_clock::now();
+        }
+        instance.xrayClient->processAccessLog();
+    }
+    catch (const std::exception& e) {
+        // Not passed on: the other instances go on
+        BOOST_LOG_TRIVIAL(error)
+            << "Error processing " << instance.config.xrayConfigPath << ": "
+            << std::string(e.what());
+    }
+}
+
+void App::queryStats(Instance& instance) {
+    try {
+        instance.xrayClient->updateTraffic(instance.statsClient->queryUserTraffic());
+    }
+    catch (const std::exception& e) {
+        BOOST_LOG_TRIVIAL(debug)
+            << "Error querying XRay stats API: "
+            << std::string(e.what());
+    }
+}
+
+void App::reloadUsers() {
+    if (!configWatcher) {
+        return;
+    }
+    for (std::size_t i = 0; i < instances.size(); ++i) {
+        ConfigUpdate update = configWatcher->take(i);
+        if (!update.config) {
+            continue;
+        }
+        Instance& instance = *instances[i];
+        instance.config.users = update.config->users;
+        instance.config.userInbounds = update.config->userInbounds;
+        instance.config.outboundTags = update.config->outboundTags;
+        std::vector<Peer> removed = instance.xrayClient->reloadUsers(update.diff);
+        if (!removed.empty()) {
+            std::stringstream logMsg;
+            for (const auto& user : removed) {
+                reportDisconnection(user, logMsg);
+            }
+            BOOST_LOG_TRIVIAL(info) << logMsg.str();
+        }
+        sendUsersChangedMessage(instance.config.instance, update.diff);
+    }
+}
+
+void App::publishMetrics() {
+    auto snapshot = std::make_shared<metrics::Snapshot>();
+    snapshot->startedAt = startedAt;
+    snapshot->publishedAt = std::time(nullptr);
+    for (const auto& instance : instances) {
+        instance->xrayClient->collectMetrics(*snapshot);
+    }
+    if (collector) {
+        fleetState.collectMetrics(*snapshot);
+    }
+    metrics::publish(std::move(snapshot));
+}
+
+void App::notify(const std::string& text) {
+    if (!agent) {
+        notifier->send(text);
+        return;
+    }
+    if (text.empty()) {
+        return;
+    }
+    fleet::Event event;
+    event.kind = fleet::EventKind::Message;
+    event.time = std::time(nullptr);
+    event.text = text;
+    agent->send(std::move(event));
+}
+
+void App::forward(fleet::EventKind kind, const Peer& peer) {
+    fleet::Event event;
+    event.kind = kind;
+    event.time = peer.lastTime;
+    event.instance = peer.instance;
+    event.email = peer.email;
+    event.id = peer.id;
+    event.ip = peer.ip;
+    agent->send(std::move(event));
+}
+
+void App::forwardSuspicious() {
+    for (const auto& instance : instances) {
+        for (std::string_view email : instance->xrayClient->getSuspicious()) {
+            std::string key = instance->config.instance + "\n" + std::string(email);
+            if (!forwardedSuspicious.insert(key).second) {
+                continue;
+            }
+            fleet::Event event;
+            event.kind = fleet::EventKind::Suspicious;
+            event.time = std::time(nullptr);
+            event.instance = instance->config.instance;
+            event.email = std::string(email);
+            agent->send(std::move(event));
+        }
+    }
+}
+
+void App::forwardOnline() {
+    for (const auto& instance : instances) {
+        for (const auto& user : instance->xrayClient->getOnline()) {
+            forward(fleet::EventKind::Connected, user);
+        }
+    }
+}
+
+void App::processFleetEvents() {
+    std::stringstream suspiciousMsg;
+    std::stringstream logMsg;
+    std::time_t now = std::time(nullptr);
+    for (const auto& received : collector->take()) {
+        if (received.reset) {
+            for (const auto& departure : fleetState.dropNode(received.node)) {
+                reportFleetEvent(departure.node, departure.event, suspiciousMsg, logMsg);
+            }
+        }
+        else if (fleetState.apply(received.node, received.event, now)) {
+            reportFleetEvent(received.node, received.event, suspiciousMsg, logMsg);
+        }
+    }
+    // Of agents that are gone without reporting their disconnections
+    for (const auto& departure : fleetState.expire(now)) {
+        reportFleetEvent(departure.node, departure.event, suspiciousMsg, logMsg);
+    }
+    if (logMsg.tellp() > 0) {
+        BOOST_LOG_TRIVIAL(info) << logMsg.str();
+    }
+    if (suspiciousMsg.tellp() > 0) {
+        notifier->send("❓ *Users missing from the xray config are in access logs:*\n" + suspiciousMsg.str());
+    }
+    sendMultiNodeMessage();
+}
+
+void App::reportFleetEvent(const std::string& node, const fleet::Event& event, std::ostream& suspiciousMsg, std::ostream& logMsg) {
+    std::string location = FleetState::location(node, event.instance);
+    std::string label = utils::instanceLabel(location);
+    switch (event.kind) {
+    case fleet::EventKind::Connected:
+    case fleet::EventKind::Disconnected: {
+        Peer peer;
+        peer.instance = location;
+        peer.email = event.email;
+        peer.id = event.id;
+        peer.ip = event.ip;
+        peer.lastTime = event.time;
+        if (event.kind == fleet::EventKind::Connected) {
+            locate(peer);
+            notifier->connected(peer);
+            if (history) {
+                history->connected(peer);
+            }
+            logMsg << "New connection: ";
+        }
+        else {
+            notifier->disconnected(peer);
+            if (history) {
+                history->disconnected(peer);
+            }
+            logMsg << "Discconnection: ";
+        }
+        logMsg << label << peer.email << " (" << peer.ip << formatLocation(peer) << ") " << utils::formatTime(peer.lastTime) << " ";
+        break;
+    }
+    case fleet::EventKind::Suspicious:
+        suspiciousMsg << utils::escapeMDv2(label + event.email) << "\n";
+        BOOST_LOG_TRIVIAL(warning) << "Unknown user in the access log: " << label << event.email;
+        break;
+    case fleet::EventKind::Message:
+        notifier->send(utils::escapeMDv2("[" + node + "]") + "\n" + event.text);
+        break;
+    }
+}
+
+void App::locate(Peer& peer) {
+    IpAddress address;
+    if (!fleetGeoCache || !IpAddress::parse(peer.ip, address)) {
+        return;
+    }
+    const geoip::Location& location = fleetGeoCache->lookup(address);
+    if (location.empty()) {
+        return;
+    }
+    geoip::Location& last = fleetLocations[peer.email];
+    peer.locationChanged = geoip::moved(last, location);
+    last = location;
+    peer.location = location;
+}
+
+std::string App::formatLocation(const Peer& peer) {
+    std::string text = geoip::format(peer.location);
+    if (text.empty()) {
+        return "";
+    }
+    return ", " + text + (peer.locationChanged ? ", country changed" : "");
+}
+
+void App::sendMultiNodeMessage() {
+    auto users = fleetState.takeOverLimit();
+    if (users.empty()) {
+        return;
+    }
+    std::stringstream telegramMsg;
+    std::stringstream logMsg;
+    telegramMsg << "🌐 *Users are online on several nodes at once:*\n";
+    for (const auto& user : users) {
+        std::string nodes;
+        for (const auto& node : user.nodes) {
+            nodes += (nodes.empty() ? "" : ", ") + node;
+        }
+        telegramMsg << utils::escapeMDv2(user.email) << utils::escapeMDv2(" | ")
+            << utils::escapeMDv2(std::to_string(user.nodes.size()) + " nodes") << utils::escapeMDv2(" | ")
+            << utils::escapeMDv2(nodes) << "\n";
+        logMsg << "Online on several nodes: " << user.email << " (" << user.nodes.size() << "): " << nodes << " ";
+    }
+    notifier->send(telegramMsg.str());
+    BOOST_LOG_TRIVIAL(warning) << logMsg.str();
+}
+
+void App::logProfile() {
+    // The report is only built when it would be written
+    if (config.logLevelStr == "trace" || config.logLevelStr == "debug") {
+        BOOST_LOG_TRIVIAL(debug) << profiler::report();
+    }
 }
 
 void App::signalHandler(int signal) {
-    if (g_appInstance) {
-        g_appInstance->stop();
+    if (!g_appInstance) {
+        return;
+    }
+    if (signal == SIGUSR1) {
+        // Profile report out of turn
+        g_appInstance->reportRequested = true;
+        if (g_appInstance->logWatcher) {
+            g_appInstance->logWatcher->wakeup();
+        }
+        return;
     }
+    g_appInstance->stop();
 }
 
 void App::sendStartupMessage() {
-    auto users = xrayClient->getConnected();
+    std::vector<Peer> users;
+    for (const auto& instance : instances) {
+        auto online = instance->xrayClient->getOnline();
+        users.insert(users.end(), std::make_move_iterator(online.begin()), std::make_move_iterator(online.end()));
+    }
+    if (history) {
+        // The real start is unknown, the session is recorded from the last activity on
+        for (const auto& user : users) {
+            history->connected(user);
+        }
+    }
+
+    if (agent) {
+        // The collector reports them as connections of this node
+        for (const auto& user : users) {
+            forward(fleet::EventKind::Connected, user);
+        }
+        notify("🚀 *Xray connection monitoring has been launched*");
+        BOOST_LOG_TRIVIAL(info)
+            << "Xray connection monitoring has been launched, " << users.size()
+            << " connected users are sent to the collector";
+        return;
+    }
 
     std::stringstream telegramMsg;
     std::stringstream logMsg;
@@ -102,68 +584,232 @@ void App::sendStartupMessage() {
 
     bool firstUser = true;
     for (const auto& user : users) {
-        telegramMsg << utils::escapeMDv2(user.email) << utils::escapeMDv2(" | ")
+        std::string label = utils::instanceLabel(user.instance);
+        telegramMsg << utils::escapeMDv2(label + user.email) << utils::escapeMDv2(" | ")
             << utils::escapeMDv2(user.id) << utils::escapeMDv2(" | ")
             << utils::escapeMDv2(user.ip) << "\n";
         if (!firstUser) {
             logMsg << ", ";
         }
-        logMsg << user.email;
+        logMsg << label << user.email;
         firstUser = false;
     }
 
-    if (telegramBot->isEnabled()) {
-        telegramBot->sendMessage(telegramMsg.str());
-    }
+    notifier->send(telegramMsg.str());
 
     BOOST_LOG_TRIVIAL(info) << logMsg.str();
 }
 
 void App::sendNewConnectionMessage() {
-    auto users = xrayClient->getConnected();
-    std::stringstream telegramMsg;
     std::stringstream logMsg;
-    telegramMsg << "🔗 *Users have connected to the xray server:*\n";
-    for (const auto& user : users) {
-        telegramMsg << utils::escapeMDv2(user.email) << utils::escapeMDv2(" | ")
-            << utils::escapeMDv2(user.id) << utils::escapeMDv2(" | ")
-            << utils::escapeMDv2(user.ip) << utils::escapeMDv2(" | ")
-            << utils::escapeMDv2(utils::formatTime(user.lastTime)) << "\n";
-
-        logMsg << "New connection: "
-            << user.email
-            << " (" << user.ip << ") "
-            << utils::formatTime(user.lastTime);
+    bool any = false;
+    for (const auto& instance : instances) {
+        for (const auto& user : instance->xrayClient->getConnected()) {
+            if (history) {
+                history->connected(user);
+            }
+            if (agent) {
+                forward(fleet::EventKind::Connected, user);
+            }
+            else {
+                notifier->connected(user);
+            }
 
-    }
-    if (!users.empty()) {
-        if (telegramBot->isEnabled()) {
-            telegramBot->sendMessage(telegramMsg.str());
+            logMsg << "New connection: "
+                << utils::instanceLabel(user.instance) << user.email
+                << " (" << user.ip << formatLocation(user) << ") "
+                << utils::formatTime(user.lastTime);
+            any = true;
         }
+    }
+    if (any) {
         BOOST_LOG_TRIVIAL(info) << logMsg.str();
     }
 }
 
 void App::sendDisconnectionMessage() {
-    auto users = xrayClient->getDisconnected();
+    std::stringstream logMsg;
+    bool any = false;
+    for (const auto& instance : instances) {
+        for (const auto& user : instance->xrayClient->getDisconnected()) {
+            reportDisconnection(user, logMsg);
+            any = true;
+        }
+    }
+    if (any) {
+        BOOST_LOG_TRIVIAL(info) << logMsg.str();
+    }
+}
+
+void App::reportDisconnection(const Peer& user, std::ostream& logMsg) {
+    if (history) {
+        history->disconnected(user);
+    }
+    if (agent) {
+        forward(fleet::EventKind::Disconnected, user);
+    }
+    else {
+        notifier->disconnected(user);
+    }
+
+    logMsg << "Discconnection: "
+        << utils::instanceLabel(user.instance) << user.email
+        << " (" << user.ip << ") "
+        << utils::formatTime(user.lastTime);
+}
+
+void App::sendConcurrentIpsMessage() {
+    const std::size_t shownIps = 10;
+    std::vector<Peer> users;
+    for (const auto& instance : instances) {
+        auto concurrent = instance->xrayClient->getConcurrent();
+        users.insert(users.end(), concurrent.begin(), concurrent.end());
+    }
+    if (users.empty()) {
+        return;
+    }
     std::stringstream telegramMsg;
     std::stringstream logMsg;
-    telegramMsg << "❌ *Users have disconnected from the xray server:*\n";
+    telegramMsg << "⚠️ *Users are online from too many IP addresses:*\n";
     for (const auto& user : users) {
-        telegramMsg << utils::escapeMDv2(user.email) << utils::escapeMDv2(" | ")
-            << utils::escapeMDv2(user.id) << utils::escapeMDv2(" | ")
-            << utils::escapeMDv2(user.ip) << "\n";
+        std::string ips;
+        std::size_t count = 0;
+        user.ips.forEach([&](const IpAddress& address, std::time_t) {
+            if (count++ < shownIps) {
+                ips += (ips.empty() ? "" : ", ") + address.toString();
+            }
+        });
+        if (count > shownIps) {
+            ips += ", ...";
+        }
+        std::string label = utils::instanceLabel(user.instance);
+        telegramMsg << utils::escapeMDv2(label + user.email) << utils::escapeMDv2(" | ")
+            << utils::escapeMDv2(std::to_string(count) + " IPs") << utils::escapeMDv2(" | ")
+            << utils::escapeMDv2(ips) << "\n";
 
-        logMsg << "Discconnection: "
-            << user.email
-            << " (" << user.ip << ") "
-            << utils::formatTime(user.lastTime);
+        logMsg << "Too many IPs: "
+            << label << user.email
+            << " (" << count << "): " << ips << " ";
+    }
+    notify(telegramMsg.str());
+    BOOST_LOG_TRIVIAL(warning) << logMsg.str();
+}
+
+void App::sendConnectionRateMessage() {
+    std::vector<RateAlert> alerts;
+    for (const auto& instance : instances) {
+        auto abnormal = instance->xrayClient->getAbnormalRates();
+        alerts.insert(alerts.end(), abnormal.begin(), abnormal.end());
+    }
+    if (alerts.empty()) {
+        return;
+    }
+    std::stringstream telegramMsg;
+    std::stringstream logMsg;
+    telegramMsg << "⚠️ *Users have an abnormal connection rate:*\n";
+    for (const auto& alert : alerts) {
+        std::string label = utils::instanceLabel(alert.peer.instance);
+        std::string rate = std::to_string(alert.connections) + " connections in " + alert.window
+            + " (limit " + std::to_string(alert.limit) + ")";
+        telegramMsg << utils::escapeMDv2(label + alert.peer.email) << utils::escapeMDv2(" | ")
+            << utils::escapeMDv2(rate) << utils::escapeMDv2(" | ")
+            << utils::escapeMDv2(alert.peer.ip) << "\n";
 
+        logMsg << "Abnormal connection rate: "
+            << label << alert.peer.email
+            << " " << rate << " ";
     }
-    if (!users.empty()) {
-        if (telegramBot->isEnabled()) {
-            telegramBot->sendMessage(telegramMsg.str());
+    notify(telegramMsg.str());
+    BOOST_LOG_TRIVIAL(warning) << logMsg.str();
+}
+
+void App::sendProbesMessage() {
+    std::stringstream telegramMsg;
+    std::stringstream logMsg;
+    for (const auto& instance : instances) {
+        std::string label = utils::instanceLabel(instance->config.instance);
+        for (const auto& offender : instance->xrayClient->getProbes()) {
+            telegramMsg << utils::escapeMDv2(label + offender.source) << utils::escapeMDv2(" | ")
+                << utils::escapeMDv2(std::to_string(offender.attempts) + " attempts") << utils::escapeMDv2(" | ")
+                << utils::escapeMDv2(offender.example) << "\n";
+
+            logMsg << "Rejected or unknown connections: "
+                << label << offender.source
+                << " (" << offender.attempts << "): " << offender.example << " ";
         }
-        BOOST_LOG_TRIVIAL(info) << logMsg.str();
     }
+    if (telegramMsg.tellp() == 0) {
+        return;
+    }
+    notify("🚫 *Sources with many rejected or unknown connections:*\n" + telegramMsg.str());
+    BOOST_LOG_TRIVIAL(warning) << logMsg.str();
+}
+
+void App::sendDestinationsMessage() {
+    const std::size_t shown = 10;
+    const std::size_t shownUserHosts = 3;
+    auto formatTop = [](const std::vector<TopDestinations::Count>& counts, std::size_t limit) {
+        std::string text;
+        for (std::size_t i = 0; i < counts.size() && i < limit; ++i) {
+            text += utils::escapeMDv2(counts[i].name + " | " + std::to_string(counts[i].count)) + "\n";
+        }
+        return text;
+    };
+    std::stringstream telegramMsg;
+    for (const auto& instance : instances) {
+        const TopDestinations& destinations = instance->xrayClient->getDestinations();
+        auto hosts = destinations.hosts();
+        if (hosts.empty()) {
+            continue;
+        }
+        std::string label = utils::instanceLabel(instance->config.instance);
+        telegramMsg << "\n*" << utils::escapeMDv2(label + "Hosts") << "*\n" << formatTop(hosts, shown)
+            << "*" << utils::escapeMDv2(label + "Ports") << "*\n" << formatTop(destinations.ports(), shown)
+            << "*" << utils::escapeMDv2(label + "Busiest users") << "*\n";
+        for (UserId user : destinations.busiest(shown)) {
+            std::string top;
+            auto userHosts = destinations.hosts(user);
+            for (std::size_t i = 0; i < userHosts.size() && i < shownUserHosts; ++i) {
+                top += (top.empty() ? "" : ", ") + userHosts[i].name;
+            }
+            telegramMsg << utils::escapeMDv2(instance->xrayClient->getEmail(user) + " | "
+                + std::to_string(destinations.lines(user)) + " connections | " + top) << "\n";
+        }
+        instance->xrayClient->clearDestinations();
+    }
+    if (telegramMsg.tellp() == 0) {
+        return;
+    }
+    BOOST_LOG_TRIVIAL(info) << "Sending top destinations of the last " << config.destinationsInterval << " h";
+    notify("📈 *Top destinations of the last " + std::to_string(config.destinationsInterval) + " h:*\n" + telegramMsg.str());
+}
+
+void App::sendUsersChangedMessage(const std::string& instance, const UsersDiff& diff) {
+    if (diff.empty()) {
+        return;
+    }
+    std::stringstream telegramMsg;
+    std::stringstream logMsg;
+    auto list = [&](const char* title, const char* logTitle, const std::vector<User>& users) {
+        if (users.empty()) {
+            return;
+        }
+        if (telegramMsg.tellp() > 0) {
+            telegramMsg << "\n";
+        }
+        telegramMsg << title << "\n";
+        logMsg << logTitle;
+        for (const auto& user : users) {
+            telegramMsg << utils::escapeMDv2(utils::instanceLabel(instance) + user.email) << utils::escapeMDv2(" | ")
+                << utils::escapeMDv2(user.protocol) << utils::escapeMDv2(" | ")
+                << utils::escapeMDv2(user.id) << "\n";
+            logMsg << " " << utils::instanceLabel(instance) << user.email;
+        }
+        logMsg << ". ";
+    };
+    list("➕ *Users have been added to the xray config:*", "Users added:", diff.added);
+    list("➖ *Users have been removed from the xray config:*", "Users removed:", diff.removed);
+    list("✏️ *Users have been changed in the xray config:*", "Users changed:", diff.changed);
+    notify(telegramMsg.str());
+    BOOST_LOG_TRIVIAL(info) << logMsg.str();
 }
@@ -4,7 +4,25 @@
 #include "Config.h"
 #include "XRayClient.h"
 #include "TelegramBot.h"
+#include "Notifier.h"
+#include "LogWatcher.h"
+#include "MetricsServer.h"
+#include "ConfigWatcher.h"
+#include "Agent.h"
+#include "Collector.h"
+#include "FleetState.h"
+#include "History.h"
+#include "GeoIp.h"
 #include <atomic>
+#include <chrono>
+#include <ctime>
+#include <memory>
+#include <ostream>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/asio/thread_pool.hpp>
 
 
 class App {
@@ -16,16 +34,74 @@ public:
     void stop();
 
 private:
+    // One monitored xray process
+    struct Instance {
+        Config config;
+        std::unique_ptr<XRayClient> xrayClient;
+        std::unique_ptr<XRayStatsClient> statsClient;
+        std::chrono::steady_clock::time_point lastStats;
+    };
+
     Config config;
-    std::unique_ptr<XRayClient> xrayClient;
+    // Shared by the clients of the instances, so created before them
+    std::unique_ptr<GeoIp> geoIp;
+    // Never resized after initialize(), the clients keep references to the configs
+    std::vector<std::unique_ptr<Instance>> instances;
+    // Processes several instances in parallel, not created for a single one
+    std::unique_ptr<boost::asio::thread_pool> pool;
     std::unique_ptr<TelegramBot> telegramBot;
+    std::unique_ptr<Notifier> notifier;
+    std::unique_ptr<LogWatcher> logWatcher;
+    std::unique_ptr<MetricsServer> metricsServer;
+    std::unique_ptr<ConfigWatcher> configWatcher;
+    std::unique_ptr<History> history;
+    // In agent mode events go to the collector instead of the notifier
+    std::unique_ptr<AgentClient> agent;
+    std::unique_ptr<Collector> collector;
+    FleetState fleetState;
+    // Collector: locations of connections of agents, last known one of each user
+    std::unique_ptr<GeoCache> fleetGeoCache;
+    std::unordered_map<std::string, geoip::Location> fleetLocations;
+    // Instance and email of unknown users already sent to the collector
+    std::set<std::string> forwardedSuspicious;
+    std::time_t startedAt = std::time(nullptr);
     std::atomic<bool> shutdownRequested{ false };
+    std::atomic<bool> reportRequested{ false };
 
     void initialize();
     void setupSignalHandlers();
+    void waitNextIteration();
+    void saveState();
+    void logProfile();
+    void processInstances();
+    void processInstance(Instance& instance);
+    void queryStats(Instance& instance);
+    void reloadUsers();
+    void publishMetrics();
+    // Sends right away, or forwards to the collector in agent mode
+    void notify(const std::string& text);
+    void forward(fleet::EventKind kind, const Peer& peer);
+    void forwardSuspicious();
+    // Agent: repeats the connections of online users, so the collector keeps them
+    void forwardOnline();
+    void processFleetEvents();
+    // Collector: notifier, history and the log line of one event of an agent
+    void reportFleetEvent(const std::string& node, const fleet::Event& event, std::ostream& suspiciousMsg, std::ostream& logMsg);
+    // Collector: fills the location of a connection of an agent
+    void locate(Peer& peer);
+    // ", DE AS3320 Deutsche Telekom AG" for log lines, empty if unknown
+    static std::string formatLocation(const Peer& peer);
+    void sendMultiNodeMessage();
     void sendStartupMessage();
     void sendNewConnectionMessage();
     void sendDisconnectionMessage();
+    // History, collector or notifier and the log line of one disconnection
+    void reportDisconnection(const Peer& user, std::ostream& logMsg);
+    void sendConcurrentIpsMessage();
+    void sendConnectionRateMessage();
+    void sendProbesMessage();
+    void sendDestinationsMessage();
+    void sendUsersChangedMessage(const std::string& instance, const UsersDiff& diff);
     static void signalHandler(int signal);
 };
 
@@ -0,0 +1,165 @@
+#include "Backfill.h"
+#include "TimestampDecoder.h"
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+namespace {
+    const std::size_t MIN_CHUNK_SIZE = 4 * 1024 * 1024;
+    const std::size_t SEARCH_GRANULARITY = 64 * 1024;
+
+    // Start of the line following `pos` (or `pos` itself at line start)
+    std::size_t alignToLine(const char* data, std::size_t pos, std::size_t end) {
+        if (pos == 0 || pos >= end) {
+            return std::min(pos, end);
+        }
+        if (data[pos - 1] == '\n') {
+            return pos;
+        }
+        const void* nl = std::memchr(data + pos, '\n', end - pos);
+        return nl ? static_cast<const char*>(nl) - data + 1 : end;
+    }
+
+    // Timestamp of the first line at or after `pos` which has one
+    std::int64_t timestampAt(const char* data, std::size_t pos, std::size_t end, TimestampDecoder& decoder) {
+        while (pos < end) {
+            const char* nl = static_cast<const char*>(std::memchr(data + pos, '\n', end - pos));
+            std::size_t lineEnd = nl ? nl - data : end;
+            std::int64_t ts = decoder.decode(std::string_view(data + pos, lineEnd - pos));
+            if (ts != 0) {
+                return ts;
+            }
+            pos = lineEnd + 1;
+        }
+        return INT64_MAX;
+    }
+
+    // First line which may be newer than `since`, lines are in time order
+    std::size_t findStart(const char* data, std::size_t end, std::int64_t since) {
+        TimestampDecoder decoder;
+        std::size_t lo = 0;
+        std::size_t hi = end;
+        while (hi - lo > SEARCH_GRANULARITY) {
+            std::size_t mid = alignToLine(data, lo + (hi - lo) / 2, end);
+            if (mid >= hi) {
+                break;
+            }
+            if (timestampAt(data, mid, end, decoder) < since) {
+                lo = mid;
+            }
+            else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+    struct ChunkResult {
+        std::unordered_map<std::string, backfill::Event> latest;
+        std::size_t lines = 0;
+    };
+
+    void scanChunk(const char* data, std::size_t begin, std::size_t end, std::int64_t since,
+        const backfill::Filter& filter, ChunkResult& result) {
+        TimestampDecoder decoder;
+        accesslog::Entry entry;
+        std::size_t pos = begin;
+        while (pos < end) {
+            const char* nl = static_cast<const char*>(std::memchr(data + pos, '\n', end - pos));
+            std::size_t lineEnd = nl ? nl - data : end;
+            std::string_view line(data + pos, lineEnd - pos);
+            pos = lineEnd + 1;
+            ++result.lines;
+
+            if (!accesslog::parseLine(line, entry) || !filter(entry)) {
+                continue;
+            }
+            std::int64_t ts = decoder.decode(entry.timestamp);
+            if (ts < since) {
+                continue;
+            }
+            auto& event = result.latest[std::string(entry.email)];
+            if (ts >= event.time) {
+                event.time = ts;
+                event.ip.assign(entry.ip);
+            }
+        }
+    }
+}
+
+backfill::Result backfill::scan(const std::string& path, std::int64_t sinceMicros, const Filter& filter, unsigned int threads) {
+    Result result;
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+    }
+    struct stat st {};
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Cannot stat " + path + ": " + std::strerror(errno));
+    }
+    result.device = st.st_dev;
+    result.inode = st.st_ino;
+    std::size_t size = static_cast<std::size_t>(st.st_size);
+    if (size == 0) {
+        ::close(fd);
+        return result;
+    }
+
+    void* mapped = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        throw std::runtime_error("Cannot mmap " + path + ": " + std::strerror(errno));
+    }
+    const char* data = static_cast<const char*>(mapped);
+
+    // An incomplete last line is left to the incremental reader
+    std::size_t end = size;
+    while (end > 0 && data[end - 1] != '\n') --end;
+    result.endOffset = static_cast<off_t>(end);
+
+    std::size_t begin = findStart(data, end, sinceMicros);
+    ::madvise(const_cast<char*>(data) + (begin & ~static_cast<std::size_t>(4095)),
+        end - (begin & ~static_cast<std::size_t>(4095)), MADV_SEQUENTIAL);
+    result.bytes = end - begin;
+
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    std::size_t chunks = std::clamp<std::size_t>(result.bytes / MIN_CHUNK_SIZE, 1, threads);
+    std::vector<std::size_t> bounds{ begin };
+    for (std::size_t i = 1; i < chunks; ++i) {
+        bounds.push_back(std::max(bounds.back(), alignToLine(data, begin + result.bytes * i / chunks, end)));
+    }
+    bounds.push_back(end);
+
+    std::vector<ChunkResult> partial(chunks);
+    std::vector<std::thread> workers;
+    for (std::size_t i = 1; i < chunks; ++i) {
+        workers.emplace_back(scanChunk, data, bounds[i], bounds[i + 1], sinceMicros, std::cref(filter), std::ref(partial[i]));
+    }
+    scanChunk(data, bounds[0], bounds[1], sinceMicros, filter, partial[0]);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    ::munmap(mapped, size);
+
+    for (auto& chunk : partial) {
+        result.lines += chunk.lines;
+        for (auto& [email, event] : chunk.latest) {
+            auto [it, inserted] = result.latest.try_emplace(email, event);
+            if (!inserted && event.time >= it->second.time) {
+                it->second = std::move(event);
+            }
+        }
+    }
+    return result;
+}
@@ -0,0 +1,38 @@
+#ifndef BACKFILL_H
+#define BACKFILL_H
+
+#include "accesslog.h"
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <sys/types.h>
+
+
+// Startup scan of the whole access log: the file is memory mapped,
+// the part newer than `since` is found by binary search over timestamps
+// and parsed in parallel, newline aligned chunks.
+namespace backfill {
+    struct Event {
+        std::int64_t time = 0;
+        std::string ip;
+    };
+
+    struct Result {
+        // Latest event per email
+        std::unordered_map<std::string, Event> latest;
+        std::size_t bytes = 0;
+        std::size_t lines = 0;
+        // Position right after the last complete line
+        off_t endOffset = 0;
+        dev_t device = 0;
+        ino_t inode = 0;
+    };
+
+    // Called from several threads at once
+    using Filter = std::function<bool(const accesslog::Entry&)>;
+
+    Result scan(const std::string& path, std::int64_t sinceMicros, const Filter& filter, unsigned int threads = 0);
+}
+
+#endif
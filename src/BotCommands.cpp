@@ -0,0 +1,204 @@
+#include "BotCommands.h"
+#include "Metrics.h"
+#include "Notifier.h"
+#include "utils.h"
+#include <algorithm>
+#include <sstream>
+#include <tuple>
+
+
+namespace {
+    const char* HELP =
+        "/online - users connected now\n"
+        "/user <email> - state of one user\n"
+        "/suspicious - unknown emails in the access log\n"
+        "/top [email] - most connected destinations\n"
+        "/stats - counters of the monitor";
+
+    std::string formatRates(const metrics::UserState& user) {
+        if (user.uplinkRate <= 0 && user.downlinkRate <= 0) {
+            return "";
+        }
+        return " | ↑" + utils::formatBytes(user.uplinkRate) + "/s ↓" + utils::formatBytes(user.downlinkRate) + "/s";
+    }
+
+    std::string formatDuration(std::time_t seconds) {
+        std::ostringstream out;
+        if (seconds >= 86400) {
+            out << seconds / 86400 << "d ";
+        }
+        if (seconds >= 3600) {
+            out << seconds % 86400 / 3600 << "h ";
+        }
+        out << seconds % 3600 / 60 << "m";
+        return out.str();
+    }
+
+    std::vector<std::string> reply(const std::string& text) {
+        return Notifier::split(text);
+    }
+
+    std::vector<std::string> online(const metrics::Snapshot& snapshot) {
+        std::vector<const metrics::UserState*> users;
+        for (const auto& user : snapshot.users) {
+            if (user.online) {
+                users.push_back(&user);
+            }
+        }
+        if (users.empty()) {
+            return reply(utils::escapeMDv2("Nobody is online"));
+        }
+        std::sort(users.begin(), users.end(), [](const auto* a, const auto* b) {
+            return std::tie(a->email, a->instance) < std::tie(b->email, b->instance);
+        });
+        std::ostringstream text;
+        text << "🟢 *Online: " << users.size() << "*\n";
+        for (const auto* user : users) {
+            text << utils::escapeMDv2(utils::instanceLabel(user->instance) + user->email + " | " + user->ip + formatRates(*user)) << "\n";
+        }
+        return reply(text.str());
+    }
+
+    std::vector<std::string> user(const metrics::Snapshot& snapshot, const std::string& email) {
+        if (email.empty()) {
+            return reply(utils::escapeMDv2("Usage: /user <email>"));
+        }
+        std::string wanted = utils::toLower(email);
+        std::ostringstream text;
+        for (const auto& user : snapshot.users) {
+            if (utils::toLower(user.email) != wanted) {
+                continue;
+            }
+            text << (user.online ? "🟢" : "⚪") << " *"
+                << utils::escapeMDv2(utils::instanceLabel(user.instance) + user.email) << "*\n"
+                << utils::escapeMDv2("ID: " + user.id) << "\n"
+                << utils::escapeMDv2(std::string(user.online ? "Online" : "Offline") + ", last seen "
+                    + (user.lastTime != 0 ? utils::formatTime(user.lastTime) : "never")) << "\n"
+                << utils::escapeMDv2("Connections: " + std::to_string(user.connections) + formatRates(user)) << "\n";
+            text << utils::escapeMDv2("Connection rate: " + std::to_string(user.connections1m) + " / 1m, "
+                + std::to_string(user.connections5m) + " / 5m, " + std::to_string(user.connections1h) + " / 1h") << "\n";
+            if (!user.location.empty()) {
+                text << utils::escapeMDv2("Location: " + user.location) << "\n";
+            }
+            if (!user.addresses.empty()) {
+                text << utils::escapeMDv2("Addresses (" + std::to_string(user.addresses.size()) + "):") << "\n";
+                for (const auto& address : user.addresses) {
+                    text << utils::escapeMDv2("  " + address.toString()) << "\n";
+                }
+            }
+            text << "\n";
+        }
+        if (text.tellp() == 0) {
+            return reply(utils::escapeMDv2("Unknown user " + email));
+        }
+        return reply(text.str());
+    }
+
+    std::vector<std::string> suspicious(const metrics::Snapshot& snapshot) {
+        if (snapshot.suspicious.empty()) {
+            return reply(utils::escapeMDv2("No unknown emails seen"));
+        }
+        std::vector<const metrics::LineCount*> entries;
+        for (const auto& entry : snapshot.suspicious) {
+            entries.push_back(&entry);
+        }
+        std::sort(entries.begin(), entries.end(), [](const auto* a, const auto* b) { return a->lines > b->lines; });
+        std::ostringstream text;
+        text << "⚠️ *Unknown emails: " << entries.size() << "*\n";
+        for (const auto* entry : entries) {
+            text << utils::escapeMDv2(utils::instanceLabel(entry->instance) + entry->name + " | "
+                + std::to_string(entry->lines) + " lines") << "\n";
+        }
+        return reply(text.str());
+    }
+
+    std::string formatCounts(std::vector<metrics::LineCount> counts) {
+        const std::size_t shown = 10;
+        // Each instance is sorted, together they are not
+        std::stable_sort(counts.begin(), counts.end(), [](const auto& a, const auto& b) { return a.lines > b.lines; });
+        std::string text;
+        for (std::size_t i = 0; i < counts.size() && i < shown; ++i) {
+            text += utils::escapeMDv2(utils::instanceLabel(counts[i].instance) + counts[i].name + " | " + std::to_string(counts[i].lines)) + "\n";
+        }
+        return text;
+    }
+
+    std::vector<std::string> top(const metrics::Snapshot& snapshot, const std::string& email) {
+        std::ostringstream text;
+        if (email.empty()) {
+            if (snapshot.hosts.empty()) {
+                return reply(utils::escapeMDv2("No destinations counted yet"));
+            }
+            text << "*Hosts*\n" << formatCounts(snapshot.hosts)
+                << "*Ports*\n" << formatCounts(snapshot.ports);
+            return reply(text.str());
+        }
+        std::string wanted = utils::toLower(email);
+        for (const auto& user : snapshot.users) {
+            if (utils::toLower(user.email) != wanted || user.hosts.empty()) {
+                continue;
+            }
+            text << "*" << utils::escapeMDv2(utils::instanceLabel(user.instance) + user.email) << "*\n";
+            for (const auto& host : user.hosts) {
+                text << utils::escapeMDv2(host.name + " | " + std::to_string(host.lines)) << "\n";
+            }
+            std::string ports;
+            for (const auto& port : user.ports) {
+                ports += (ports.empty() ? "Ports: " : ", ") + port.name + " (" + std::to_string(port.lines) + ")";
+            }
+            text << utils::escapeMDv2(ports) << "\n\n";
+        }
+        if (text.tellp() == 0) {
+            return reply(utils::escapeMDv2("No destinations of " + email));
+        }
+        return reply(text.str());
+    }
+
+    std::vector<std::string> stats(const metrics::Snapshot& snapshot) {
+        const auto& counters = metrics::counters();
+        std::time_t now = std::time(nullptr);
+        std::size_t online = std::count_if(snapshot.users.begin(), snapshot.users.end(),
+            [](const auto& user) { return user.online; });
+        std::ostringstream text;
+        text << "Uptime: " << formatDuration(now - snapshot.startedAt) << "\n"
+            << "Users online: " << online << " of " << snapshot.users.size() << "\n"
+            << "Lines read: " << counters.linesRead.load(std::memory_order_relaxed)
+            << ", parsed: " << counters.linesParsed.load(std::memory_order_relaxed)
+            << ", rejected: " << counters.linesRejected.load(std::memory_order_relaxed) << "\n"
+            << "Log read: " << utils::formatBytes(static_cast<double>(counters.bytesRead.load(std::memory_order_relaxed))) << "\n"
+            << "Connections: " << counters.connections.load(std::memory_order_relaxed)
+            << ", disconnections: " << counters.disconnections.load(std::memory_order_relaxed) << "\n"
+            << "Notifications sent: " << counters.notificationsSent.load(std::memory_order_relaxed)
+            << ", failed: " << counters.notificationsFailed.load(std::memory_order_relaxed) << "\n"
+            << "State age: " << std::max<std::time_t>(0, now - snapshot.publishedAt) << " s";
+        return reply("📊 *Monitor*\n" + utils::escapeMDv2(text.str()));
+    }
+}
+
+namespace commands {
+    std::vector<std::string> answer(const std::string& command, const std::string& argument) {
+        std::shared_ptr<const metrics::Snapshot> snapshot = metrics::current();
+        if (command == "help" || command == "start") {
+            return reply(utils::escapeMDv2(HELP));
+        }
+        if (!snapshot) {
+            return reply(utils::escapeMDv2("The monitor is starting, try again later"));
+        }
+        if (command == "online") {
+            return online(*snapshot);
+        }
+        if (command == "user") {
+            return user(*snapshot, argument);
+        }
+        if (command == "suspicious") {
+            return suspicious(*snapshot);
+        }
+        if (command == "top") {
+            return top(*snapshot, argument);
+        }
+        if (command == "stats") {
+            return stats(*snapshot);
+        }
+        return reply(utils::escapeMDv2("Unknown command /" + command + "\n" + HELP));
+    }
+}
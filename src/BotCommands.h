@@ -0,0 +1,16 @@
+#ifndef BOTCOMMANDS_H
+#define BOTCOMMANDS_H
+
+#include <string>
+#include <vector>
+
+
+// Answers of the Telegram bot commands. They are built from the snapshot
+// published by the main loop (metrics::current()), so a command never
+// waits for the main thread and never reads the access log.
+namespace commands {
+    // MarkdownV2 messages, each within the Telegram limit
+    std::vector<std::string> answer(const std::string& command, const std::string& argument);
+}
+
+#endif
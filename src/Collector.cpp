@@ -0,0 +1,201 @@
+#include "Collector.h"
+#include "utils.h"
+#include <memory>
+#include <openssl/crypto.h>
+#include <stdexcept>
+#include <boost/log/trivial.hpp>
+
+
+namespace net = boost::asio;
+using tcp = net::ip::tcp;
+
+// One connected agent: Hello, then Batch after Batch, each answered right away
+class CollectorSession : public std::enable_shared_from_this<CollectorSession> {
+public:
+    CollectorSession(Collector& collector, tcp::socket socket)
+        : collector(collector), socket(std::move(socket)) {}
+
+    void start() {
+        boost::system::error_code ec;
+        // Agents may have nothing to say for hours
+        socket.set_option(net::socket_base::keep_alive(true), ec);
+        peer = socket.remote_endpoint(ec);
+        readHeader();
+    }
+
+private:
+    Collector& collector;
+    tcp::socket socket;
+    tcp::endpoint peer;
+    char header[fleet::HEADER_SIZE];
+    std::string payload;
+    std::string reply;
+    // Empty until Hello
+    std::string node;
+
+    void readHeader() {
+        net::async_read(socket, net::buffer(header),
+            [self = shared_from_this()](boost::system::error_code ec, std::size_t) {
+                if (ec) {
+                    self->closed(ec);
+                    return;
+                }
+                fleet::FrameType type;
+                std::uint32_t size = 0;
+                try {
+                    fleet::parseHeader(self->header, type, size);
+                }
+                catch (const std::exception& e) {
+                    self->fail(e);
+                    return;
+                }
+                self->readPayload(type, size);
+            });
+    }
+
+    void readPayload(fleet::FrameType type, std::uint32_t size) {
+        payload.resize(size);
+        net::async_read(socket, net::buffer(payload),
+            [self = shared_from_this(), type](boost::system::error_code ec, std::size_t) {
+                if (ec) {
+                    self->closed(ec);
+                    return;
+                }
+                try {
+                    self->handle(type);
+                }
+                catch (const std::exception& e) {
+                    self->fail(e);
+                    return;
+                }
+                net::async_write(self->socket, net::buffer(self->reply),
+                    [self](boost::system::error_code ec, std::size_t) {
+                        if (ec) {
+                            self->closed(ec);
+                            return;
+                        }
+                        self->readHeader();
+                    });
+            });
+    }
+
+    void handle(fleet::FrameType type) {
+        if (type == fleet::FrameType::Hello && node.empty()) {
+            fleet::Hello hello = fleet::parseHello(payload);
+            if (!collector.isAuthorized(hello.token)) {
+                throw std::runtime_error("Wrong fleet token of agent " + hello.node);
+            }
+            node = hello.node;
+            reply = fleet::welcome(collector.welcome(hello));
+            BOOST_LOG_TRIVIAL(info) << "Agent " << node << " connected from " << peer;
+        }
+        else if (type == fleet::FrameType::Batch && !node.empty()) {
+            reply = fleet::ack(collector.receive(node, fleet::parseBatch(payload)));
+        }
+        else {
+            throw std::runtime_error("Unexpected frame");
+        }
+    }
+
+    void closed(const boost::system::error_code& ec) {
+        if (ec == net::error::operation_aborted) {
+            return;
+        }
+        if (!node.empty()) {
+            BOOST_LOG_TRIVIAL(info) << "Agent " << node << " disconnected: " << ec.message();
+        }
+    }
+
+    void fail(const std::exception& e) {
+        BOOST_LOG_TRIVIAL(warning)
+            << "Dropping agent connection from " << peer << ": "
+            << std::string(e.what());
+    }
+};
+
+Collector::Collector(const std::string& listen, const std::string& token, std::function<void()> onEvents)
+    : acceptor(ioContext), token(token), onEvents(std::move(onEvents)) {
+    auto [host, port] = utils::splitHostPort(listen);
+    tcp::endpoint endpoint(net::ip::make_address(host.empty() ? "0.0.0.0" : host), port);
+    acceptor.open(endpoint.protocol());
+    acceptor.set_option(net::socket_base::reuse_address(true));
+    acceptor.bind(endpoint);
+    acceptor.listen();
+    accept();
+    worker = std::thread([this] { ioContext.run(); });
+    BOOST_LOG_TRIVIAL(info) << "Collecting events of agents on " << endpoint;
+}
+
+Collector::~Collector() {
+    ioContext.stop();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+std::vector<Collector::Received> Collector::take() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<Received> result;
+    result.swap(received);
+    return result;
+}
+
+void Collector::accept() {
+    acceptor.async_accept([this](boost::system::error_code ec, tcp::socket socket) {
+        if (!ec) {
+            std::make_shared<CollectorSession>(*this, std::move(socket))->start();
+        }
+        else if (ec == net::error::operation_aborted) {
+            return;
+        }
+        accept();
+    });
+}
+
+bool Collector::isAuthorized(const std::string& presented) const {
+    // Constant time, the token is not guessed byte by byte
+    return presented.size() == token.size()
+        && CRYPTO_memcmp(presented.data(), token.data(), token.size()) == 0;
+}
+
+std::uint64_t Collector::welcome(const fleet::Hello& hello) {
+    std::uint64_t& last = lastSeqs[hello.node];
+    if (hello.lastSeq < last) {
+        // The agent has started over without its spool
+        BOOST_LOG_TRIVIAL(warning)
+            << "Agent " << hello.node << " restarted its sequence at " << hello.lastSeq
+            << ", the collector had " << last;
+        last = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            // Its disconnections may be lost with the spool
+            received.push_back({ hello.node, {}, true });
+        }
+        if (onEvents) {
+            onEvents();
+        }
+    }
+    return last;
+}
+
+std::uint64_t Collector::receive(const std::string& node, std::vector<fleet::Event> events) {
+    std::uint64_t& last = lastSeqs[node];
+    std::size_t count = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& event : events) {
+            if (event.seq <= last) {
+                // Resent after a lost acknowledgement
+                continue;
+            }
+            last = event.seq;
+            received.push_back({ node, std::move(event) });
+            ++count;
+        }
+    }
+    BOOST_LOG_TRIVIAL(trace) << "Agent " << node << ": " << count << " new events";
+    if (count > 0 && onEvents) {
+        onEvents();
+    }
+    return last;
+}
@@ -0,0 +1,59 @@
+#ifndef COLLECTOR_H
+#define COLLECTOR_H
+
+#include "FleetProtocol.h"
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+
+
+// Receives events of agents from its own thread. Every batch is acknowledged
+// once its events are queued for take(); events with a sequence number the
+// node has already delivered are dropped. Agents without the shared token
+// are disconnected at their Hello.
+class Collector {
+public:
+    struct Received {
+        std::string node;
+        fleet::Event event;
+        // The node has started over, what is known of it is stale; no event
+        bool reset = false;
+    };
+
+    // `listen` is host:port, an IPv6 host in brackets.
+    // `onEvents` is called from the collector thread when events arrive
+    Collector(const std::string& listen, const std::string& token, std::function<void()> onEvents);
+    ~Collector();
+    Collector(const Collector&) = delete;
+    Collector& operator=(const Collector&) = delete;
+
+    // Events received since the last call, in the order of arrival
+    std::vector<Received> take();
+
+private:
+    friend class CollectorSession;
+
+    boost::asio::io_context ioContext;
+    boost::asio::ip::tcp::acceptor acceptor;
+    std::string token;
+    std::function<void()> onEvents;
+    std::thread worker;
+
+    std::mutex mutex;
+    std::vector<Received> received;
+    // Last delivered sequence number of every node, used by the collector thread only
+    std::map<std::string, std::uint64_t> lastSeqs;
+
+    void accept();
+    bool isAuthorized(const std::string& presented) const;
+    // Sequence number to continue from
+    std::uint64_t welcome(const fleet::Hello& hello);
+    // Returns the sequence number to acknowledge
+    std::uint64_t receive(const std::string& node, std::vector<fleet::Event> events);
+};
+
+#endif
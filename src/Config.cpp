@@ -2,7 +2,10 @@
 #include <sstream>
 #include <system_error>
 #include <optional>
+#include <algorithm>
 #include <boost/log/trivial.hpp>
+#include <boost/filesystem.hpp>
+#include <unistd.h>
 #include "Config.h"
 #include "version.h"
 #include "utils.h"
@@ -10,6 +13,7 @@
 
 namespace po = boost::program_options;
 namespace json = boost::json;
+namespace fs = boost::filesystem;
 
 // Вспомогательные функции для безопасного доступа
 static std::optional<std::string>
@@ -52,7 +56,11 @@ Config Config::parseCommandLine(int argc, char* argv[]) {
     }
 
     if (vm.count("xray-config-path")) {
-        config.xrayConfigPath = vm["xray-config-path"].as<std::string>();
+        config.xrayConfigPaths = vm["xray-config-path"].as<std::vector<std::string>>();
+        config.xrayConfigPath = config.xrayConfigPaths.front();
+    }
+    else if (!vm.count("collector")) {
+        config.xrayConfigPaths.push_back(config.xrayConfigPath);
     }
     if (vm.count("log-level")) {
         config.logLevelStr = utils::toLower(vm["log-level"].as<std::string>());
@@ -60,15 +68,129 @@ Config Config::parseCommandLine(int argc, char* argv[]) {
     if (vm.count("log-filepath")) {
         config.logFilePath = vm["log-filepath"].as<std::string>();
     }
+    if (vm.count("log-max-size")) {
+        config.logMaxSize = vm["log-max-size"].as<int>();
+    }
+    if (vm.count("log-rotate-hours")) {
+        config.logRotateHours = vm["log-rotate-hours"].as<int>();
+    }
+    if (vm.count("log-keep-files")) {
+        config.logKeepFiles = vm["log-keep-files"].as<int>();
+    }
+    if (vm.count("log-fsync-interval")) {
+        config.logFsyncInterval = vm["log-fsync-interval"].as<int>();
+    }
+    if (vm.count("log-overflow")) {
+        std::string overflow = utils::toLower(vm["log-overflow"].as<std::string>());
+        if (overflow != "drop" && overflow != "block") {
+            throw std::runtime_error("Invalid log overflow policy: " + overflow);
+        }
+        config.logBlock = overflow == "block";
+    }
     if (vm.count("interval")) {
         config.interval = vm["interval"].as<int>();
     }
+    if (vm.count("watch")) {
+        config.watch = true;
+    }
+    if (vm.count("debounce")) {
+        config.debounce = vm["debounce"].as<int>();
+    }
+    if (vm.count("state-filepath")) {
+        config.stateFilePath = vm["state-filepath"].as<std::string>();
+    }
+    if (vm.count("state-interval")) {
+        config.stateInterval = vm["state-interval"].as<int>();
+    }
     if (vm.count("telegram-token")) {
         config.telegramToken = vm["telegram-token"].as<std::string>();
     }
     if (vm.count("telegram-channel")) {
         config.telegramChannel = vm["telegram-channel"].as<std::string>();
     }
+    if (vm.count("telegram-commands")) {
+        config.telegramCommands = true;
+    }
+    if (vm.count("telegram-admins")) {
+        std::stringstream admins(vm["telegram-admins"].as<std::string>());
+        std::string admin;
+        while (std::getline(admins, admin, ',')) {
+            admin.erase(0, admin.find_first_not_of(' '));
+            admin.erase(admin.find_last_not_of(' ') + 1);
+            if (!admin.empty()) {
+                config.telegramAdmins.push_back(admin);
+            }
+        }
+    }
+    if (vm.count("idle-timeout")) {
+        config.idleTimeout = vm["idle-timeout"].as<int>();
+    }
+    if (vm.count("ip-timeout")) {
+        config.ipTimeout = vm["ip-timeout"].as<int>();
+    }
+    if (vm.count("max-ips")) {
+        config.maxIps = vm["max-ips"].as<int>();
+    }
+    if (vm.count("max-connections-1m")) {
+        config.maxConnections1m = vm["max-connections-1m"].as<int>();
+    }
+    if (vm.count("max-connections-5m")) {
+        config.maxConnections5m = vm["max-connections-5m"].as<int>();
+    }
+    if (vm.count("max-connections-1h")) {
+        config.maxConnections1h = vm["max-connections-1h"].as<int>();
+    }
+    if (vm.count("max-probes")) {
+        config.maxProbes = vm["max-probes"].as<int>();
+    }
+    if (vm.count("destinations-interval")) {
+        config.destinationsInterval = vm["destinations-interval"].as<int>();
+    }
+    if (vm.count("metrics-listen")) {
+        config.metricsListen = vm["metrics-listen"].as<std::string>();
+    }
+    if (vm.count("reload-interval")) {
+        config.reloadInterval = vm["reload-interval"].as<int>();
+    }
+    if (vm.count("notify-window")) {
+        config.notifyWindow = vm["notify-window"].as<int>();
+    }
+    if (vm.count("agent")) {
+        config.agent = vm["agent"].as<std::string>();
+    }
+    if (vm.count("collector")) {
+        config.collector = vm["collector"].as<std::string>();
+    }
+    if (vm.count("node-name")) {
+        config.nodeName = vm["node-name"].as<std::string>();
+    }
+    else {
+        char hostname[256] = {};
+        if (::gethostname(hostname, sizeof(hostname) - 1) == 0) {
+            config.nodeName = hostname;
+        }
+    }
+    if (vm.count("fleet-token")) {
+        config.fleetToken = vm["fleet-token"].as<std::string>();
+    }
+    if (vm.count("spool-filepath")) {
+        config.spoolFilePath = vm["spool-filepath"].as<std::string>();
+    }
+    if (vm.count("agent-compress")) {
+        config.agentCompress = true;
+    }
+    if (vm.count("max-nodes")) {
+        config.maxNodes = vm["max-nodes"].as<int>();
+    }
+    if (vm.count("history-dir")) {
+        config.historyDir = vm["history-dir"].as<std::string>();
+    }
+    if (vm.count("history-days")) {
+        config.historyDays = vm["history-days"].as<int>();
+    }
+    if (vm.count("geoip-db")) {
+        config.geoipPaths = vm["geoip-db"].as<std::vector<std::string>>();
+    }
 
     return config;
 }
@@ -78,18 +200,61 @@ po::options_description Config::createOptionsDescription() {
     desc.add_options()
         ("help,h", "Show help message")
         ("version,v", "Show version")
-        ("xray-config-path,c", po::value<std::string>(), "XRay config file path")
+        ("xray-config-path,c", po::value<std::vector<std::string>>()->composing(), "XRay config file path, repeat it to monitor several xray instances")
         ("log-level,l", po::value<std::string>()->default_value("info"), "Log level (trace, debug, info, warning, error, fatal)")
         ("log-filepath", po::value<std::string>(), "Log file path")
+        ("log-max-size", po::value<int>()->default_value(10), "Rotate the log file at MiB, 0 - no limit")
+        ("log-rotate-hours", po::value<int>()->default_value(0), "Rotate the log file after hours, 0 - no limit")
+        ("log-keep-files", po::value<int>()->default_value(5), "Rotated log files to keep")
+        ("log-fsync-interval", po::value<int>()->default_value(10), "Sync the log file to the disk every seconds, 0 - left to the OS")
+        ("log-overflow", po::value<std::string>()->default_value("drop"), "What to do with log records when the queue is full (drop, block)")
         ("interval,i", po::value<int>()->default_value(10), "Polling interval in seconds")
+        ("watch,w", "Wait for access log changes (inotify) instead of polling")
+        ("debounce", po::value<int>()->default_value(50), "Coalescing window of log changes for --watch in milliseconds")
+        ("state-filepath", po::value<std::string>(), "File to keep monitor state between restarts")
+        ("state-interval", po::value<int>()->default_value(60), "State saving interval in seconds")
+        ("idle-timeout", po::value<int>()->default_value(0), "Disconnect users without traffic (needs StatsService) for seconds, 0 - off")
         ("telegram-token,t", po::value<std::string>(), "Telegram bot token")
-        ("telegram-channel", po::value<std::string>(), "Telegram channel ID");
+        ("telegram-channel", po::value<std::string>(), "Telegram channel ID")
+        ("telegram-commands", "Answer bot commands (/online, /user, /suspicious, /stats) of the channel and admins")
+        ("telegram-admins", po::value<std::string>(), "Comma separated chat IDs or @usernames allowed to send bot commands")
+        ("ip-timeout", po::value<int>()->default_value(600), "Forget a user source IP not seen for seconds")
+        ("max-ips", po::value<int>()->default_value(0), "Alert when a user is online from more IPs at once, 0 - off")
+        ("max-connections-1m", po::value<int>()->default_value(0), "Alert when a user opens more connections within a minute, 0 - off")
+        ("max-connections-5m", po::value<int>()->default_value(0), "Alert when a user opens more connections within 5 minutes, 0 - off")
+        ("max-connections-1h", po::value<int>()->default_value(0), "Alert when a user opens more connections within an hour, 0 - off")
+        ("destinations-interval", po::value<int>()->default_value(0), "Send the top destinations of users every hours and start counting over, 0 - off")
+        ("max-probes", po::value<int>()->default_value(0), "Alert when an address or network has more rejected or unknown email connections, 0 - off")
+        ("metrics-listen", po::value<std::string>(), "Serve Prometheus metrics on host:port")
+        ("notify-window", po::value<int>()->default_value(10), "Window to collect connections into one notification in seconds")
+        ("reload-interval", po::value<int>()->default_value(5), "Check the XRay config for changed users every seconds, 0 - off")
+        ("agent", po::value<std::string>(), "Stream events to the collector at host:port instead of notifying")
+        ("collector", po::value<std::string>(), "Receive events of agents on host:port")
+        ("node-name", po::value<std::string>(), "Name of this node for the collector (default: hostname)")
+        ("fleet-token", po::value<std::string>(), "Shared secret an agent presents to the collector")
+        ("spool-filepath", po::value<std::string>(), "File to keep events for the collector across restarts")
+        ("agent-compress", "Compress event batches sent to the collector")
+        ("max-nodes", po::value<int>()->default_value(1), "Alert when a user is online on more nodes of the collector at once, 0 - off")
+        ("history-dir", po::value<std::string>(), "Directory to record user sessions to, see `xray-monitor query --help`")
+        ("history-days", po::value<int>()->default_value(90), "Keep session history for days, 0 - forever")
+        ("geoip-db", po::value<std::vector<std::string>>()->composing(), "MaxMind DB (.mmdb) file with countries or ASNs of connections, may be repeated");
     return desc;
 }
 
 void Config::validate() const {
-    if (xrayConfigPath.empty()) {
-        throw std::runtime_error("XRay config path cannot be empty");
+    for (const auto& path : xrayConfigPaths) {
+        if (path.empty()) {
+            throw std::runtime_error("XRay config path cannot be empty");
+        }
+    }
+    if (!agent.empty() && !collector.empty()) {
+        throw std::runtime_error("A monitor is either an agent or a collector");
+    }
+    if ((!agent.empty() || !collector.empty()) && fleetToken.empty()) {
+        throw std::runtime_error("Fleet token must be specified for an agent or a collector");
+    }
+    if (!agent.empty() && nodeName.empty()) {
+        throw std::runtime_error("Node name must be specified for an agent");
     }
     if (interval <= 0) {
         throw std::runtime_error("Interval must be positive");
@@ -100,6 +265,9 @@ void Config::validate() const {
     if (telegramToken.empty() && !telegramChannel.empty()) {
         throw std::runtime_error("Telegram token must be specified when channel is provided");
     }
+    if (telegramCommands && telegramToken.empty()) {
+        throw std::runtime_error("Telegram token must be specified for bot commands");
+    }
     // get it from logger::stringToSeverity
     if (logLevelStr != "trace" && logLevelStr != "debug" && logLevelStr != "info" &&
         logLevelStr != "warning" && logLevelStr != "error" && logLevelStr != "fatal") {
@@ -108,8 +276,9 @@ void Config::validate() const {
 }
 
 void Config::printHelp(const po::options_description& desc) const {
-    std::cout << "XRay Monitor - VLESS connection monitoring tool\n\n"
-        << "Usage: xray-monitor [options]\n\n"
+    std::cout << "XRay Monitor - VLESS, VMess, Trojan and Shadowsocks connection monitoring tool\n\n"
+        << "Usage: xray-monitor [options]\n"
+        << "       xray-monitor query --history-dir <dir> --user <email> [--since 7d] [--until now]\n\n"
         << desc << std::endl;
 }
 
@@ -141,11 +310,14 @@ void Config::parseConfigFile() {
     //if (!hasStatsService) {
     //    throw std::runtime_error("XRay config must contain api.services with StatsService");
     //}
+    statsService = hasStatsService;
 
     parseInbounds(root);
 
     parseUsers(root);
 
+    parseOutbounds(root);
+
     auto log_it = root.find("log");
     if (log_it != root.end() && log_it->value().is_object()) {
         const auto& log_obj = log_it->value().as_object();
@@ -159,6 +331,84 @@ void Config::parseConfigFile() {
     }
 }
 
+std::vector<Config> Config::instances() const {
+    std::vector<Config> result;
+    if (xrayConfigPaths.empty()) {
+        return result;
+    }
+    if (xrayConfigPaths.size() == 1) {
+        result.push_back(*this);
+        return result;
+    }
+    // Named by the config file, e.g. `eu` for /etc/xray/eu.json,
+    // or by its directory if the file names are the same
+    auto unique = [](const std::vector<std::string>& names) {
+        std::vector<std::string> sorted = names;
+        std::sort(sorted.begin(), sorted.end());
+        return std::adjacent_find(sorted.begin(), sorted.end()) == sorted.end();
+    };
+    std::vector<std::string> names;
+    for (const auto& path : xrayConfigPaths) {
+        names.push_back(fs::path(path).stem().string());
+    }
+    if (!unique(names)) {
+        names.clear();
+        for (const auto& path : xrayConfigPaths) {
+            names.push_back(fs::path(path).parent_path().filename().string());
+        }
+    }
+    if (!unique(names)) {
+        for (std::size_t i = 0; i < names.size(); ++i) {
+            names[i] += "-" + std::to_string(i + 1);
+        }
+    }
+    for (std::size_t i = 0; i < xrayConfigPaths.size(); ++i) {
+        Config instance = *this;
+        instance.xrayConfigPath = xrayConfigPaths[i];
+        instance.xrayConfigPaths = { xrayConfigPaths[i] };
+        instance.instance = names[i];
+        if (!stateFilePath.empty()) {
+            instance.stateFilePath += "." + names[i];
+        }
+        result.push_back(std::move(instance));
+    }
+    return result;
+}
+
+Config Config::reparseConfigFile() const {
+    Config updated = *this;
+    updated.users.clear();
+    updated.userInbounds.clear();
+    updated.outboundTags.clear();
+    updated.parseConfigFile();
+    return updated;
+}
+
+UsersDiff Config::diffUsers(const std::unordered_map<std::string, User>& before,
+    const std::unordered_map<std::string, User>& after) {
+    UsersDiff diff;
+    for (const auto& [email, user] : after) {
+        auto it = before.find(email);
+        if (it == before.end()) {
+            diff.added.push_back(user);
+        }
+        else if (it->second.id != user.id || it->second.protocol != user.protocol ||
+            it->second.inbounds != user.inbounds) {
+            diff.changed.push_back(user);
+        }
+    }
+    for (const auto& [email, user] : before) {
+        if (after.find(email) == after.end()) {
+            diff.removed.push_back(user);
+        }
+    }
+    auto byEmail = [](const User& a, const User& b) { return a.email < b.email; };
+    std::sort(diff.added.begin(), diff.added.end(), byEmail);
+    std::sort(diff.removed.begin(), diff.removed.end(), byEmail);
+    std::sort(diff.changed.begin(), diff.changed.end(), byEmail);
+    return diff;
+}
+
 void Config::parseInbounds(const json::object& root) {
     auto inbounds_it = root.find("inbounds");
     if (inbounds_it == root.end() || !inbounds_it->value().is_array()) {
@@ -195,6 +445,8 @@ void Config::parseInbounds(const json::object& root) {
 }
 
 void Config::parseUsers(const json::object& root) {
+    static const std::vector<std::string> protocols = { "vless", "vmess", "trojan", "shadowsocks" };
+
     auto inbounds_it = root.find("inbounds");
     if (inbounds_it == root.end() || !inbounds_it->value().is_array()) return;
 
@@ -205,29 +457,67 @@ void Config::parseUsers(const json::object& root) {
         const auto& inbound = inbound_val.as_object();
 
         auto protocol_opt = get_optional_string(inbound, "protocol");
-        if (!protocol_opt || *protocol_opt != "vless") continue;
+        if (!protocol_opt || std::find(protocols.begin(), protocols.end(), *protocol_opt) == protocols.end()) continue;
 
         auto settings_it = inbound.find("settings");
         if (settings_it == inbound.end() || !settings_it->value().is_object()) continue;
 
+        auto tag = get_optional_string(inbound, "tag").value_or("");
+        if (tag.empty()) {
+            BOOST_LOG_TRIVIAL(warning) << "Inbound " << *protocol_opt << " has no tag, its connections are not recognized";
+        }
+
         const auto& settings = settings_it->value().as_object();
         auto clients_it = settings.find("clients");
-        if (clients_it == settings.end() || !clients_it->value().is_array()) continue;
+        if (clients_it == settings.end() || !clients_it->value().is_array()) {
+            // Single user shadowsocks
+            auto email_opt = get_optional_string(settings, "email");
+            if (email_opt && !email_opt->empty()) {
+                addUser("", *email_opt, *protocol_opt, tag);
+            }
+            continue;
+        }
 
         const auto& clients = clients_it->value().as_array();
         for (const auto& client_val : clients) {
             if (!client_val.is_object()) continue;
             const auto& client = client_val.as_object();
 
+            // Trojan and shadowsocks clients have a password instead, it is not kept
             auto id_opt = get_optional_string(client, "id");
             auto email_opt = get_optional_string(client, "email");
 
-            if (id_opt && email_opt && !email_opt->empty()) {
-                User user;
-                user.id = *id_opt;
-                user.email = *email_opt;
-                users[user.email] = user;
+            if (email_opt && !email_opt->empty()) {
+                addUser(id_opt.value_or(""), *email_opt, *protocol_opt, tag);
             }
         }
     }
 }
+
+void Config::addUser(const std::string& id, const std::string& email, const std::string& protocol, const std::string& inboundTag) {
+    User& user = users[email];
+    if (user.email.empty()) {
+        user.id = id;
+        user.email = email;
+        user.protocol = protocol;
+    }
+    if (!inboundTag.empty()) {
+        user.inbounds.push_back(inboundTag);
+        if (std::find(userInbounds.begin(), userInbounds.end(), inboundTag) == userInbounds.end()) {
+            userInbounds.push_back(inboundTag);
+        }
+    }
+}
+
+void Config::parseOutbounds(const json::object& root) {
+    auto outbounds_it = root.find("outbounds");
+    if (outbounds_it == root.end() || !outbounds_it->value().is_array()) return;
+
+    for (const auto& outbound_val : outbounds_it->value().as_array()) {
+        if (!outbound_val.is_object()) continue;
+        auto tag = get_optional_string(outbound_val.as_object(), "tag");
+        if (tag && !tag->empty()) {
+            outboundTags.push_back(*tag);
+        }
+    }
+}
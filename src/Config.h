@@ -11,6 +11,19 @@
 struct User {
     std::string id;
     std::string email;
+    std::string protocol;
+    // Tags of inbounds the user is a client of
+    std::vector<std::string> inbounds;
+};
+
+// Difference between two user lists of the xray config, matched by email
+struct UsersDiff {
+    std::vector<User> added;
+    std::vector<User> removed;
+    // Same email with another id, protocol or inbounds
+    std::vector<User> changed;
+
+    bool empty() const { return added.empty() && removed.empty() && changed.empty(); }
 };
 
 namespace po = boost::program_options;
@@ -19,26 +32,86 @@ namespace json = boost::json;
 class Config {
 public:
     std::string xrayConfigPath = "/usr/local/etc/xray/config.json";
+    // Every given path, one xray instance each. Empty for a collector without own xray
+    std::vector<std::string> xrayConfigPaths;
+    // Name of the instance in messages and metrics, empty if there is only one
+    std::string instance;
     std::string logLevelStr = "info";
     std::string logFilePath;
+    // Rotation of the log file: MiB (0 - no limit), hours (0 - no limit), rotated files kept
+    unsigned int logMaxSize = 10;
+    unsigned int logRotateHours = 0;
+    unsigned int logKeepFiles = 5;
+    // Seconds between syncs of the log file to the disk, 0 - left to the OS
+    unsigned int logFsyncInterval = 10;
+    // Wait for room in the log queue instead of dropping records
+    bool logBlock = false;
     unsigned int interval = 10;
+    bool watch = false;
+    unsigned int debounce = 50;
+    std::string stateFilePath;
+    unsigned int stateInterval = 60;
     std::string telegramToken;
     std::string telegramChannel;
+    bool telegramCommands = false;
+    // Chats besides the channel allowed to send commands: IDs or @usernames
+    std::vector<std::string> telegramAdmins;
+    unsigned int notifyWindow = 10;
+    std::string metricsListen;
     std::string apiAddress = "127.0.0.1";
     unsigned int apiPort = 0;
+    bool statsService = false;
+    unsigned int idleTimeout = 0;
+    unsigned int ipTimeout = 600;
+    unsigned int maxIps = 0;
+    // Accepted connections of a user per window, 0 - off
+    unsigned int maxConnections1m = 0;
+    unsigned int maxConnections5m = 0;
+    unsigned int maxConnections1h = 0;
+    // Rejected or unknown email attempts of a source, 0 - no alerts
+    unsigned int maxProbes = 0;
+    // Hours between top destinations summaries, 0 - off
+    unsigned int destinationsInterval = 0;
+    unsigned int reloadInterval = 5;
+    // Collector host:port to stream events to instead of notifying
+    std::string agent;
+    // host:port to receive events of agents on
+    std::string collector;
+    std::string nodeName;
+    // Shared secret of agents and the collector
+    std::string fleetToken;
+    std::string spoolFilePath;
+    bool agentCompress = false;
+    unsigned int maxNodes = 1;
+    // Session history directory, off if empty
+    std::string historyDir;
+    unsigned int historyDays = 90;
+    // MaxMind DB files for countries and ASNs of connections, off if empty
+    std::vector<std::string> geoipPaths;
     std::string accessLogPath;
     std::unordered_map<std::string, User> users;
+    // Tags of inbounds with clients and of all outbounds
+    std::vector<std::string> userInbounds;
+    std::vector<std::string> outboundTags;
 
     static Config parseCommandLine(int argc, char* argv[]);
     void validate() const;
     void printHelp(const po::options_description& desc) const;
     void printVersion() const;
     void parseConfigFile();
+    // Config of each xray instance, not parsed yet
+    std::vector<Config> instances() const;
+    // Same config with the users, inbounds and outbounds of the xray config file read again
+    Config reparseConfigFile() const;
+    static UsersDiff diffUsers(const std::unordered_map<std::string, User>& before,
+        const std::unordered_map<std::string, User>& after);
 
 private:
     static po::options_description createOptionsDescription();
     void parseInbounds(const json::object& root);
     void parseUsers(const json::object& root);
+    void parseOutbounds(const json::object& root);
+    void addUser(const std::string& id, const std::string& email, const std::string& protocol, const std::string& inboundTag);
 };
 
 #endif
@@ -0,0 +1,121 @@
+#include "ConfigWatcher.h"
+#include <boost/log/trivial.hpp>
+#include <sys/stat.h>
+
+
+ConfigWatcher::ConfigWatcher(const std::vector<const Config*>& configs, unsigned int intervalSeconds, std::function<void()> onUpdate)
+    : interval(intervalSeconds), onUpdate(std::move(onUpdate)) {
+    for (const Config* config : configs) {
+        Watched entry;
+        entry.path = config->xrayConfigPath;
+        entry.current = std::make_shared<Config>(*config);
+        // Editors often replace the file, so the inode is compared too
+        stampFile(entry.path, entry.last);
+        watched.push_back(std::move(entry));
+    }
+    worker = std::thread([this] { run(); });
+}
+
+ConfigWatcher::~ConfigWatcher() {
+    {
+        std::lock_guard<std::mutex> lock(stopMutex);
+        stopping = true;
+    }
+    stopCv.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+ConfigUpdate ConfigWatcher::take(std::size_t instance) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Watched& entry = watched[instance];
+    ConfigUpdate update = std::move(entry.pending);
+    entry.pending = ConfigUpdate{};
+    if (update.config) {
+        entry.current = update.config;
+    }
+    return update;
+}
+
+bool ConfigWatcher::FileStamp::operator==(const FileStamp& other) const {
+    return device == other.device && inode == other.inode && size == other.size &&
+        mtime.tv_sec == other.mtime.tv_sec && mtime.tv_nsec == other.mtime.tv_nsec;
+}
+
+bool ConfigWatcher::stampFile(const std::string& path, FileStamp& stamp) {
+    struct stat st {};
+    if (::stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+    stamp.device = st.st_dev;
+    stamp.inode = st.st_ino;
+    stamp.size = st.st_size;
+    stamp.mtime = st.st_mtim;
+    return true;
+}
+
+void ConfigWatcher::run() {
+    std::unique_lock<std::mutex> lock(stopMutex);
+    while (!stopCv.wait_for(lock, interval, [this] { return stopping; })) {
+        lock.unlock();
+        // The list itself never changes after construction
+        for (Watched& entry : watched) {
+            FileStamp stamp;
+            if (stampFile(entry.path, stamp) && !(stamp == entry.last)) {
+                entry.last = stamp;
+                reload(entry);
+            }
+        }
+        lock.lock();
+    }
+}
+
+void ConfigWatcher::reload(Watched& entry) {
+    std::shared_ptr<const Config> base;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        base = entry.current;
+    }
+    std::shared_ptr<Config> updated;
+    try {
+        updated = std::make_shared<Config>(base->reparseConfigFile());
+    }
+    catch (const std::exception& e) {
+        // Most likely caught in the middle of a write, the next change is tried again
+        BOOST_LOG_TRIVIAL(warning)
+            << "Error reloading XRay config " << entry.path << ", keeping the previous users: "
+            << std::string(e.what());
+        return;
+    }
+    if (updated->accessLogPath != base->accessLogPath) {
+        BOOST_LOG_TRIVIAL(warning) << "Access log path of the XRay config has changed, restart to apply it";
+    }
+
+    UsersDiff diff;
+    bool same = false;
+    for (;;) {
+        diff = Config::diffUsers(base->users, updated->users);
+        same = diff.empty() && updated->userInbounds == base->userInbounds &&
+            updated->outboundTags == base->outboundTags;
+        std::lock_guard<std::mutex> lock(mutex);
+        if (entry.current != base) {
+            // The main loop took the previous update meanwhile
+            base = entry.current;
+            continue;
+        }
+        // An unchanged file also cancels an update that was not taken yet
+        entry.pending = same ? ConfigUpdate{} : ConfigUpdate{ updated, diff };
+        break;
+    }
+    if (same) {
+        BOOST_LOG_TRIVIAL(debug) << "XRay config " << entry.path << " has changed, users are the same";
+        return;
+    }
+    BOOST_LOG_TRIVIAL(info)
+        << "XRay config " << entry.path << " reloaded: " << diff.added.size() << " users added, "
+        << diff.removed.size() << " removed, " << diff.changed.size() << " changed";
+    if (onUpdate) {
+        onUpdate();
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef CONFIGWATCHER_H
+#define CONFIGWATCHER_H
+
+#include "Config.h"
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+
+
+// Reparsed xray config and how its users differ from the previous one
+struct ConfigUpdate {
+    std::shared_ptr<const Config> config;
+    UsersDiff diff;
+};
+
+// Checks the xray config files of all instances for changes from one
+// thread. A changed file is parsed and compared there, the main loop only
+// takes the finished update, so processing never waits for the parser.
+class ConfigWatcher {
+public:
+    // `onUpdate` is called from the watcher thread when an update is ready
+    ConfigWatcher(const std::vector<const Config*>& configs, unsigned int intervalSeconds, std::function<void()> onUpdate);
+    ~ConfigWatcher();
+    ConfigWatcher(const ConfigWatcher&) = delete;
+    ConfigWatcher& operator=(const ConfigWatcher&) = delete;
+
+    // The latest update of the instance not taken yet, empty config if there is none
+    ConfigUpdate take(std::size_t instance);
+
+private:
+    struct FileStamp {
+        dev_t device = 0;
+        ino_t inode = 0;
+        off_t size = 0;
+        timespec mtime{};
+
+        bool operator==(const FileStamp& other) const;
+    };
+
+    struct Watched {
+        std::string path;
+        // Used by the watcher thread only
+        FileStamp last;
+        // Config the pending update was compared with
+        std::shared_ptr<const Config> current;
+        ConfigUpdate pending;
+    };
+
+    std::chrono::seconds interval;
+    std::function<void()> onUpdate;
+
+    // Guards the pointers only, never held while parsing
+    std::mutex mutex;
+    std::vector<Watched> watched;
+
+    std::mutex stopMutex;
+    std::condition_variable stopCv;
+    bool stopping = false;
+    std::thread worker;
+
+    void run();
+    void reload(Watched& entry);
+    static bool stampFile(const std::string& path, FileStamp& stamp);
+};
+
+#endif
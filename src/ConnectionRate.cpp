@@ -0,0 +1,60 @@
+#include "ConnectionRate.h"
+#include <algorithm>
+#include <limits>
+
+
+void ConnectionRate::advance(std::time_t now) {
+    if (now <= head) {
+        return;
+    }
+    if (head == 0 || minuteTotal == 0) {
+        // Nothing to drop, the rings are empty
+        head = now;
+        return;
+    }
+    // At most one turn of each ring however long the user was idle
+    for (std::time_t second = head + 1; second <= std::min(now, head + SLOTS); ++second) {
+        auto& slot = seconds[second % SLOTS];
+        secondTotal -= slot;
+        slot = 0;
+    }
+    const std::time_t headMinute = head / 60;
+    const std::time_t nowMinute = now / 60;
+    for (std::time_t minute = headMinute + 1; minute <= std::min(nowMinute, headMinute + SLOTS); ++minute) {
+        auto& slot = minutes[minute % SLOTS];
+        minuteTotal -= slot;
+        slot = 0;
+    }
+    head = now;
+}
+
+void ConnectionRate::add(std::time_t time) {
+    if (time <= 0) {
+        return;
+    }
+    advance(time);
+    if (head - time < SLOTS) {
+        auto& slot = seconds[time % SLOTS];
+        // A flood of more than 65535 lines in one second saturates
+        if (slot < std::numeric_limits<std::uint16_t>::max()) {
+            ++slot;
+            ++secondTotal;
+        }
+    }
+    if (head / 60 - time / 60 < SLOTS) {
+        ++minutes[time / 60 % SLOTS];
+        ++minuteTotal;
+    }
+}
+
+std::uint32_t ConnectionRate::lastMinutes(unsigned int count) const {
+    if (head == 0) {
+        return 0;
+    }
+    std::uint32_t total = 0;
+    const std::time_t headMinute = head / 60;
+    for (std::time_t minute = headMinute; minute > headMinute - std::min<std::time_t>(count, SLOTS); --minute) {
+        total += minutes[minute % SLOTS];
+    }
+    return total;
+}
@@ -0,0 +1,36 @@
+#ifndef CONNECTIONRATE_H
+#define CONNECTIONRATE_H
+
+#include <array>
+#include <cstdint>
+#include <ctime>
+
+
+// Accepted connections of one user over the last hour in two rings:
+// per second for the last minute and per minute for the hour. Fixed
+// size, an access log line costs one increment of each ring. Lines may
+// come newest first; a line older than the ring it belongs to is ignored.
+class ConnectionRate {
+public:
+    void add(std::time_t time);
+    // Drops the counts that fell out of the windows by `now`
+    void advance(std::time_t now);
+
+    // Sliding over seconds
+    std::uint32_t lastMinute() const { return secondTotal; }
+    // Sliding over whole minutes, the current one included
+    std::uint32_t lastMinutes(unsigned int count) const;
+    std::uint32_t lastHour() const { return minuteTotal; }
+
+private:
+    static const std::time_t SLOTS = 60;
+
+    // Newest second counted or advanced to
+    std::time_t head = 0;
+    std::array<std::uint16_t, SLOTS> seconds{};
+    std::array<std::uint32_t, SLOTS> minutes{};
+    std::uint32_t secondTotal = 0;
+    std::uint32_t minuteTotal = 0;
+};
+
+#endif
@@ -0,0 +1,236 @@
+#include "FleetProtocol.h"
+#include <algorithm>
+#include <stdexcept>
+#include <zlib.h>
+
+
+namespace {
+    // Batches smaller than that are sent as they are
+    const std::size_t COMPRESS_MIN_SIZE = 512;
+    const std::uint8_t FLAG_DEFLATE = 1;
+
+    class Writer {
+    public:
+        std::string& data;
+
+        explicit Writer(std::string& data) : data(data) {}
+
+        template <class T>
+        void put(T value) {
+            auto bits = static_cast<std::uint64_t>(value);
+            for (std::size_t i = 0; i < sizeof(T); ++i) {
+                data += static_cast<char>((bits >> (8 * i)) & 0xff);
+            }
+        }
+
+        void putString(const std::string& value) {
+            auto size = static_cast<std::uint16_t>(std::min<std::size_t>(value.size(), UINT16_MAX));
+            put(size);
+            data.append(value, 0, size);
+        }
+    };
+
+    class Reader {
+    public:
+        Reader(const char*& ptr, const char* end) : ptr(ptr), end(end) {}
+
+        template <class T>
+        bool get(T& value) {
+            if (static_cast<std::size_t>(end - ptr) < sizeof(T)) return false;
+            std::uint64_t bits = 0;
+            for (std::size_t i = 0; i < sizeof(T); ++i) {
+                bits |= static_cast<std::uint64_t>(static_cast<unsigned char>(ptr[i])) << (8 * i);
+            }
+            value = static_cast<T>(bits);
+            ptr += sizeof(T);
+            return true;
+        }
+
+        bool getString(std::string& value) {
+            std::uint16_t size = 0;
+            if (!get(size) || static_cast<std::size_t>(end - ptr) < size) return false;
+            value.assign(ptr, size);
+            ptr += size;
+            return true;
+        }
+
+    private:
+        const char*& ptr;
+        const char* end;
+    };
+
+    std::string frame(fleet::FrameType type, const std::string& payload) {
+        std::string out;
+        out.reserve(fleet::HEADER_SIZE + payload.size());
+        Writer w(out);
+        w.put(static_cast<std::uint32_t>(payload.size() + 1));
+        w.put(static_cast<std::uint8_t>(type));
+        out += payload;
+        return out;
+    }
+}
+
+void fleet::encodeEvent(std::string& out, const Event& event) {
+    Writer w(out);
+    w.put(event.seq);
+    w.put(static_cast<std::uint8_t>(event.kind));
+    w.put(event.time);
+    w.putString(event.instance);
+    w.putString(event.email);
+    w.putString(event.id);
+    w.putString(event.ip);
+    w.putString(event.text);
+}
+
+bool fleet::decodeEvent(const char*& ptr, const char* end, Event& event) {
+    Reader r(ptr, end);
+    std::uint8_t kind = 0;
+    if (!r.get(event.seq) || !r.get(kind) || !r.get(event.time) ||
+        !r.getString(event.instance) || !r.getString(event.email) ||
+        !r.getString(event.id) || !r.getString(event.ip) || !r.getString(event.text)) {
+        return false;
+    }
+    if (kind < static_cast<std::uint8_t>(EventKind::Connected) || kind > static_cast<std::uint8_t>(EventKind::Message)) {
+        return false;
+    }
+    event.kind = static_cast<EventKind>(kind);
+    return true;
+}
+
+std::string fleet::hello(const Hello& hello) {
+    std::string payload;
+    Writer w(payload);
+    w.put(MAGIC);
+    w.put(VERSION);
+    w.putString(hello.node);
+    w.put(hello.lastSeq);
+    w.putString(hello.token);
+    return frame(FrameType::Hello, payload);
+}
+
+std::string fleet::welcome(std::uint64_t lastSeq) {
+    std::string payload;
+    Writer(payload).put(lastSeq);
+    return frame(FrameType::Welcome, payload);
+}
+
+std::string fleet::ack(std::uint64_t seq) {
+    std::string payload;
+    Writer(payload).put(seq);
+    return frame(FrameType::Ack, payload);
+}
+
+std::string fleet::batch(const std::vector<Event>& events, bool compress) {
+    std::string raw;
+    Writer(raw).put(static_cast<std::uint32_t>(events.size()));
+    for (const auto& event : events) {
+        encodeEvent(raw, event);
+    }
+
+    std::string payload;
+    Writer w(payload);
+    if (compress && raw.size() >= COMPRESS_MIN_SIZE) {
+        uLongf size = compressBound(static_cast<uLong>(raw.size()));
+        std::string deflated(size, '\0');
+        if (compress2(reinterpret_cast<Bytef*>(deflated.data()), &size,
+                reinterpret_cast<const Bytef*>(raw.data()), static_cast<uLong>(raw.size()), Z_DEFAULT_COMPRESSION) == Z_OK &&
+            size < raw.size()) {
+            deflated.resize(size);
+            w.put(FLAG_DEFLATE);
+            w.put(static_cast<std::uint32_t>(raw.size()));
+            payload += deflated;
+            return frame(FrameType::Batch, payload);
+        }
+    }
+    w.put(static_cast<std::uint8_t>(0));
+    w.put(static_cast<std::uint32_t>(raw.size()));
+    payload += raw;
+    return frame(FrameType::Batch, payload);
+}
+
+void fleet::parseHeader(const char* header, FrameType& type, std::uint32_t& payloadSize) {
+    const char* ptr = header;
+    Reader r(ptr, header + HEADER_SIZE);
+    std::uint32_t length = 0;
+    std::uint8_t rawType = 0;
+    r.get(length);
+    r.get(rawType);
+    if (length == 0 || length > MAX_FRAME) {
+        throw std::runtime_error("Invalid frame length " + std::to_string(length));
+    }
+    if (rawType < static_cast<std::uint8_t>(FrameType::Hello) || rawType > static_cast<std::uint8_t>(FrameType::Ack)) {
+        throw std::runtime_error("Unknown frame type " + std::to_string(rawType));
+    }
+    type = static_cast<FrameType>(rawType);
+    payloadSize = length - 1;
+}
+
+fleet::Hello fleet::parseHello(const std::string& payload) {
+    const char* ptr = payload.data();
+    Reader r(ptr, payload.data() + payload.size());
+    std::uint32_t magic = 0;
+    std::uint16_t version = 0;
+    if (!r.get(magic) || !r.get(version) || magic != MAGIC) {
+        throw std::runtime_error("Not an xray-monitor agent");
+    }
+    if (version != VERSION) {
+        throw std::runtime_error("Unsupported agent protocol version " + std::to_string(version));
+    }
+    Hello hello;
+    if (!r.getString(hello.node) || !r.get(hello.lastSeq) || !r.getString(hello.token)) {
+        throw std::runtime_error("Malformed hello");
+    }
+    if (hello.node.empty()) {
+        throw std::runtime_error("Agent without a node name");
+    }
+    return hello;
+}
+
+std::uint64_t fleet::parseSeq(const std::string& payload) {
+    const char* ptr = payload.data();
+    std::uint64_t seq = 0;
+    if (!Reader(ptr, payload.data() + payload.size()).get(seq)) {
+        throw std::runtime_error("Malformed sequence number");
+    }
+    return seq;
+}
+
+std::vector<fleet::Event> fleet::parseBatch(const std::string& payload) {
+    const char* ptr = payload.data();
+    const char* end = payload.data() + payload.size();
+    std::uint8_t flags = 0;
+    std::uint32_t rawSize = 0;
+    Reader header(ptr, end);
+    if (!header.get(flags) || !header.get(rawSize) || rawSize > MAX_FRAME) {
+        throw std::runtime_error("Malformed batch");
+    }
+    std::string inflated;
+    if (flags & FLAG_DEFLATE) {
+        inflated.resize(rawSize);
+        uLongf size = rawSize;
+        if (uncompress(reinterpret_cast<Bytef*>(inflated.data()), &size,
+                reinterpret_cast<const Bytef*>(ptr), static_cast<uLong>(end - ptr)) != Z_OK || size != rawSize) {
+            throw std::runtime_error("Corrupt compressed batch");
+        }
+        ptr = inflated.data();
+        end = inflated.data() + inflated.size();
+    }
+    else if (static_cast<std::size_t>(end - ptr) != rawSize) {
+        throw std::runtime_error("Malformed batch");
+    }
+
+    std::uint32_t count = 0;
+    if (!Reader(ptr, end).get(count)) {
+        throw std::runtime_error("Malformed batch");
+    }
+    std::vector<Event> events;
+    events.reserve(std::min<std::uint32_t>(count, 65536));
+    for (std::uint32_t i = 0; i < count; ++i) {
+        Event event;
+        if (!decodeEvent(ptr, end, event)) {
+            throw std::runtime_error("Malformed event in batch");
+        }
+        events.push_back(std::move(event));
+    }
+    return events;
+}
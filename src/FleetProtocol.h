@@ -0,0 +1,77 @@
+#ifndef FLEETPROTOCOL_H
+#define FLEETPROTOCOL_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+// Wire format between agents and the collector. Every message is a frame:
+// u32 length of the rest, u8 frame type, payload. Integers are little-endian,
+// strings are u16 length + bytes.
+//
+//   agent -> collector: Hello(magic, version, node, last sequence, token), Batch(events)
+//   collector -> agent: Welcome(last sequence of the node), Ack(sequence)
+namespace fleet {
+    const std::uint32_t MAGIC = 0x47414d58; // "XMAG"
+    const std::uint16_t VERSION = 2;
+    const std::uint32_t MAX_FRAME = 16 * 1024 * 1024;
+    // u32 length + u8 type
+    const std::size_t HEADER_SIZE = 5;
+
+    enum class FrameType : std::uint8_t {
+        Hello = 1,
+        Welcome = 2,
+        Batch = 3,
+        Ack = 4,
+    };
+
+    enum class EventKind : std::uint8_t {
+        Connected = 1,
+        Disconnected = 2,
+        Suspicious = 3,
+        // Ready notification text (MarkdownV2) of the node
+        Message = 4,
+    };
+
+    struct Event {
+        // Per node, starting from 1
+        std::uint64_t seq = 0;
+        EventKind kind = EventKind::Connected;
+        std::int64_t time = 0;
+        std::string instance;
+        std::string email;
+        std::string id;
+        std::string ip;
+        std::string text;
+    };
+
+    struct Hello {
+        std::string node;
+        // Last sequence number the agent has assigned, lower than the one
+        // the collector knows if the agent has lost its spool
+        std::uint64_t lastSeq = 0;
+        // Shared secret of the fleet (--fleet-token)
+        std::string token;
+    };
+
+    void encodeEvent(std::string& out, const Event& event);
+    // False if the data is cut or malformed
+    bool decodeEvent(const char*& ptr, const char* end, Event& event);
+
+    std::string hello(const Hello& hello);
+    std::string welcome(std::uint64_t lastSeq);
+    // The events are deflated if `compress` is set and it pays off
+    std::string batch(const std::vector<Event>& events, bool compress);
+    std::string ack(std::uint64_t seq);
+
+    // Type and payload size of a frame header, throws std::runtime_error if it is out of range
+    void parseHeader(const char* header, FrameType& type, std::uint32_t& payloadSize);
+    // Payload parsers, throw std::runtime_error on malformed data
+    Hello parseHello(const std::string& payload);
+    // Of Welcome and Ack
+    std::uint64_t parseSeq(const std::string& payload);
+    std::vector<Event> parseBatch(const std::string& payload);
+}
+
+#endif
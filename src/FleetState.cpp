@@ -0,0 +1,143 @@
+#include "FleetState.h"
+#include <algorithm>
+#include <iterator>
+
+
+namespace {
+    // Seconds between scans for expired presences
+    const std::time_t EXPIRE_INTERVAL = 60;
+}
+
+
+FleetState::FleetState(unsigned int maxNodes) : maxNodes(maxNodes) {}
+
+std::string FleetState::location(const std::string& node, const std::string& instance) {
+    return instance.empty() ? node : node + "/" + instance;
+}
+
+bool FleetState::apply(const std::string& node, const fleet::Event& event, std::time_t now) {
+    switch (event.kind) {
+    case fleet::EventKind::Connected: {
+        Presence presence{ event.id, event.ip, static_cast<std::time_t>(event.time), now };
+        auto [it, added] = online[event.email].try_emplace({ node, event.instance }, presence);
+        if (!added) {
+            it->second.time = std::max(it->second.time, presence.time);
+            it->second.seen = now;
+            return false;
+        }
+        changed.insert(event.email);
+        return true;
+    }
+    case fleet::EventKind::Disconnected: {
+        auto it = online.find(event.email);
+        if (it == online.end() || it->second.erase({ node, event.instance }) == 0) {
+            return false;
+        }
+        if (it->second.empty()) {
+            online.erase(it);
+        }
+        changed.insert(event.email);
+        return true;
+    }
+    case fleet::EventKind::Suspicious:
+        return suspicious.insert(location(node, event.instance) + "\n" + event.email).second;
+    case fleet::EventKind::Message:
+        break;
+    }
+    return true;
+}
+
+template <class Predicate>
+std::vector<FleetState::Departure> FleetState::remove(Predicate drop) {
+    std::vector<Departure> result;
+    for (auto user = online.begin(); user != online.end();) {
+        auto& locations = user->second;
+        for (auto it = locations.begin(); it != locations.end();) {
+            if (!drop(it->first.first, it->second)) {
+                ++it;
+                continue;
+            }
+            Departure departure;
+            departure.node = it->first.first;
+            departure.event.kind = fleet::EventKind::Disconnected;
+            departure.event.time = it->second.time;
+            departure.event.instance = it->first.second;
+            departure.event.email = user->first;
+            departure.event.id = it->second.id;
+            departure.event.ip = it->second.ip;
+            result.push_back(std::move(departure));
+            changed.insert(user->first);
+            it = locations.erase(it);
+        }
+        user = locations.empty() ? online.erase(user) : std::next(user);
+    }
+    return result;
+}
+
+std::vector<FleetState::Departure> FleetState::dropNode(const std::string& node) {
+    return remove([&](const std::string& where, const Presence&) { return where == node; });
+}
+
+std::vector<FleetState::Departure> FleetState::expire(std::time_t now) {
+    if (now - expiredAt < EXPIRE_INTERVAL) {
+        return {};
+    }
+    expiredAt = now;
+    return remove([&](const std::string&, const Presence& presence) { return now - presence.seen > PRESENCE_TIMEOUT; });
+}
+
+std::vector<std::string> FleetState::nodesOf(const std::string& email) const {
+    std::vector<std::string> nodes;
+    auto it = online.find(email);
+    if (it == online.end()) {
+        return nodes;
+    }
+    // Sorted by node, several instances of one node are next to each other
+    for (const auto& [where, presence] : it->second) {
+        const std::string& node = where.first;
+        if (nodes.empty() || nodes.back() != node) {
+            nodes.push_back(node);
+        }
+    }
+    return nodes;
+}
+
+std::vector<FleetState::MultiNode> FleetState::takeOverLimit() {
+    std::vector<MultiNode> result;
+    if (maxNodes == 0) {
+        changed.clear();
+        return result;
+    }
+    for (const auto& email : changed) {
+        std::vector<std::string> nodes = nodesOf(email);
+        if (nodes.size() <= maxNodes) {
+            overLimit.erase(email);
+        }
+        else if (overLimit.insert(email).second) {
+            result.push_back({ email, std::move(nodes) });
+        }
+    }
+    changed.clear();
+    return result;
+}
+
+void FleetState::collectMetrics(metrics::Snapshot& snapshot) const {
+    for (const auto& [email, locations] : online) {
+        for (const auto& [where, presence] : locations) {
+            metrics::UserState state;
+            state.instance = location(where.first, where.second);
+            state.email = email;
+            state.id = presence.id;
+            state.ip = presence.ip;
+            state.lastTime = presence.time;
+            state.online = true;
+            state.connections = 1;
+            IpAddress address;
+            if (IpAddress::parse(presence.ip, address)) {
+                state.addresses.push_back(address);
+            }
+            state.ips = state.addresses.size();
+            snapshot.users.push_back(std::move(state));
+        }
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef FLEETSTATE_H
+#define FLEETSTATE_H
+
+#include "FleetProtocol.h"
+#include "Metrics.h"
+#include <ctime>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+// Users online across all agents of the collector. Applying an event twice
+// changes nothing, so events resent after a reconnect are not reported again.
+// A presence no event has confirmed for PRESENCE_TIMEOUT is expired: agents
+// repeat the connections of their online users more often than that.
+class FleetState {
+public:
+    // Seconds, the inactivity window of the agents
+    static const std::time_t PRESENCE_TIMEOUT = 2 * 60 * 60;
+
+    // Disconnection the agent has not reported
+    struct Departure {
+        std::string node;
+        fleet::Event event;
+    };
+
+    struct MultiNode {
+        std::string email;
+        std::vector<std::string> nodes;
+    };
+
+    // Alerts when a user is online on more than `maxNodes` nodes, 0 - never
+    explicit FleetState(unsigned int maxNodes);
+
+    // False if the event is known already. A repeated connection only
+    // renews the presence
+    bool apply(const std::string& node, const fleet::Event& event, std::time_t now);
+    // Forgets the users online on the node, e.g. one that has lost its spool
+    std::vector<Departure> dropNode(const std::string& node);
+    // Forgets presences not confirmed for PRESENCE_TIMEOUT
+    std::vector<Departure> expire(std::time_t now);
+    // Users who have gone over the node limit since the last call.
+    // Reported once until they are back within the limit
+    std::vector<MultiNode> takeOverLimit();
+
+    // Online users, by location
+    void collectMetrics(metrics::Snapshot& snapshot) const;
+
+    // "node" or "node/instance"
+    static std::string location(const std::string& node, const std::string& instance);
+
+private:
+    // Of the connection event
+    struct Presence {
+        std::string id;
+        std::string ip;
+        std::time_t time = 0;
+        // When the collector has last had an event of it
+        std::time_t seen = 0;
+    };
+
+    unsigned int maxNodes;
+    // Email -> (node, instance) where the user is online
+    std::map<std::string, std::map<std::pair<std::string, std::string>, Presence>> online;
+    // Emails with changed locations since takeOverLimit()
+    std::set<std::string> changed;
+    std::set<std::string> overLimit;
+    // Node, instance and email of every reported unknown user
+    std::set<std::string> suspicious;
+    std::time_t expiredAt = 0;
+
+    std::vector<std::string> nodesOf(const std::string& email) const;
+    // Removes the presences `drop` selects, as disconnection events
+    template <class Predicate>
+    std::vector<Departure> remove(Predicate drop);
+};
+
+#endif
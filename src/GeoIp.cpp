@@ -0,0 +1,365 @@
+#include "GeoIp.h"
+#include <boost/log/trivial.hpp>
+#include <cerrno>
+#include <cstring>
+#include <initializer_list>
+#include <iterator>
+#include <stdexcept>
+#include <string_view>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+namespace {
+    const char METADATA_MARKER[] = "\xAB\xCD\xEFMaxMind.com";
+    const std::size_t MARKER_SIZE = sizeof(METADATA_MARKER) - 1;
+    // The metadata is within the last 128 KiB of a file
+    const std::size_t METADATA_MAX = 128 * 1024;
+    // Zero bytes between the search tree and the data section
+    const std::size_t SEPARATOR = 16;
+    // Nesting of skipped maps and arrays, deeper is a corrupt file
+    const int MAX_DEPTH = 32;
+
+    enum Type : std::uint8_t {
+        Extended = 0,
+        Pointer = 1,
+        String = 2,
+        Uint16 = 5,
+        Uint32 = 6,
+        Map = 7,
+        Uint64 = 9,
+        Array = 11,
+        Boolean = 14,
+    };
+
+    struct Field {
+        std::uint8_t type = Extended;
+        // Payload bytes, entries of a map or an array, value of a boolean
+        // or target of a pointer
+        std::size_t size = 0;
+        // Of the payload or of the first entry
+        std::size_t offset = 0;
+    };
+
+    // Data or metadata section decoded without copying. Offsets are relative
+    // to the section; every read is bounds checked and fails on a corrupt file
+    class Section {
+    public:
+        Section(const std::uint8_t* data, std::size_t size) : data(data), size(size) {}
+
+        // Field at `offset` with pointers followed. Moves `offset` past the
+        // field, past only the control bytes of a map or an array
+        bool decode(std::size_t& offset, Field& field) const {
+            if (!control(offset, field)) {
+                return false;
+            }
+            if (field.type != Pointer) {
+                return true;
+            }
+            std::size_t target = field.size;
+            return control(target, field) && field.type != Pointer;
+        }
+
+        // Moves `offset` past the field and all of its entries
+        bool skip(std::size_t& offset, int depth = 0) const {
+            Field field;
+            if (depth > MAX_DEPTH || !control(offset, field)) {
+                return false;
+            }
+            std::size_t entries = field.type == Map ? field.size * 2 : field.type == Array ? field.size : 0;
+            for (std::size_t i = 0; i < entries; ++i) {
+                if (!skip(offset, depth + 1)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Value at `path` of nested maps, starting with the map at `offset`
+        bool find(std::size_t offset, std::initializer_list<std::string_view> path, Field& value) const {
+            for (std::string_view key : path) {
+                Field map;
+                if (!decode(offset, map) || map.type != Map) {
+                    return false;
+                }
+                std::size_t pos = map.offset;
+                bool found = false;
+                for (std::size_t i = 0; i < map.size && !found; ++i) {
+                    Field name;
+                    if (!decode(pos, name) || name.type != String) {
+                        return false;
+                    }
+                    if (text(name) == key) {
+                        offset = pos;
+                        found = true;
+                    }
+                    else if (!skip(pos)) {
+                        return false;
+                    }
+                }
+                if (!found) {
+                    return false;
+                }
+            }
+            return decode(offset, value);
+        }
+
+        std::string_view text(const Field& field) const {
+            return { reinterpret_cast<const char*>(data + field.offset), field.size };
+        }
+
+        bool number(const Field& field, std::uint64_t& value) const {
+            if ((field.type != Uint16 && field.type != Uint32 && field.type != Uint64) || field.size > 8) {
+                return false;
+            }
+            value = 0;
+            for (std::size_t i = 0; i < field.size; ++i) {
+                value = value << 8 | data[field.offset + i];
+            }
+            return true;
+        }
+
+    private:
+        const std::uint8_t* data;
+        std::size_t size;
+
+        std::size_t bigEndian(std::size_t offset, std::size_t length, std::size_t value = 0) const {
+            for (std::size_t i = 0; i < length; ++i) {
+                value = value << 8 | data[offset + i];
+            }
+            return value;
+        }
+
+        // Control byte(s) of the field at `offset`, pointers are not followed
+        bool control(std::size_t& offset, Field& field) const {
+            if (offset >= size) {
+                return false;
+            }
+            std::uint8_t byte = data[offset++];
+            field.type = byte >> 5;
+            if (field.type == Pointer) {
+                static const std::size_t BIAS[] = { 0, 2048, 526336, 0 };
+                std::size_t length = ((byte >> 3) & 3) + 1;
+                if (size - offset < length) {
+                    return false;
+                }
+                field.size = bigEndian(offset, length, length == 4 ? 0 : byte & 7) + BIAS[length - 1];
+                offset += length;
+                return true;
+            }
+            if (field.type == Extended) {
+                if (offset >= size) {
+                    return false;
+                }
+                field.type = static_cast<std::uint8_t>(7 + data[offset++]);
+            }
+            field.size = byte & 0x1f;
+            if (field.size >= 29) {
+                static const std::size_t BASE[] = { 29, 285, 65821 };
+                std::size_t length = field.size - 28;
+                if (size - offset < length) {
+                    return false;
+                }
+                field.size = BASE[length - 1] + bigEndian(offset, length);
+                offset += length;
+            }
+            field.offset = offset;
+            if (field.type != Map && field.type != Array && field.type != Boolean) {
+                if (size - offset < field.size) {
+                    return false;
+                }
+                offset += field.size;
+            }
+            return true;
+        }
+    };
+}
+
+bool geoip::moved(const Location& before, const Location& after) {
+    return !before.country.empty() && !after.country.empty() && before.country != after.country;
+}
+
+std::string geoip::format(const Location& location) {
+    std::string text = location.country;
+    if (location.asn != 0) {
+        if (!text.empty()) {
+            text += " ";
+        }
+        text += "AS" + std::to_string(location.asn);
+        if (!location.organization.empty()) {
+            text += " " + location.organization;
+        }
+    }
+    return text;
+}
+
+MmdbReader::MmdbReader(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+    }
+    struct stat st {};
+    if (::fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        throw std::runtime_error("Cannot read " + path);
+    }
+    size = static_cast<std::size_t>(st.st_size);
+    void* mapped = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        throw std::runtime_error("Cannot map " + path + ": " + std::strerror(errno));
+    }
+    data = static_cast<const std::uint8_t*>(mapped);
+    if (!readMetadata()) {
+        ::munmap(mapped, size);
+        throw std::runtime_error(path + " is not a MaxMind DB file");
+    }
+}
+
+MmdbReader::~MmdbReader() {
+    ::munmap(const_cast<std::uint8_t*>(data), size);
+}
+
+bool MmdbReader::readMetadata() {
+    if (size < MARKER_SIZE) {
+        return false;
+    }
+    // The last marker: the data section could contain the same bytes
+    std::size_t from = size > METADATA_MAX ? size - METADATA_MAX : 0;
+    std::size_t marker = size - MARKER_SIZE + 1;
+    while (marker-- > from) {
+        if (std::memcmp(data + marker, METADATA_MARKER, MARKER_SIZE) == 0) {
+            break;
+        }
+    }
+    if (marker == static_cast<std::size_t>(-1) || marker < from) {
+        return false;
+    }
+    Section metadata(data + marker + MARKER_SIZE, size - marker - MARKER_SIZE);
+    auto number = [&](std::string_view key, std::uint64_t& value) {
+        Field field;
+        return metadata.find(0, { key }, field) && metadata.number(field, value);
+    };
+    std::uint64_t nodes = 0, bits = 0, version = 0;
+    if (!number("node_count", nodes) || !number("record_size", bits) || !number("ip_version", version)) {
+        return false;
+    }
+    if ((bits != 24 && bits != 28 && bits != 32) || (version != 4 && version != 6) || nodes > UINT32_MAX) {
+        return false;
+    }
+    std::uint64_t treeSize = nodes * bits / 4;
+    if (treeSize + SEPARATOR > marker) {
+        return false;
+    }
+    nodeCount = static_cast<std::uint32_t>(nodes);
+    recordSize = static_cast<std::uint32_t>(bits);
+    ipVersion = static_cast<std::uint32_t>(version);
+    records = data + treeSize + SEPARATOR;
+    recordsSize = marker - treeSize - SEPARATOR;
+    Field type;
+    if (metadata.find(0, { "database_type" }, type) && type.type == String) {
+        databaseType = metadata.text(type);
+    }
+    if (ipVersion == 6) {
+        for (int i = 0; i < 96 && ipv4Start < nodeCount; ++i) {
+            ipv4Start = child(ipv4Start, 0);
+        }
+    }
+    return true;
+}
+
+std::uint32_t MmdbReader::child(std::uint32_t node, unsigned int bit) const {
+    const std::uint8_t* p = data + static_cast<std::size_t>(node) * recordSize / 4;
+    auto byte = [](std::uint8_t value, int shift) { return static_cast<std::uint32_t>(value) << shift; };
+    switch (recordSize) {
+    case 24:
+        p += bit * 3;
+        return byte(p[0], 16) | byte(p[1], 8) | p[2];
+    case 28:
+        // The middle byte has the high nibbles of both records
+        if (bit == 0) {
+            return byte(p[3] & 0xf0, 20) | byte(p[0], 16) | byte(p[1], 8) | p[2];
+        }
+        return byte(p[3] & 0x0f, 24) | byte(p[4], 16) | byte(p[5], 8) | p[6];
+    default:
+        p += bit * 4;
+        return byte(p[0], 24) | byte(p[1], 16) | byte(p[2], 8) | p[3];
+    }
+}
+
+void MmdbReader::lookup(const IpAddress& address, geoip::Location& location) const {
+    std::uint32_t node = 0;
+    unsigned int bits = 128;
+    if (address.isV4()) {
+        node = ipVersion == 6 ? ipv4Start : 0;
+        bits = 32;
+    }
+    else if (ipVersion == 4) {
+        return;
+    }
+    for (unsigned int i = 0; i < bits && node < nodeCount; ++i) {
+        unsigned int bit;
+        if (bits == 32) {
+            bit = (address.lo >> (31 - i)) & 1;
+        }
+        else {
+            bit = i < 64 ? (address.hi >> (63 - i)) & 1 : (address.lo >> (127 - i)) & 1;
+        }
+        node = child(node, bit);
+    }
+    // nodeCount itself means no data for the address
+    if (node <= nodeCount) {
+        return;
+    }
+    std::size_t offset = node - nodeCount - SEPARATOR;
+    Section section(records, recordsSize);
+    Field field;
+    if (location.country.empty()
+        && (section.find(offset, { "country", "iso_code" }, field) || section.find(offset, { "registered_country", "iso_code" }, field))
+        && field.type == String) {
+        location.country = section.text(field);
+    }
+    std::uint64_t asn = 0;
+    if (location.asn == 0 && section.find(offset, { "autonomous_system_number" }, field) && section.number(field, asn)) {
+        location.asn = static_cast<std::uint32_t>(asn);
+        if (section.find(offset, { "autonomous_system_organization" }, field) && field.type == String) {
+            location.organization = section.text(field);
+        }
+    }
+}
+
+GeoIp::GeoIp(const std::vector<std::string>& paths) {
+    for (const auto& path : paths) {
+        readers.push_back(std::make_unique<MmdbReader>(path));
+        BOOST_LOG_TRIVIAL(info) << "GeoIP database " << path << " loaded: " << readers.back()->type();
+    }
+}
+
+geoip::Location GeoIp::lookup(const IpAddress& address) const {
+    geoip::Location location;
+    for (const auto& reader : readers) {
+        reader->lookup(address, location);
+    }
+    return location;
+}
+
+const geoip::Location& GeoCache::lookup(const IpAddress& address) {
+    auto it = index.find(address);
+    if (it != index.end()) {
+        entries.splice(entries.begin(), entries, it->second);
+        return it->second->location;
+    }
+    if (entries.size() >= CAPACITY) {
+        // The oldest entry is reused for the new address
+        index.erase(entries.back().address);
+        entries.splice(entries.begin(), entries, std::prev(entries.end()));
+        entries.front() = { address, geoIp.lookup(address) };
+    }
+    else {
+        entries.push_front({ address, geoIp.lookup(address) });
+    }
+    index.emplace(address, entries.begin());
+    return entries.front().location;
+}
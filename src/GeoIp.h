@@ -0,0 +1,98 @@
+#ifndef GEOIP_H
+#define GEOIP_H
+
+#include "IpSet.h"
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+namespace geoip {
+    struct Location {
+        // ISO 3166-1 code, empty if unknown
+        std::string country;
+        // Autonomous system, 0 if unknown
+        std::uint32_t asn = 0;
+        std::string organization;
+
+        bool empty() const { return country.empty() && asn == 0; }
+    };
+
+    // Both countries are known and differ
+    bool moved(const Location& before, const Location& after);
+    // "DE AS3320 Deutsche Telekom AG", empty if unknown
+    std::string format(const Location& location);
+}
+
+// MaxMind DB (.mmdb) file mapped into memory. The search tree is walked
+// and the record is decoded in place, only the fields asked for are
+// copied. Read only, so lookups are safe from several threads.
+class MmdbReader {
+public:
+    // Throws std::runtime_error if the file cannot be mapped or is not a MaxMind DB
+    explicit MmdbReader(const std::string& path);
+    ~MmdbReader();
+    MmdbReader(const MmdbReader&) = delete;
+    MmdbReader& operator=(const MmdbReader&) = delete;
+
+    // Fills the fields still empty in `location` the file has for the address
+    void lookup(const IpAddress& address, geoip::Location& location) const;
+    // "GeoLite2-Country", "GeoLite2-ASN"...
+    const std::string& type() const { return databaseType; }
+
+private:
+    const std::uint8_t* data = nullptr;
+    std::size_t size = 0;
+    std::uint32_t nodeCount = 0;
+    // Bits of a record, two records a node
+    std::uint32_t recordSize = 0;
+    std::uint32_t ipVersion = 0;
+    // Node of ::/96, IPv4 addresses start there in an IPv6 tree
+    std::uint32_t ipv4Start = 0;
+    // Data section, record offsets and pointers are relative to it
+    const std::uint8_t* records = nullptr;
+    std::size_t recordsSize = 0;
+    std::string databaseType;
+
+    bool readMetadata();
+    std::uint32_t child(std::uint32_t node, unsigned int bit) const;
+};
+
+// Country and ASN of addresses from local .mmdb files, e.g. GeoLite2-Country
+// and GeoLite2-ASN, the first file that has a field wins. Never goes to the network
+class GeoIp {
+public:
+    explicit GeoIp(const std::vector<std::string>& paths);
+
+    geoip::Location lookup(const IpAddress& address) const;
+
+private:
+    std::vector<std::unique_ptr<MmdbReader>> readers;
+};
+
+// Recent lookups of one thread, the least recently used one is dropped
+class GeoCache {
+public:
+    static const std::size_t CAPACITY = 4096;
+
+    explicit GeoCache(const GeoIp& geoIp) : geoIp(geoIp) {}
+
+    // Valid until the next lookup
+    const geoip::Location& lookup(const IpAddress& address);
+
+private:
+    struct Entry {
+        IpAddress address;
+        geoip::Location location;
+    };
+
+    const GeoIp& geoIp;
+    // Most recently used first
+    std::list<Entry> entries;
+    std::unordered_map<IpAddress, std::list<Entry>::iterator, IpAddressHash> index;
+};
+
+#endif
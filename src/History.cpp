@@ -0,0 +1,478 @@
+#include "History.h"
+#include "utils.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+#include <boost/filesystem.hpp>
+#include <boost/log/trivial.hpp>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+namespace fs = boost::filesystem;
+using history::Record;
+using history::SegmentHeader;
+
+namespace {
+    const char MAGIC[4] = { 'X', 'M', 'H', 'S' };
+    const std::time_t SEGMENT_SPAN = 24 * 60 * 60;
+    const std::uint64_t SEGMENT_RECORDS = 1 << 20;
+    // Sealed segments are merged up to that
+    const std::uint64_t COMPACT_RECORDS = 1 << 20;
+    const std::time_t COMPACT_SPAN = 7 * 24 * 60 * 60;
+
+    bool writeAll(int fd, const char* data, std::size_t size) {
+        while (size > 0) {
+            ssize_t n = ::write(fd, data, size);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            data += n;
+            size -= static_cast<std::size_t>(n);
+        }
+        return true;
+    }
+
+    // Sorted by name, which is the creation time
+    std::vector<std::string> listSegments(const std::string& dir) {
+        std::vector<std::string> paths;
+        boost::system::error_code ec;
+        for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+            if (it->path().extension() == ".seg") {
+                paths.push_back(it->path().string());
+            }
+        }
+        std::sort(paths.begin(), paths.end());
+        return paths;
+    }
+
+    bool readHeader(int fd, SegmentHeader& header) {
+        return ::pread(fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header)) &&
+            std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 && header.version == history::VERSION;
+    }
+
+    SegmentHeader makeHeader(bool sealed, std::uint64_t count, std::int64_t minTime, std::int64_t maxTime) {
+        SegmentHeader header {};
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = history::VERSION;
+        header.sealed = sealed ? 1 : 0;
+        header.count = count;
+        header.minTime = minTime;
+        header.maxTime = maxTime;
+        return header;
+    }
+
+    // Records of a segment, sealed or not
+    bool readRecords(const std::string& path, std::vector<Record>& records) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        SegmentHeader header;
+        struct stat st {};
+        bool ok = readHeader(fd, header) && ::fstat(fd, &st) == 0;
+        if (ok) {
+            std::size_t count = header.sealed ? header.count :
+                (static_cast<std::size_t>(st.st_size) - sizeof(header)) / sizeof(Record);
+            records.resize(count);
+            std::size_t bytes = count * sizeof(Record);
+            ok = ::pread(fd, records.data(), bytes, sizeof(header)) == static_cast<ssize_t>(bytes);
+        }
+        ::close(fd);
+        return ok;
+    }
+
+    // Header, records and the index, replaces `path` atomically
+    bool writeSealed(const std::string& path, const std::vector<Record>& records) {
+        std::int64_t minTime = records.empty() ? 0 : records.front().start;
+        std::int64_t maxTime = 0;
+        for (const auto& record : records) {
+            minTime = std::min(minTime, record.start);
+            maxTime = std::max(maxTime, record.end);
+        }
+        std::vector<std::uint32_t> index(records.size());
+        std::iota(index.begin(), index.end(), 0);
+        std::stable_sort(index.begin(), index.end(), [&](std::uint32_t a, std::uint32_t b) {
+            return records[a].user < records[b].user ||
+                (records[a].user == records[b].user && records[a].start < records[b].start);
+        });
+        SegmentHeader header = makeHeader(true, records.size(), minTime, maxTime);
+
+        std::string tmpPath = path + ".tmp";
+        int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        bool ok = fd >= 0 &&
+            writeAll(fd, reinterpret_cast<const char*>(&header), sizeof(header)) &&
+            writeAll(fd, reinterpret_cast<const char*>(records.data()), records.size() * sizeof(Record)) &&
+            writeAll(fd, reinterpret_cast<const char*>(index.data()), index.size() * sizeof(std::uint32_t)) &&
+            ::fsync(fd) == 0;
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        if (!ok || ::rename(tmpPath.c_str(), path.c_str()) != 0) {
+            BOOST_LOG_TRIVIAL(warning)
+                << "Error writing history segment " << path << ": "
+                << std::strerror(errno);
+            ::unlink(tmpPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    std::vector<std::string> readNames(const std::string& path) {
+        std::vector<std::string> names;
+        std::string data;
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            struct stat st {};
+            if (::fstat(fd, &st) == 0) {
+                data.resize(static_cast<std::size_t>(st.st_size));
+                data.resize(std::max<ssize_t>(::pread(fd, data.data(), data.size(), 0), 0));
+            }
+            ::close(fd);
+        }
+        std::size_t pos = 0;
+        std::size_t end;
+        // A line cut by a crash is not a name
+        while ((end = data.find('\n', pos)) != std::string::npos) {
+            names.push_back(data.substr(pos, end - pos));
+            pos = end + 1;
+        }
+        return names;
+    }
+}
+
+History::History(const std::string& dir, unsigned int retentionDays)
+    : dir(dir), retention(static_cast<std::time_t>(retentionDays) * 24 * 60 * 60) {
+    fs::create_directories(dir);
+    std::string namesPath = dir + "/names";
+    std::vector<std::string> names = readNames(namesPath);
+    for (std::uint32_t i = 0; i < names.size(); ++i) {
+        ids.emplace(names[i], i);
+    }
+    // Without the cut line, if any
+    std::size_t namesSize = 0;
+    for (const auto& name : names) {
+        namesSize += name.size() + 1;
+    }
+    namesFd = ::open(namesPath.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (namesFd < 0 || ::ftruncate(namesFd, static_cast<off_t>(namesSize)) != 0 || ::lseek(namesFd, 0, SEEK_END) < 0) {
+        throw std::runtime_error("Cannot open " + namesPath + ": " + std::strerror(errno));
+    }
+
+    // The last segment of the previous run goes on
+    auto segments = listSegments(dir);
+    if (!segments.empty()) {
+        const std::string& last = segments.back();
+        int lastFd = ::open(last.c_str(), O_RDWR | O_CLOEXEC);
+        SegmentHeader header;
+        std::vector<Record> records;
+        if (lastFd >= 0 && readHeader(lastFd, header) && !header.sealed && readRecords(last, records)) {
+            fd = lastFd;
+            segmentPath = last;
+            segmentStart = static_cast<std::time_t>(std::stoll(fs::path(last).stem().string()));
+            count = records.size();
+            // Drops a record cut by a crash
+            if (::ftruncate(fd, static_cast<off_t>(sizeof(SegmentHeader) + count * sizeof(Record))) != 0) {
+                BOOST_LOG_TRIVIAL(warning) << "Cannot truncate history segment " << last;
+            }
+        }
+        else if (lastFd >= 0) {
+            ::close(lastFd);
+        }
+    }
+    std::time_t now = std::time(nullptr);
+    if (fd < 0) {
+        openSegment(now);
+    }
+    expire(now);
+    compact();
+    BOOST_LOG_TRIVIAL(info) << "Recording session history to " << dir;
+}
+
+History::~History() {
+    for (int descriptor : { fd, namesFd }) {
+        if (descriptor >= 0) {
+            ::close(descriptor);
+        }
+    }
+}
+
+void History::connected(const Peer& peer) {
+    // Already open if the event is repeated
+    open.try_emplace(peer.instance + "\n" + peer.email, Open{ peer.lastTime, peer.ip });
+}
+
+void History::disconnected(const Peer& peer) {
+    auto it = open.find(peer.instance + "\n" + peer.email);
+    if (it == open.end()) {
+        return;
+    }
+    Record record {};
+    record.start = it->second.start;
+    record.end = std::max<std::int64_t>(peer.lastTime, record.start);
+    record.user = intern(peer.email);
+    record.instance = intern(peer.instance);
+    IpAddress address;
+    const std::string& ip = peer.ip.empty() ? it->second.ip : peer.ip;
+    if (IpAddress::parse(ip, address)) {
+        record.ipHi = address.hi;
+        record.ipLo = address.lo;
+    }
+    open.erase(it);
+    append(record);
+}
+
+void History::closeSessions(std::time_t now) {
+    while (!open.empty()) {
+        auto it = open.begin();
+        std::size_t newline = it->first.find('\n');
+        Peer peer;
+        peer.instance = it->first.substr(0, newline);
+        peer.email = it->first.substr(newline + 1);
+        peer.lastTime = now;
+        disconnected(peer);
+    }
+}
+
+std::uint32_t History::intern(const std::string& name) {
+    auto it = ids.find(name);
+    if (it != ids.end()) {
+        return it->second;
+    }
+    auto id = static_cast<std::uint32_t>(ids.size());
+    // Before any record that refers to it
+    std::string line = name + "\n";
+    if (!writeAll(namesFd, line.data(), line.size())) {
+        BOOST_LOG_TRIVIAL(warning)
+            << "Error writing history names: "
+            << std::strerror(errno);
+    }
+    ids.emplace(name, id);
+    return id;
+}
+
+void History::append(const Record& record) {
+    if (fd < 0) {
+        return;
+    }
+    off_t offset = static_cast<off_t>(sizeof(SegmentHeader) + count * sizeof(Record));
+    if (::pwrite(fd, &record, sizeof(record), offset) != static_cast<ssize_t>(sizeof(record))) {
+        BOOST_LOG_TRIVIAL(warning)
+            << "Error writing history segment " << segmentPath << ": "
+            << std::strerror(errno);
+        return;
+    }
+    ++count;
+}
+
+void History::openSegment(std::time_t now) {
+    std::time_t start = now;
+    std::string path;
+    do {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%010lld.seg", static_cast<long long>(start++));
+        path = (fs::path(dir) / name).string();
+    } while (fs::exists(path));
+
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    SegmentHeader header = makeHeader(false, 0, 0, 0);
+    if (fd < 0 || !writeAll(fd, reinterpret_cast<const char*>(&header), sizeof(header))) {
+        BOOST_LOG_TRIVIAL(error)
+            << "Cannot create history segment " << path << ": "
+            << std::strerror(errno);
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+        return;
+    }
+    segmentPath = path;
+    segmentStart = start - 1;
+    count = 0;
+}
+
+void History::maintain(std::time_t now) {
+    if (fd >= 0 && (count == 0 || (now - segmentStart < SEGMENT_SPAN && count < SEGMENT_RECORDS))) {
+        return;
+    }
+    if (fd >= 0) {
+        seal();
+    }
+    openSegment(now);
+    expire(now);
+    compact();
+}
+
+void History::seal() {
+    std::vector<Record> records;
+    if (readRecords(segmentPath, records) && writeSealed(segmentPath, records)) {
+        BOOST_LOG_TRIVIAL(debug) << "History segment " << segmentPath << " sealed, " << records.size() << " sessions";
+    }
+    ::close(fd);
+    fd = -1;
+}
+
+void History::expire(std::time_t now) {
+    if (retention == 0) {
+        return;
+    }
+    for (const auto& path : listSegments(dir)) {
+        if (path == segmentPath) {
+            continue;
+        }
+        int segmentFd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        SegmentHeader header;
+        bool old = segmentFd >= 0 && readHeader(segmentFd, header) && header.sealed && header.maxTime < now - retention;
+        if (segmentFd >= 0) {
+            ::close(segmentFd);
+        }
+        if (old && ::unlink(path.c_str()) == 0) {
+            BOOST_LOG_TRIVIAL(info) << "History segment " << path << " is past the retention, removed";
+        }
+    }
+}
+
+void History::compact() {
+    std::vector<std::string> group;
+    std::uint64_t groupCount = 0;
+    std::int64_t groupStart = 0;
+
+    auto merge = [&]() {
+        if (group.size() > 1) {
+            std::vector<Record> merged;
+            merged.reserve(groupCount);
+            bool ok = true;
+            for (const auto& path : group) {
+                std::vector<Record> records;
+                ok = ok && readRecords(path, records);
+                merged.insert(merged.end(), records.begin(), records.end());
+            }
+            // Into the oldest one, the others go after it is in place
+            if (ok && writeSealed(group.front(), merged)) {
+                for (std::size_t i = 1; i < group.size(); ++i) {
+                    ::unlink(group[i].c_str());
+                }
+                BOOST_LOG_TRIVIAL(info)
+                    << "History segments merged into " << group.front() << ", " << merged.size() << " sessions";
+            }
+        }
+        group.clear();
+        groupCount = 0;
+    };
+
+    for (const auto& path : listSegments(dir)) {
+        int segmentFd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        SegmentHeader header;
+        bool sealed = segmentFd >= 0 && readHeader(segmentFd, header) && header.sealed && path != segmentPath;
+        if (segmentFd >= 0) {
+            ::close(segmentFd);
+        }
+        if (!sealed) {
+            merge();
+            continue;
+        }
+        if (!group.empty() &&
+            (groupCount + header.count > COMPACT_RECORDS || header.maxTime - groupStart > COMPACT_SPAN)) {
+            merge();
+        }
+        if (group.empty()) {
+            groupStart = header.minTime;
+        }
+        group.push_back(path);
+        groupCount += header.count;
+    }
+    merge();
+}
+
+HistoryReader::HistoryReader(const std::string& dir) {
+    if (!fs::is_directory(dir)) {
+        throw std::runtime_error("No session history in " + dir);
+    }
+    names = readNames(dir + "/names");
+    for (std::uint32_t i = 0; i < names.size(); ++i) {
+        ids.emplace(names[i], i);
+    }
+    for (const auto& path : listSegments(dir)) {
+        // Removed by compaction meanwhile
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+        struct stat st {};
+        SegmentHeader header;
+        if (!readHeader(fd, header) || ::fstat(fd, &st) != 0) {
+            ::close(fd);
+            continue;
+        }
+        auto size = static_cast<std::size_t>(st.st_size);
+        std::size_t needed = sizeof(header) + (header.sealed ? header.count * (sizeof(Record) + sizeof(std::uint32_t)) : 0);
+        void* data = size >= needed ? ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            continue;
+        }
+        mapped.push_back({ static_cast<const char*>(data), size });
+    }
+}
+
+HistoryReader::~HistoryReader() {
+    for (const auto& segment : mapped) {
+        ::munmap(const_cast<char*>(segment.data), segment.size);
+    }
+}
+
+std::vector<history::Session> HistoryReader::query(const std::string& email, std::time_t since, std::time_t until) const {
+    std::vector<history::Session> sessions;
+    auto it = ids.find(email);
+    if (it == ids.end()) {
+        return sessions;
+    }
+    std::uint32_t user = it->second;
+
+    auto add = [&](const Record& record) {
+        if (record.user != user || record.start > until || record.end < since) {
+            return;
+        }
+        history::Session session;
+        session.instance = record.instance < names.size() ? names[record.instance] : "";
+        if (record.ipHi != 0 || record.ipLo != 0) {
+            session.ip = IpAddress{ record.ipHi, record.ipLo }.toString();
+        }
+        session.start = static_cast<std::time_t>(record.start);
+        session.end = static_cast<std::time_t>(record.end);
+        sessions.push_back(std::move(session));
+    };
+
+    for (const auto& segment : mapped) {
+        SegmentHeader header;
+        std::memcpy(&header, segment.data, sizeof(header));
+        const auto* records = reinterpret_cast<const Record*>(segment.data + sizeof(header));
+        if (!header.sealed) {
+            // Being written: scanned, it holds a day at most
+            std::size_t count = (segment.size - sizeof(header)) / sizeof(Record);
+            for (std::size_t i = 0; i < count; ++i) {
+                add(records[i]);
+            }
+            continue;
+        }
+        if (header.minTime > until || header.maxTime < since) {
+            continue;
+        }
+        const auto* index = reinterpret_cast<const std::uint32_t*>(records + header.count);
+        const auto* end = index + header.count;
+        const auto* first = std::lower_bound(index, end, user, [&](std::uint32_t i, std::uint32_t value) {
+            return records[i].user < value;
+        });
+        for (const auto* i = first; i != end && *i < header.count && records[*i].user == user; ++i) {
+            add(records[*i]);
+        }
+    }
+    std::sort(sessions.begin(), sessions.end(), [](const history::Session& a, const history::Session& b) {
+        return a.start < b.start;
+    });
+    return sessions;
+}
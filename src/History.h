@@ -0,0 +1,119 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "PeerTable.h"
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+// Sessions (connection to disconnection) of all users in a directory of
+// segment files, each covering about a day. A segment is a header, fixed
+// size records in the order sessions ended and, once sealed, an index of
+// the records sorted by user. Users and instances are numbered by the
+// `names` file, one name per line. Native byte order.
+namespace history {
+    const std::uint32_t VERSION = 1;
+
+    struct Record {
+        std::int64_t start;
+        std::int64_t end;
+        // Lines of the names file
+        std::uint32_t user;
+        std::uint32_t instance;
+        // IpAddress, zero if unknown
+        std::uint64_t ipHi;
+        std::uint64_t ipLo;
+        std::uint64_t reserved;
+    };
+    static_assert(sizeof(Record) == 48, "Record is a part of the file format");
+
+    struct SegmentHeader {
+        char magic[4];
+        std::uint32_t version;
+        std::uint32_t sealed;
+        std::uint32_t reserved;
+        // Valid once sealed: earliest start, latest end, records before the index
+        std::int64_t minTime;
+        std::int64_t maxTime;
+        std::uint64_t count;
+        char padding[24];
+    };
+    static_assert(sizeof(SegmentHeader) == 64, "SegmentHeader is a part of the file format");
+
+    struct Session {
+        std::string instance;
+        std::string ip;
+        std::time_t start = 0;
+        std::time_t end = 0;
+    };
+}
+
+// Records sessions of the monitor as they end. Used by the main thread only
+class History {
+public:
+    History(const std::string& dir, unsigned int retentionDays);
+    ~History();
+    History(const History&) = delete;
+    History& operator=(const History&) = delete;
+
+    void connected(const Peer& peer);
+    void disconnected(const Peer& peer);
+    // Ends the open sessions, on shutdown
+    void closeSessions(std::time_t now);
+    // Seals the segment once it is a day old, then drops segments older
+    // than the retention and merges small ones. Cheap if nothing is due
+    void maintain(std::time_t now);
+
+private:
+    struct Open {
+        std::time_t start;
+        std::string ip;
+    };
+
+    std::string dir;
+    std::time_t retention;
+    std::unordered_map<std::string, std::uint32_t> ids;
+    int namesFd = -1;
+    // Active segment
+    int fd = -1;
+    std::string segmentPath;
+    std::time_t segmentStart = 0;
+    std::uint64_t count = 0;
+    // By instance and email
+    std::unordered_map<std::string, Open> open;
+
+    std::uint32_t intern(const std::string& name);
+    void append(const history::Record& record);
+    void openSegment(std::time_t now);
+    void seal();
+    void expire(std::time_t now);
+    void compact();
+};
+
+// Memory mapped segments of a history directory, for queries
+class HistoryReader {
+public:
+    explicit HistoryReader(const std::string& dir);
+    ~HistoryReader();
+    HistoryReader(const HistoryReader&) = delete;
+    HistoryReader& operator=(const HistoryReader&) = delete;
+
+    // Sessions of `email` overlapping [since, until], by start time
+    std::vector<history::Session> query(const std::string& email, std::time_t since, std::time_t until) const;
+    std::size_t segments() const { return mapped.size(); }
+
+private:
+    struct Mapped {
+        const char* data;
+        std::size_t size;
+    };
+
+    std::vector<Mapped> mapped;
+    std::vector<std::string> names;
+    std::unordered_map<std::string, std::uint32_t> ids;
+};
+
+#endif
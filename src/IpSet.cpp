@@ -0,0 +1,127 @@
+#include "IpSet.h"
+#include <arpa/inet.h>
+#include <cstring>
+
+
+bool IpAddress::parse(std::string_view text, IpAddress& address) {
+    char buf[INET6_ADDRSTRLEN];
+    if (text.empty() || text.size() >= sizeof(buf)) {
+        return false;
+    }
+    std::memcpy(buf, text.data(), text.size());
+    buf[text.size()] = '\0';
+
+    unsigned char bytes[16] = {};
+    if (text.find(':') == std::string_view::npos) {
+        if (inet_pton(AF_INET, buf, bytes + 12) != 1) {
+            return false;
+        }
+        bytes[10] = 0xff;
+        bytes[11] = 0xff;
+    }
+    else if (inet_pton(AF_INET6, buf, bytes) != 1) {
+        return false;
+    }
+    address.hi = 0;
+    address.lo = 0;
+    for (int i = 0; i < 8; ++i) {
+        address.hi = address.hi << 8 | bytes[i];
+        address.lo = address.lo << 8 | bytes[i + 8];
+    }
+    return true;
+}
+
+std::string IpAddress::toString() const {
+    unsigned char bytes[16];
+    for (int i = 0; i < 8; ++i) {
+        bytes[i] = static_cast<unsigned char>(hi >> (56 - 8 * i));
+        bytes[i + 8] = static_cast<unsigned char>(lo >> (56 - 8 * i));
+    }
+    char buf[INET6_ADDRSTRLEN];
+    const char* text = isV4()
+        ? inet_ntop(AF_INET, bytes + 12, buf, sizeof(buf))
+        : inet_ntop(AF_INET6, bytes, buf, sizeof(buf));
+    return text ? std::string(text) : std::string();
+}
+
+IpSet::IpSet(const IpSet& other)
+    : entries(other.entries), inlineCount(other.inlineCount),
+    spilled(other.spilled ? std::make_unique<Map>(*other.spilled) : nullptr) {}
+
+IpSet& IpSet::operator=(const IpSet& other) {
+    if (this != &other) {
+        entries = other.entries;
+        inlineCount = other.inlineCount;
+        spilled = other.spilled ? std::make_unique<Map>(*other.spilled) : nullptr;
+    }
+    return *this;
+}
+
+void IpSet::touch(const IpAddress& address, std::time_t seen) {
+    if (!spilled) {
+        for (std::size_t i = 0; i < inlineCount; ++i) {
+            if (entries[i].address == address) {
+                if (seen > entries[i].seen) {
+                    entries[i].seen = seen;
+                }
+                return;
+            }
+        }
+        if (inlineCount < INLINE) {
+            entries[inlineCount++] = Entry{ address, seen };
+            return;
+        }
+        spilled = std::make_unique<Map>();
+        spilled->reserve(INLINE * 4);
+        for (std::size_t i = 0; i < inlineCount; ++i) {
+            spilled->emplace(entries[i].address, entries[i].seen);
+        }
+        inlineCount = 0;
+    }
+    // Looked up first: emplace() allocates a node even for a known address
+    auto it = spilled->find(address);
+    if (it != spilled->end()) {
+        if (seen > it->second) {
+            it->second = seen;
+        }
+        return;
+    }
+    spilled->emplace(address, seen);
+    if (spilled->size() > LIMIT) {
+        dropOldest();
+    }
+}
+
+void IpSet::expire(std::time_t before) {
+    if (!spilled) {
+        std::size_t kept = 0;
+        for (std::size_t i = 0; i < inlineCount; ++i) {
+            if (entries[i].seen > before) {
+                entries[kept++] = entries[i];
+            }
+        }
+        inlineCount = kept;
+        return;
+    }
+    for (auto it = spilled->begin(); it != spilled->end();) {
+        it = it->second > before ? std::next(it) : spilled->erase(it);
+    }
+    if (spilled->size() <= INLINE) {
+        // Back to the compact form
+        inlineCount = 0;
+        for (const auto& [address, seen] : *spilled) {
+            entries[inlineCount++] = Entry{ address, seen };
+        }
+        spilled.reset();
+    }
+}
+
+void IpSet::dropOldest() {
+    auto oldest = spilled->begin();
+    for (auto it = spilled->begin(); it != spilled->end(); ++it) {
+        if (it->second < oldest->second) {
+            oldest = it;
+        }
+    }
+    spilled->erase(oldest);
+}
@@ -0,0 +1,84 @@
+#ifndef IPSET_H
+#define IPSET_H
+
+#include <array>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+
+// Binary IP address. IPv4 is kept in the low 32 bits of the
+// IPv4-mapped IPv6 form (::ffff:a.b.c.d), so both fit 128 bits.
+struct IpAddress {
+    std::uint64_t hi = 0;
+    std::uint64_t lo = 0;
+
+    // Without heap allocation; false if the text is not an address
+    static bool parse(std::string_view text, IpAddress& address);
+    bool isV4() const { return hi == 0 && (lo >> 32) == 0xffff; }
+    std::string toString() const;
+
+    bool operator==(const IpAddress& other) const { return hi == other.hi && lo == other.lo; }
+    bool operator!=(const IpAddress& other) const { return !(*this == other); }
+};
+
+struct IpAddressHash {
+    std::size_t operator()(const IpAddress& address) const {
+        std::uint64_t h = address.hi * 0x9E3779B97F4A7C15ULL ^ address.lo;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        return static_cast<std::size_t>(h ^ (h >> 33));
+    }
+};
+
+// Source addresses of one user with the time each was last seen.
+// A few addresses are stored inline; more spill into a hash map.
+// The set never grows above LIMIT, the oldest address is dropped.
+class IpSet {
+public:
+    static const std::size_t INLINE = 4;
+    static const std::size_t LIMIT = 256;
+
+    IpSet() = default;
+    IpSet(const IpSet& other);
+    IpSet& operator=(const IpSet& other);
+    IpSet(IpSet&&) = default;
+    IpSet& operator=(IpSet&&) = default;
+
+    void touch(const IpAddress& address, std::time_t seen);
+    // Removes addresses not seen after `before`
+    void expire(std::time_t before);
+    std::size_t size() const { return spilled ? spilled->size() : inlineCount; }
+    bool empty() const { return size() == 0; }
+
+    template <class F>
+    void forEach(F&& f) const {
+        if (spilled) {
+            for (const auto& [address, seen] : *spilled) {
+                f(address, seen);
+            }
+            return;
+        }
+        for (std::size_t i = 0; i < inlineCount; ++i) {
+            f(entries[i].address, entries[i].seen);
+        }
+    }
+
+private:
+    struct Entry {
+        IpAddress address;
+        std::time_t seen = 0;
+    };
+    using Map = std::unordered_map<IpAddress, std::time_t, IpAddressHash>;
+
+    std::array<Entry, INLINE> entries;
+    std::size_t inlineCount = 0;
+    std::unique_ptr<Map> spilled;
+
+    void dropOldest();
+};
+
+#endif
@@ -0,0 +1,164 @@
+#include "LogReader.h"
+#include "Metrics.h"
+#include "Profiler.h"
+#include <boost/log/trivial.hpp>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+const std::size_t READ_CHUNK_SIZE = 64 * 1024;
+
+LogReader::LogReader(const std::string& path, std::size_t tailBytes)
+    : path(path), tailBytes(tailBytes) {}
+
+LogReader::~LogReader() {
+    closeFile();
+}
+
+std::size_t LogReader::readLines(std::vector<std::string_view>& lines, std::size_t maxBytes) {
+    // Lines of the previous call are not referenced anymore, only the incomplete one is kept
+    text.erase(0, returned);
+    returned = 0;
+    std::size_t consumed = fill(maxBytes);
+    splitLines(lines);
+    return consumed;
+}
+
+std::size_t LogReader::fill(std::size_t maxBytes) {
+    if (fd < 0) {
+        // The very first open starts near the end, reopen after rotation starts from the beginning
+        if (!openFile(inode == 0)) {
+            return 0;
+        }
+    }
+
+    struct stat pathStat {};
+    if (::stat(path.c_str(), &pathStat) != 0) {
+        // Moved away and not yet recreated: read what is left in the old file
+        return drain(maxBytes);
+    }
+
+    std::size_t consumed = 0;
+    if (pathStat.st_ino != inode || pathStat.st_dev != device) {
+        // Rename rotation: finish the old file, then switch to the new one
+        consumed += drain();
+        if (!text.empty() && text.back() != '\n') {
+            // The old file ended without a newline, its last line is complete anyway
+            text += '\n';
+        }
+        BOOST_LOG_TRIVIAL(info) << "Access log rotated, reopening " << path;
+        closeFile();
+        if (!openFile(false)) {
+            return consumed;
+        }
+    }
+    else {
+        struct stat fdStat {};
+        if (::fstat(fd, &fdStat) == 0 && fdStat.st_size < offset) {
+            // Copytruncate rotation: the same file was cut down
+            BOOST_LOG_TRIVIAL(info) << "Access log truncated, reading from the beginning";
+            offset = 0;
+            text.clear();
+        }
+    }
+
+    consumed += drain(maxBytes);
+    return consumed;
+}
+
+bool LogReader::resume(dev_t savedDevice, ino_t savedInode, off_t savedOffset) {
+    closeFile();
+    text.clear();
+    returned = 0;
+    if (!openFile(false)) {
+        return false;
+    }
+    struct stat st {};
+    if (savedDevice != device || savedInode != inode ||
+        ::fstat(fd, &st) != 0 || st.st_size < savedOffset) {
+        BOOST_LOG_TRIVIAL(info) << "Access log was replaced, reading " << path << " from the beginning";
+        return false;
+    }
+    offset = savedOffset;
+    return true;
+}
+
+bool LogReader::openFile(bool fromTail) {
+    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        BOOST_LOG_TRIVIAL(debug)
+            << "Error opening XRay log " << path << ": "
+            << std::strerror(errno);
+        return false;
+    }
+    struct stat st {};
+    if (::fstat(fd, &st) != 0) {
+        closeFile();
+        return false;
+    }
+    device = st.st_dev;
+    inode = st.st_ino;
+    offset = 0;
+    if (fromTail && static_cast<std::size_t>(st.st_size) > tailBytes) {
+        offset = st.st_size - static_cast<off_t>(tailBytes);
+        // Skip the first line, it is most likely cut in the middle
+        char c = 0;
+        while (::pread(fd, &c, 1, offset) == 1) {
+            ++offset;
+            if (c == '\n') break;
+        }
+    }
+    return true;
+}
+
+void LogReader::closeFile() {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+std::size_t LogReader::drain(std::size_t maxBytes) {
+    std::size_t total = 0;
+    while (fd >= 0 && total < maxBytes) {
+        // Read straight into the text, its capacity is kept between calls
+        std::size_t used = text.size();
+        text.resize(used + READ_CHUNK_SIZE);
+        auto started = std::chrono::steady_clock::now();
+        ssize_t n = ::pread(fd, &text[used], READ_CHUNK_SIZE, offset);
+        profiler::record(profiler::Stage::Read, std::chrono::steady_clock::now() - started);
+        text.resize(used + (n > 0 ? static_cast<std::size_t>(n) : 0));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            BOOST_LOG_TRIVIAL(debug)
+                << "Error reading XRay log: "
+                << std::strerror(errno);
+            break;
+        }
+        if (n == 0) break;
+        offset += n;
+        total += static_cast<std::size_t>(n);
+    }
+    metrics::counters().bytesRead.fetch_add(total, std::memory_order_relaxed);
+    return total;
+}
+
+void LogReader::splitLines(std::vector<std::string_view>& lines) {
+    profiler::ScopedTimer timer(profiler::Stage::Split);
+    const char* begin = text.data();
+    const char* data = begin;
+    const char* end = begin + text.size();
+    while (data < end) {
+        const char* nl = static_cast<const char*>(std::memchr(data, '\n', end - data));
+        if (nl == nullptr) {
+            // Incomplete line, wait for the rest of it
+            break;
+        }
+        lines.emplace_back(data, nl - data);
+        data = nl + 1;
+    }
+    returned = data - begin;
+}
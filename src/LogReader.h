@@ -0,0 +1,57 @@
+#ifndef LOGREADER_H
+#define LOGREADER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <sys/types.h>
+
+
+// Incremental reader of an append-only log file.
+// Keeps the file open between polls and returns only complete lines
+// appended since the previous call. Follows logrotate in both
+// rename (create) and copytruncate modes.
+class LogReader {
+public:
+    LogReader(const std::string& path, std::size_t tailBytes = 1024 * 1024);
+    ~LogReader();
+    LogReader(const LogReader&) = delete;
+    LogReader& operator=(const LogReader&) = delete;
+
+    // Appends new complete lines to `lines`, returns number of bytes consumed.
+    // Stops after about `maxBytes`, the rest is returned by the next call.
+    // The lines point into a buffer of the reader that is reused, so they
+    // stay valid only until the next call.
+    std::size_t readLines(std::vector<std::string_view>& lines, std::size_t maxBytes = SIZE_MAX);
+    // Continues from `offset` if the file is still the same one,
+    // otherwise (rotated meanwhile) from its beginning
+    bool resume(dev_t device, ino_t inode, off_t offset);
+
+    const std::string& getPath() const { return path; }
+    dev_t getDevice() const { return device; }
+    ino_t getInode() const { return inode; }
+    off_t getOffset() const { return offset; }
+    // End of the last complete line returned, where resume() should continue
+    off_t getCommittedOffset() const { return offset - static_cast<off_t>(text.size() - returned); }
+
+private:
+    std::string path;
+    std::size_t tailBytes;
+    int fd = -1;
+    dev_t device = 0;
+    ino_t inode = 0;
+    off_t offset = 0;
+    // Bytes read, starting with the incomplete line left from the previous call
+    std::string text;
+    // Length of the lines already returned from `text`
+    std::size_t returned = 0;
+
+    bool openFile(bool fromTail);
+    void closeFile();
+    std::size_t fill(std::size_t maxBytes);
+    std::size_t drain(std::size_t maxBytes = SIZE_MAX);
+    void splitLines(std::vector<std::string_view>& lines);
+};
+
+#endif
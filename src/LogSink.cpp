@@ -0,0 +1,233 @@
+#include "LogSink.h"
+#include "Metrics.h"
+#include "utils.h"
+#include <boost/log/expressions/keyword.hpp>
+#include <boost/log/trivial.hpp>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+namespace {
+    // Records wait in the queue at most this long, unless it fills up or an error comes
+    const auto FLUSH_INTERVAL = std::chrono::milliseconds(100);
+    // Bytes written with one call at most
+    const std::size_t BATCH_LIMIT = 256 * 1024;
+
+    void writeAll(int fd, const char* data, std::size_t size) {
+        while (size > 0) {
+            ssize_t n = ::write(fd, data, size);
+            if (n < 0 && errno == EINTR) continue;
+            // Lost: there is nowhere else to report it
+            if (n <= 0) return;
+            data += n;
+            size -= static_cast<std::size_t>(n);
+        }
+    }
+}
+
+LogSink::LogSink(const Options& options)
+    : options(options), slots(new Slot[QUEUE_SIZE]) {
+    for (std::size_t i = 0; i < QUEUE_SIZE; ++i) {
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    if (options.path.empty()) {
+        fd = STDERR_FILENO;
+    }
+    else {
+        utils::ensurePathExists(options.path);
+        open();
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open log file " + options.path + ": " + std::strerror(errno));
+        }
+    }
+    syncedAt = std::chrono::steady_clock::now();
+    writer = std::thread([this] { run(); });
+}
+
+LogSink::~LogSink() {
+    stop();
+    if (fd >= 0 && !options.path.empty()) {
+        ::close(fd);
+    }
+}
+
+void LogSink::consume(const boost::log::record_view& record, const string_type& message) {
+    while (stopping.load(std::memory_order_relaxed) || !push(message)) {
+        if (!options.blockOnOverflow || stopping.load(std::memory_order_relaxed)) {
+            droppedCount.fetch_add(1, std::memory_order_relaxed);
+            metrics::counters().logRecordsDropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        wake();
+        std::this_thread::yield();
+    }
+    auto severity = record[boost::log::trivial::severity];
+    bool urgent = severity && *severity >= boost::log::trivial::error;
+    if (urgent || head.load(std::memory_order_relaxed) - tail.load(std::memory_order_relaxed) >= QUEUE_SIZE / 2) {
+        wake();
+    }
+}
+
+bool LogSink::push(const string_type& message) {
+    std::uint64_t pos = head.load(std::memory_order_relaxed);
+    for (;;) {
+        Slot& slot = slots[pos & (QUEUE_SIZE - 1)];
+        std::uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence == pos) {
+            if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                // The slot keeps its capacity, so a steady stream does not allocate
+                slot.message.assign(message);
+                slot.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (sequence < pos) {
+            // Full: the writer has not taken the record of the previous round yet
+            return false;
+        }
+        else {
+            pos = head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool LogSink::pop(std::string& batch) {
+    std::uint64_t pos = tail.load(std::memory_order_relaxed);
+    Slot& slot = slots[pos & (QUEUE_SIZE - 1)];
+    if (slot.sequence.load(std::memory_order_acquire) != pos + 1) {
+        return false;
+    }
+    batch.append(slot.message);
+    batch.push_back('\n');
+    slot.sequence.store(pos + QUEUE_SIZE, std::memory_order_release);
+    tail.store(pos + 1, std::memory_order_relaxed);
+    return true;
+}
+
+void LogSink::wake() {
+    if (!wakePending.exchange(true, std::memory_order_acq_rel)) {
+        std::lock_guard<std::mutex> lock(mutex);
+        wakeCv.notify_one();
+    }
+}
+
+void LogSink::flush() {
+    std::uint64_t target = head.load(std::memory_order_acquire);
+    wake();
+    std::unique_lock<std::mutex> lock(mutex);
+    flushedCv.wait(lock, [&] { return flushed >= target || finished; });
+}
+
+void LogSink::stop() {
+    if (stopping.exchange(true)) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        wakeCv.notify_one();
+    }
+    if (writer.joinable()) {
+        writer.join();
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    finished = true;
+    flushedCv.notify_all();
+}
+
+void LogSink::run() {
+    std::string batch;
+    for (;;) {
+        // Records queued before the stop are still written
+        bool last = stopping.load(std::memory_order_acquire);
+        wakePending.store(false, std::memory_order_release);
+        while (pop(batch)) {
+            if (batch.size() >= BATCH_LIMIT) {
+                write(batch);
+            }
+        }
+        std::uint64_t drops = droppedCount.load(std::memory_order_relaxed);
+        if (drops != reportedDrops) {
+            batch += std::to_string(drops - reportedDrops) + " log records dropped, the queue was full\n";
+            reportedDrops = drops;
+        }
+        if (!batch.empty()) {
+            write(batch);
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (!options.path.empty() && options.rotateInterval.count() > 0 && fileSize > 0
+            && now - openedAt >= options.rotateInterval) {
+            rotate();
+        }
+        if (unsynced && (last || (options.fsyncInterval.count() > 0 && now - syncedAt >= options.fsyncInterval))) {
+            sync();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            flushed = tail.load(std::memory_order_relaxed);
+        }
+        flushedCv.notify_all();
+        if (last) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        wakeCv.wait_for(lock, FLUSH_INTERVAL, [&] {
+            return wakePending.load(std::memory_order_acquire) || stopping.load(std::memory_order_acquire);
+        });
+    }
+}
+
+void LogSink::write(std::string& batch) {
+    if (!options.path.empty()) {
+        if (options.maxSize > 0 && fileSize > 0 && fileSize + batch.size() > options.maxSize) {
+            rotate();
+        }
+        else if (fd < 0) {
+            // Could not be opened at the last rotation
+            open();
+        }
+    }
+    // Rather on the console than nowhere
+    writeAll(fd >= 0 ? fd : STDERR_FILENO, batch.data(), batch.size());
+    fileSize += batch.size();
+    unsynced = !options.path.empty();
+    batch.clear();
+}
+
+void LogSink::open() {
+    fd = ::open(options.path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    struct stat st {};
+    fileSize = fd >= 0 && ::fstat(fd, &st) == 0 ? static_cast<std::uint64_t>(st.st_size) : 0;
+    openedAt = std::chrono::steady_clock::now();
+}
+
+void LogSink::rotate() {
+    if (fd >= 0) {
+        sync();
+        ::close(fd);
+    }
+    const std::string& path = options.path;
+    if (options.keepFiles == 0) {
+        ::unlink(path.c_str());
+    }
+    else {
+        ::unlink((path + "." + std::to_string(options.keepFiles)).c_str());
+        for (unsigned int i = options.keepFiles - 1; i > 0; --i) {
+            ::rename((path + "." + std::to_string(i)).c_str(), (path + "." + std::to_string(i + 1)).c_str());
+        }
+        ::rename(path.c_str(), (path + ".1").c_str());
+    }
+    open();
+}
+
+void LogSink::sync() {
+    if (fd >= 0 && !options.path.empty()) {
+        ::fdatasync(fd);
+    }
+    unsynced = false;
+    syncedAt = std::chrono::steady_clock::now();
+}
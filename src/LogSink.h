@@ -0,0 +1,96 @@
+#ifndef LOGSINK_H
+#define LOGSINK_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <boost/log/sinks/basic_sink_backend.hpp>
+#include <boost/log/core/record_view.hpp>
+
+
+// Boost.Log backend writing from a thread of its own. A record is formatted
+// by the logging thread and copied into a bounded lock-free queue, the
+// writer takes all queued records at once and writes them with one call,
+// so logging costs no system call on the main loop. A file is rotated by
+// size and age: `log` becomes `log.1`, `log.1` becomes `log.2` and so on.
+class LogSink : public boost::log::sinks::basic_formatted_sink_backend<char,
+    boost::log::sinks::combine_requirements<boost::log::sinks::concurrent_feeding, boost::log::sinks::flushing>::type> {
+public:
+    // Records, a power of 2
+    static const std::size_t QUEUE_SIZE = 8192;
+
+    struct Options {
+        // Empty for the console (stderr)
+        std::string path;
+        // Bytes of a file before it is rotated, 0 - no limit
+        std::uint64_t maxSize = 0;
+        // Age of a file before it is rotated, 0 - no limit
+        std::chrono::seconds rotateInterval{ 0 };
+        // Rotated files to keep
+        unsigned int keepFiles = 5;
+        // Written data is synced to the disk this often, 0 - left to the OS
+        std::chrono::seconds fsyncInterval{ 0 };
+        // Wait for room in a full queue instead of dropping the record
+        bool blockOnOverflow = false;
+    };
+
+    // Throws std::runtime_error if the file cannot be opened
+    explicit LogSink(const Options& options);
+    ~LogSink();
+    LogSink(const LogSink&) = delete;
+    LogSink& operator=(const LogSink&) = delete;
+
+    void consume(const boost::log::record_view& record, const string_type& message);
+    // Waits until the records queued so far are written
+    void flush();
+    // Writes out the queue and ends the writer, records consumed later are dropped
+    void stop();
+    std::uint64_t dropped() const { return droppedCount.load(std::memory_order_relaxed); }
+
+private:
+    struct Slot {
+        // Position the slot is free for, or written at plus one
+        std::atomic<std::uint64_t> sequence{ 0 };
+        std::string message;
+    };
+
+    Options options;
+    std::unique_ptr<Slot[]> slots;
+    alignas(64) std::atomic<std::uint64_t> head{ 0 };
+    alignas(64) std::atomic<std::uint64_t> tail{ 0 };
+    std::atomic<std::uint64_t> droppedCount{ 0 };
+    std::atomic<bool> stopping{ false };
+    // Set while a wakeup of the writer is pending, so producers notify once
+    std::atomic<bool> wakePending{ false };
+    std::mutex mutex;
+    std::condition_variable wakeCv;
+    std::condition_variable flushedCv;
+    // Guarded by the mutex: records written so far, the writer has ended
+    std::uint64_t flushed = 0;
+    bool finished = false;
+    std::thread writer;
+
+    // Used by the writer thread only
+    int fd = -1;
+    std::uint64_t fileSize = 0;
+    std::chrono::steady_clock::time_point openedAt;
+    std::chrono::steady_clock::time_point syncedAt;
+    bool unsynced = false;
+    std::uint64_t reportedDrops = 0;
+
+    bool push(const string_type& message);
+    bool pop(std::string& batch);
+    void wake();
+    void run();
+    void write(std::string& batch);
+    void open();
+    void rotate();
+    void sync();
+};
+
+#endif
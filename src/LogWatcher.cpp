@@ -0,0 +1,150 @@
+#include "LogWatcher.h"
+#include <boost/log/trivial.hpp>
+#include <boost/filesystem.hpp>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <chrono>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+
+namespace fs = boost::filesystem;
+
+LogWatcher::LogWatcher(const std::vector<std::string>& filePaths, unsigned int debounceMs) : debounceMs(debounceMs) {
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    try {
+        if (inotifyFd < 0 || wakeFd < 0 || epollFd < 0) {
+            throw std::runtime_error("Cannot initialize log watcher: " + std::string(std::strerror(errno)));
+        }
+        uint32_t mask = IN_MODIFY | IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_MOVE_SELF;
+        for (const auto& filePath : filePaths) {
+            fs::path path(filePath);
+            std::string dir = path.has_parent_path() ? path.parent_path().string() : ".";
+            // The same directory gets the same descriptor
+            int wd = inotify_add_watch(inotifyFd, dir.c_str(), mask);
+            if (wd < 0) {
+                throw std::runtime_error("Cannot watch directory " + dir + ": " + std::string(std::strerror(errno)));
+            }
+            fileNames[wd].push_back(path.filename().string());
+        }
+
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = inotifyFd;
+        bool added = epoll_ctl(epollFd, EPOLL_CTL_ADD, inotifyFd, &ev) == 0;
+        ev.data.fd = wakeFd;
+        if (!added || epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev) != 0) {
+            throw std::runtime_error("Cannot initialize log watcher: " + std::string(std::strerror(errno)));
+        }
+    }
+    catch (...) {
+        // The destructor does not run for a failed constructor
+        close();
+        throw;
+    }
+}
+
+LogWatcher::~LogWatcher() {
+    close();
+}
+
+void LogWatcher::close() {
+    for (int* fd : { &epollFd, &wakeFd, &inotifyFd }) {
+        if (*fd >= 0) {
+            ::close(*fd);
+            *fd = -1;
+        }
+    }
+}
+
+bool LogWatcher::wait(int timeoutMs) {
+    epoll_event events[2];
+    int n = epoll_wait(epollFd, events, 2, timeoutMs);
+    if (n <= 0) {
+        return false;
+    }
+    bool changed = false;
+    for (int i = 0; i < n; ++i) {
+        if (events[i].data.fd == wakeFd) {
+            readWakeup();
+            return false;
+        }
+        changed = readEvents() || changed;
+    }
+    if (!changed) {
+        return false;
+    }
+    // Coalesce a burst of writes into a single wakeup: events are taken
+    // until the window since the first one is over
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(debounceMs);
+    for (;;) {
+        auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (left.count() <= 0) {
+            break;
+        }
+        n = epoll_wait(epollFd, events, 2, static_cast<int>(left.count()));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        bool woken = false;
+        for (int i = 0; i < n; ++i) {
+            if (events[i].data.fd == wakeFd) {
+                woken = readWakeup();
+            }
+            else {
+                readEvents();
+            }
+        }
+        if (n < 0 || woken) {
+            break;
+        }
+    }
+    return true;
+}
+
+bool LogWatcher::readWakeup() {
+    uint64_t value;
+    bool woken = false;
+    while (::read(wakeFd, &value, sizeof(value)) > 0) {
+        woken = true;
+    }
+    return woken;
+}
+
+void LogWatcher::wakeup() {
+    uint64_t one = 1;
+    [[maybe_unused]] ssize_t rc = ::write(wakeFd, &one, sizeof(one));
+}
+
+bool LogWatcher::readEvents() {
+    alignas(inotify_event) char buf[4096];
+    bool relevant = false;
+    for (;;) {
+        ssize_t len = ::read(inotifyFd, buf, sizeof(buf));
+        if (len <= 0) {
+            break;
+        }
+        for (char* ptr = buf; ptr < buf + len; ) {
+            auto* event = reinterpret_cast<inotify_event*>(ptr);
+            if (event->mask & (IN_MOVE_SELF | IN_Q_OVERFLOW)) {
+                relevant = true;
+            }
+            else if (event->len > 0) {
+                auto it = fileNames.find(event->wd);
+                if (it != fileNames.end()) {
+                    for (const auto& name : it->second) {
+                        relevant = relevant || name == event->name;
+                    }
+                }
+            }
+            ptr += sizeof(inotify_event) + event->len;
+        }
+    }
+    return relevant;
+}
@@ -0,0 +1,40 @@
+#ifndef LOGWATCHER_H
+#define LOGWATCHER_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+// Event driven waiting for access log changes (inotify + epoll).
+// Watches the log directories, so rotation (rename, create) is seen too.
+// Any number of logs share one inotify descriptor and one wait.
+class LogWatcher {
+public:
+    LogWatcher(const std::vector<std::string>& filePaths, unsigned int debounceMs);
+    ~LogWatcher();
+    LogWatcher(const LogWatcher&) = delete;
+    LogWatcher& operator=(const LogWatcher&) = delete;
+
+    // Blocks until the log changes, timeout expires or wakeup() is called.
+    // After a change, further ones are taken for debounceMs, so a burst of
+    // writes is one return. Returns true if any of the logs has changed.
+    bool wait(int timeoutMs);
+    // Interrupts wait(), safe to call from a signal handler
+    void wakeup();
+
+private:
+    // Watch descriptor of a directory -> names of the logs in it
+    std::unordered_map<int, std::vector<std::string>> fileNames;
+    unsigned int debounceMs;
+    int inotifyFd = -1;
+    int wakeFd = -1;
+    int epollFd = -1;
+
+    bool readEvents();
+    // Drains the eventfd, false if wakeup() has not been called
+    bool readWakeup();
+    void close();
+};
+
+#endif
@@ -0,0 +1,130 @@
+#include "Metrics.h"
+#include <sstream>
+
+
+static metrics::Counters g_counters;
+// Readers hold their own reference, the main loop swaps in a new snapshot
+static std::atomic<std::shared_ptr<const metrics::Snapshot>> g_snapshot{ std::make_shared<metrics::Snapshot>() };
+
+metrics::Counters& metrics::counters() {
+    return g_counters;
+}
+
+void metrics::publish(std::shared_ptr<const Snapshot> snapshot) {
+    g_snapshot.store(std::move(snapshot), std::memory_order_release);
+}
+
+std::shared_ptr<const metrics::Snapshot> metrics::current() {
+    return g_snapshot.load(std::memory_order_acquire);
+}
+
+static std::string escapeLabel(const std::string& value) {
+    std::string result;
+    result.reserve(value.size());
+    for (char c : value) {
+        switch (c) {
+        case '\\': result += "\\\\"; break;
+        case '"': result += "\\\""; break;
+        case '\n': result += "\\n"; break;
+        default: result += c;
+        }
+    }
+    return result;
+}
+
+// {instance="eu",email="..."}, the instance only if there are several
+static std::string labels(const std::string& instance, const char* name, const std::string& value) {
+    std::string result = "{";
+    if (!instance.empty()) {
+        result += "instance=\"" + escapeLabel(instance) + "\",";
+    }
+    result += name;
+    result += "=\"" + escapeLabel(value) + "\"}";
+    return result;
+}
+
+static std::string windowLabels(const std::string& instance, const std::string& email, const char* window) {
+    std::string result = labels(instance, "email", email);
+    result.insert(result.size() - 1, ",window=\"" + std::string(window) + "\"");
+    return result;
+}
+
+static void counter(std::ostream& out, const char* name, const char* help, std::uint64_t value) {
+    out << "# TYPE " << name << " counter\n"
+        << "# HELP " << name << " " << help << "\n"
+        << name << "_total " << value << "\n";
+}
+
+std::string metrics::render() {
+    std::shared_ptr<const Snapshot> snapshot = current();
+    const auto& c = g_counters;
+    std::ostringstream out;
+
+    counter(out, "xray_monitor_bytes_read", "Access log bytes read", c.bytesRead.load(std::memory_order_relaxed));
+    counter(out, "xray_monitor_lines_read", "Access log lines read", c.linesRead.load(std::memory_order_relaxed));
+    counter(out, "xray_monitor_lines_parsed", "Access log lines of a known format", c.linesParsed.load(std::memory_order_relaxed));
+    counter(out, "xray_monitor_lines_rejected", "Access log lines the parser rejected", c.linesRejected.load(std::memory_order_relaxed));
+    counter(out, "xray_monitor_connections", "Users connections detected", c.connections.load(std::memory_order_relaxed));
+    counter(out, "xray_monitor_disconnections", "Users disconnections detected", c.disconnections.load(std::memory_order_relaxed));
+    counter(out, "xray_monitor_notifications_sent", "Telegram messages delivered", c.notificationsSent.load(std::memory_order_relaxed));
+    counter(out, "xray_monitor_notifications_failed", "Telegram messages dropped", c.notificationsFailed.load(std::memory_order_relaxed));
+    counter(out, "xray_monitor_log_records_dropped", "Log records dropped with a full queue", c.logRecordsDropped.load(std::memory_order_relaxed));
+
+    std::size_t online = 0;
+    for (const auto& user : snapshot->users) {
+        online += user.online;
+    }
+    out << "# TYPE xray_monitor_users_online gauge\n"
+        << "# HELP xray_monitor_users_online Users online now\n"
+        << "xray_monitor_users_online " << online << "\n";
+
+    out << "# TYPE xray_monitor_user_online gauge\n"
+        << "# HELP xray_monitor_user_online Whether the user is online\n";
+    for (const auto& user : snapshot->users) {
+        out << "xray_monitor_user_online" << labels(user.instance, "email", user.email) << " " << user.online << "\n";
+    }
+    out << "# TYPE xray_monitor_user_connections counter\n"
+        << "# HELP xray_monitor_user_connections Connections of the user\n";
+    for (const auto& user : snapshot->users) {
+        out << "xray_monitor_user_connections_total" << labels(user.instance, "email", user.email) << " " << user.connections << "\n";
+    }
+    out << "# TYPE xray_monitor_user_ips gauge\n"
+        << "# HELP xray_monitor_user_ips Source addresses of the user seen within the IP timeout\n";
+    for (const auto& user : snapshot->users) {
+        out << "xray_monitor_user_ips" << labels(user.instance, "email", user.email) << " " << user.ips << "\n";
+    }
+    out << "# TYPE xray_monitor_user_uplink_bytes_per_second gauge\n"
+        << "# HELP xray_monitor_user_uplink_bytes_per_second Upload rate from the stats API\n";
+    for (const auto& user : snapshot->users) {
+        out << "xray_monitor_user_uplink_bytes_per_second" << labels(user.instance, "email", user.email) << " " << user.uplinkRate << "\n";
+    }
+    out << "# TYPE xray_monitor_user_downlink_bytes_per_second gauge\n"
+        << "# HELP xray_monitor_user_downlink_bytes_per_second Download rate from the stats API\n";
+    for (const auto& user : snapshot->users) {
+        out << "xray_monitor_user_downlink_bytes_per_second" << labels(user.instance, "email", user.email) << " " << user.downlinkRate << "\n";
+    }
+    out << "# TYPE xray_monitor_user_connection_rate gauge\n"
+        << "# HELP xray_monitor_user_connection_rate Accepted connections of the user within the window\n";
+    for (const auto& user : snapshot->users) {
+        out << "xray_monitor_user_connection_rate" << windowLabels(user.instance, user.email, "1m") << " " << user.connections1m << "\n"
+            << "xray_monitor_user_connection_rate" << windowLabels(user.instance, user.email, "5m") << " " << user.connections5m << "\n"
+            << "xray_monitor_user_connection_rate" << windowLabels(user.instance, user.email, "1h") << " " << user.connections1h << "\n";
+    }
+    out << "# TYPE xray_monitor_suspicious_lines counter\n"
+        << "# HELP xray_monitor_suspicious_lines Access log lines with an email missing from the xray config\n";
+    for (const auto& suspicious : snapshot->suspicious) {
+        out << "xray_monitor_suspicious_lines_total" << labels(suspicious.instance, "email", suspicious.name) << " " << suspicious.lines << "\n";
+    }
+    out << "# TYPE xray_monitor_inbound_lines counter\n"
+        << "# HELP xray_monitor_inbound_lines Access log lines of user connections per inbound\n";
+    for (const auto& inbound : snapshot->inbounds) {
+        out << "xray_monitor_inbound_lines_total" << labels(inbound.instance, "inbound", inbound.name) << " " << inbound.lines << "\n";
+    }
+    out << "# TYPE xray_monitor_probe_attempts gauge\n"
+        << "# HELP xray_monitor_probe_attempts Recent rejected and unknown email connections of the heaviest source addresses and networks\n";
+    for (const auto& probe : snapshot->probes) {
+        out << "xray_monitor_probe_attempts" << labels(probe.instance, "source", probe.name) << " " << probe.lines << "\n";
+    }
+    out << "# EOF\n";
+    return out.str();
+}
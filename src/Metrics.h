@@ -0,0 +1,88 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "IpSet.h"
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+// Monitor metrics in OpenMetrics text format. Counters are plain atomics
+// bumped from the hot path; per-user state is published by the main loop
+// as an immutable snapshot, so a scrape or a bot command only reads it.
+namespace metrics {
+    struct Counters {
+        std::atomic<std::uint64_t> bytesRead{ 0 };
+        std::atomic<std::uint64_t> linesRead{ 0 };
+        std::atomic<std::uint64_t> linesParsed{ 0 };
+        std::atomic<std::uint64_t> linesRejected{ 0 };
+        std::atomic<std::uint64_t> connections{ 0 };
+        std::atomic<std::uint64_t> disconnections{ 0 };
+        std::atomic<std::uint64_t> notificationsSent{ 0 };
+        std::atomic<std::uint64_t> notificationsFailed{ 0 };
+        std::atomic<std::uint64_t> logRecordsDropped{ 0 };
+    };
+
+    struct Destination {
+        std::string name;
+        std::uint64_t lines = 0;
+    };
+
+    struct UserState {
+        // Name of the xray instance, empty if there is only one
+        std::string instance;
+        std::string email;
+        std::string id;
+        std::string ip;
+        std::time_t lastTime = 0;
+        bool online = false;
+        std::uint64_t connections = 0;
+        std::size_t ips = 0;
+        double uplinkRate = 0;
+        double downlinkRate = 0;
+        // Accepted connections within the last minute, 5 minutes and hour
+        std::uint32_t connections1m = 0;
+        std::uint32_t connections5m = 0;
+        std::uint32_t connections1h = 0;
+        // Country and ASN of the last session, empty without GeoIP
+        std::string location;
+        // Seen within the IP timeout
+        std::vector<IpAddress> addresses;
+        // Heaviest hosts and ports, most lines first
+        std::vector<Destination> hosts;
+        std::vector<Destination> ports;
+    };
+
+    struct LineCount {
+        std::string instance;
+        std::string name;
+        std::uint64_t lines = 0;
+    };
+
+    struct Snapshot {
+        std::time_t startedAt = 0;
+        std::time_t publishedAt = 0;
+        std::vector<UserState> users;
+        // Per unknown email
+        std::vector<LineCount> suspicious;
+        // User connection lines per inbound tag
+        std::vector<LineCount> inbounds;
+        // Heaviest destination hosts and ports of each instance
+        std::vector<LineCount> hosts;
+        std::vector<LineCount> ports;
+        // Recent rejected and unknown email connections of the heaviest sources
+        std::vector<LineCount> probes;
+    };
+
+    Counters& counters();
+    // Replaces the state seen by following scrapes
+    void publish(std::shared_ptr<const Snapshot> snapshot);
+    // Latest published state, never blocks the publisher
+    std::shared_ptr<const Snapshot> current();
+    std::string render();
+}
+
+#endif
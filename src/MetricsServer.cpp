@@ -0,0 +1,99 @@
+#include "MetricsServer.h"
+#include "Metrics.h"
+#include "utils.h"
+#include <memory>
+#include <stdexcept>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/version.hpp>
+#include <boost/log/trivial.hpp>
+
+
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace net = boost::asio;
+using tcp = net::ip::tcp;
+
+const auto IO_TIMEOUT = std::chrono::seconds(10);
+const char* CONTENT_TYPE = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+
+// One request per connection, scrapers reconnect anyway
+class MetricsSession : public std::enable_shared_from_this<MetricsSession> {
+public:
+    MetricsSession(tcp::socket socket) : stream(std::move(socket)) {}
+
+    void start() {
+        stream.expires_after(IO_TIMEOUT);
+        http::async_read(stream, buffer, request,
+            [self = shared_from_this()](beast::error_code ec, std::size_t) {
+                if (!ec) {
+                    self->respond();
+                }
+            });
+    }
+
+private:
+    beast::tcp_stream stream;
+    beast::flat_buffer buffer;
+    http::request<http::string_body> request;
+    http::response<http::string_body> response;
+
+    void respond() {
+        response.version(request.version());
+        response.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        response.keep_alive(false);
+        std::string target(request.target());
+        if (request.method() != http::verb::get) {
+            response.result(http::status::method_not_allowed);
+        }
+        else if (target == "/metrics" || target.rfind("/metrics?", 0) == 0) {
+            response.result(http::status::ok);
+            response.set(http::field::content_type, CONTENT_TYPE);
+            response.body() = metrics::render();
+        }
+        else {
+            response.result(http::status::not_found);
+        }
+        response.prepare_payload();
+        stream.expires_after(IO_TIMEOUT);
+        http::async_write(stream, response,
+            [self = shared_from_this()](beast::error_code ec, std::size_t) {
+                self->stream.socket().shutdown(tcp::socket::shutdown_send, ec);
+            });
+    }
+};
+
+static tcp::endpoint parseEndpoint(const std::string& listen) {
+    auto [host, port] = utils::splitHostPort(listen);
+    return tcp::endpoint(net::ip::make_address(host.empty() ? "0.0.0.0" : host), port);
+}
+
+MetricsServer::MetricsServer(const std::string& listen) : acceptor(ioContext) {
+    auto endpoint = parseEndpoint(listen);
+    acceptor.open(endpoint.protocol());
+    acceptor.set_option(net::socket_base::reuse_address(true));
+    acceptor.bind(endpoint);
+    acceptor.listen();
+    accept();
+    worker = std::thread([this] { ioContext.run(); });
+    BOOST_LOG_TRIVIAL(info) << "Serving metrics on " << endpoint << "/metrics";
+}
+
+MetricsServer::~MetricsServer() {
+    ioContext.stop();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+void MetricsServer::accept() {
+    acceptor.async_accept([this](beast::error_code ec, tcp::socket socket) {
+        if (!ec) {
+            std::make_shared<MetricsSession>(std::move(socket))->start();
+        }
+        else if (ec == net::error::operation_aborted) {
+            return;
+        }
+        accept();
+    });
+}
@@ -0,0 +1,26 @@
+#ifndef METRICSSERVER_H
+#define METRICSSERVER_H
+
+#include <string>
+#include <thread>
+#include <boost/asio.hpp>
+
+
+// Serves metrics::render() at GET /metrics from its own thread
+class MetricsServer {
+public:
+    // `listen` is host:port, an IPv6 host in brackets
+    MetricsServer(const std::string& listen);
+    ~MetricsServer();
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+private:
+    boost::asio::io_context ioContext;
+    boost::asio::ip::tcp::acceptor acceptor;
+    std::thread worker;
+
+    void accept();
+};
+
+#endif
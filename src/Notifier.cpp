@@ -0,0 +1,156 @@
+#include "Notifier.h"
+#include "utils.h"
+#include "Profiler.h"
+#include <sstream>
+#include <boost/log/trivial.hpp>
+
+
+Notifier::Notifier(TelegramBot& telegramBot, unsigned int windowSeconds)
+    : telegramBot(telegramBot), window(windowSeconds) {}
+
+void Notifier::connected(const Peer& peer) {
+    add(Change::Connected, peer);
+}
+
+void Notifier::disconnected(const Peer& peer) {
+    add(Change::Disconnected, peer);
+}
+
+void Notifier::add(Change change, const Peer& peer) {
+    if (pending.empty()) {
+        windowStart = std::chrono::steady_clock::now();
+    }
+    std::string key = utils::instanceLabel(peer.instance) + peer.email;
+    auto it = pending.find(key);
+    if (it == pending.end()) {
+        pending.emplace(std::move(key), Event{ change, peer });
+    }
+    else if (it->second.change != change) {
+        // Flapping: the state at the end of the window is the same as before it
+        BOOST_LOG_TRIVIAL(debug) << "Collapsed reconnection of " << peer.email;
+        pending.erase(it);
+    }
+    else {
+        it->second.peer = peer;
+    }
+}
+
+std::string Notifier::formatTraffic(const Peer& peer) {
+    if (peer.uplinkRate <= 0 && peer.downlinkRate <= 0) {
+        return "";
+    }
+    return " | ↑" + utils::formatBytes(peer.uplinkRate) + "/s ↓" + utils::formatBytes(peer.downlinkRate) + "/s";
+}
+
+std::string Notifier::formatLocation(const Peer& peer) {
+    std::string text = geoip::format(peer.location);
+    if (text.empty()) {
+        return "";
+    }
+    return " | " + text + (peer.locationChanged ? " ⚠️ country changed" : "");
+}
+
+int Notifier::msUntilFlush() const {
+    auto left = windowStart + window - std::chrono::steady_clock::now();
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(left).count();
+    return ms > 0 ? static_cast<int>(ms) : 0;
+}
+
+void Notifier::flush(bool force) {
+    if (pending.empty() || (!force && msUntilFlush() > 0)) {
+        return;
+    }
+    std::string text;
+    {
+        profiler::ScopedTimer timer(profiler::Stage::MessageBuild);
+        text = build();
+    }
+    pending.clear();
+    send(text);
+}
+
+std::string Notifier::build() const {
+    std::stringstream connectedMsg;
+    std::stringstream disconnectedMsg;
+    for (const auto& [email, event] : pending) {
+        const Peer& user = event.peer;
+        if (event.change == Change::Connected) {
+            connectedMsg << utils::escapeMDv2(utils::instanceLabel(user.instance) + user.email) << utils::escapeMDv2(" | ")
+                << utils::escapeMDv2(user.id) << utils::escapeMDv2(" | ")
+                << utils::escapeMDv2(user.ip) << utils::escapeMDv2(formatLocation(user) + " | ")
+                << utils::escapeMDv2(utils::formatTime(user.lastTime))
+                << utils::escapeMDv2(formatTraffic(user)) << "\n";
+        }
+        else {
+            disconnectedMsg << utils::escapeMDv2(utils::instanceLabel(user.instance) + user.email) << utils::escapeMDv2(" | ")
+                << utils::escapeMDv2(user.id) << utils::escapeMDv2(" | ")
+                << utils::escapeMDv2(user.ip)
+                << utils::escapeMDv2(formatTraffic(user)) << "\n";
+        }
+    }
+
+    std::string text;
+    if (connectedMsg.tellp() > 0) {
+        text += "🔗 *Users have connected to the xray server:*\n" + connectedMsg.str();
+    }
+    if (disconnectedMsg.tellp() > 0) {
+        if (!text.empty()) {
+            text += "\n";
+        }
+        text += "❌ *Users have disconnected from the xray server:*\n" + disconnectedMsg.str();
+    }
+    return text;
+}
+
+void Notifier::send(const std::string& text) {
+    if (text.empty() || !telegramBot.isEnabled()) {
+        return;
+    }
+    for (const auto& chunk : split(text)) {
+        telegramBot.sendMessage(chunk);
+    }
+}
+
+static std::size_t safeCut(const std::string& line, std::size_t limit) {
+    std::size_t cut = limit;
+    // Not inside of a UTF-8 sequence
+    while (cut > 0 && (static_cast<unsigned char>(line[cut]) & 0xC0) == 0x80) {
+        --cut;
+    }
+    // Not between a backslash and the character it escapes
+    std::size_t slashes = 0;
+    while (slashes < cut && line[cut - 1 - slashes] == '\\') {
+        ++slashes;
+    }
+    if (slashes % 2 == 1) {
+        --cut;
+    }
+    return cut > 0 ? cut : limit;
+}
+
+std::vector<std::string> Notifier::split(const std::string& text, std::size_t limit) {
+    std::vector<std::string> chunks;
+    std::string current;
+    std::size_t pos = 0;
+    while (pos < text.size()) {
+        std::size_t end = text.find('\n', pos);
+        end = end == std::string::npos ? text.size() : end + 1;
+        std::string line = text.substr(pos, end - pos);
+        pos = end;
+
+        if (current.size() + line.size() > limit && !current.empty()) {
+            chunks.push_back(std::move(current));
+            current.clear();
+        }
+        while (line.size() > limit) {
+            std::size_t cut = safeCut(line, limit);
+            chunks.push_back(line.substr(0, cut));
+            line.erase(0, cut);
+        }
+        current += line;
+    }
+    if (!current.empty()) {
+        chunks.push_back(std::move(current));
+    }
+    return chunks;
+}
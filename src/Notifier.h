@@ -0,0 +1,57 @@
+#ifndef NOTIFIER_H
+#define NOTIFIER_H
+
+#include "XRayClient.h"
+#include "TelegramBot.h"
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+
+// Collects connect/disconnect events over a window and sends them as
+// few Telegram messages as possible. A user who connects and disconnects
+// (or the other way round) inside one window produces no message at all.
+class Notifier {
+public:
+    // Telegram rejects longer texts
+    static const std::size_t MESSAGE_LIMIT = 4096;
+
+    Notifier(TelegramBot& telegramBot, unsigned int windowSeconds);
+
+    void connected(const Peer& peer);
+    void disconnected(const Peer& peer);
+    // Sends collected events once the window has elapsed (or right away if forced)
+    void flush(bool force = false);
+    bool hasPending() const { return !pending.empty(); }
+    // Milliseconds until the collected events are due
+    int msUntilFlush() const;
+    // Sends right away, split into several messages if needed
+    void send(const std::string& text);
+
+    // Cuts at line boundaries; a single longer line is cut so that
+    // neither a MarkdownV2 escape nor a UTF-8 sequence is split
+    static std::vector<std::string> split(const std::string& text, std::size_t limit = MESSAGE_LIMIT);
+
+private:
+    enum class Change { Connected, Disconnected };
+
+    struct Event {
+        Change change;
+        Peer peer;
+    };
+
+    TelegramBot& telegramBot;
+    std::chrono::seconds window;
+    std::chrono::steady_clock::time_point windowStart;
+    // Ordered by email for stable messages
+    // By instance and email
+    std::map<std::string, Event> pending;
+
+    void add(Change change, const Peer& peer);
+    std::string build() const;
+    static std::string formatTraffic(const Peer& peer);
+    static std::string formatLocation(const Peer& peer);
+};
+
+#endif
@@ -0,0 +1,96 @@
+#include "PeerTable.h"
+#include <algorithm>
+
+
+PeerTable::PeerTable(const std::unordered_map<std::string, User>& users, const std::string& instance)
+    : instance(instance) {
+    // Sorted, so the ids and everything listed by them are stable between runs
+    std::vector<const User*> sorted;
+    sorted.reserve(users.size());
+    for (const auto& [email, user] : users) {
+        sorted.push_back(&user);
+    }
+    std::sort(sorted.begin(), sorted.end(),
+        [](const User* a, const User* b) { return a->email < b->email; });
+
+    const std::size_t count = sorted.size();
+    emails.reserve(count);
+    ids.reserve(count);
+    index.reserve(count);
+    for (const User* user : sorted) {
+        index.emplace(user->email, static_cast<UserId>(emails.size()));
+        emails.push_back(user->email);
+        ids.push_back(user->id);
+    }
+    ip.resize(count);
+    lastTime.resize(count);
+    prevTime.resize(count);
+    lastTraffic.resize(count);
+    uplinkRate.resize(count);
+    downlinkRate.resize(count);
+    connections.resize(count);
+    ips.resize(count);
+    online.resize(count);
+    tooManyIps.resize(count);
+    rates.resize(count);
+    abnormalRate.resize(count);
+    locations.resize(count);
+    seenIn.resize(count);
+}
+
+Peer PeerTable::peer(UserId user) const {
+    Peer peer;
+    peer.instance = instance;
+    peer.id = ids[user];
+    peer.email = emails[user];
+    if (ip[user] != IpAddress{}) {
+        peer.ip = ip[user].toString();
+    }
+    peer.lastTime = lastTime[user];
+    peer.prevTime = prevTime[user];
+    peer.online = online[user];
+    peer.uplinkRate = uplinkRate[user];
+    peer.downlinkRate = downlinkRate[user];
+    peer.lastTraffic = lastTraffic[user];
+    peer.connections = connections[user];
+    peer.ips = ips[user];
+    peer.tooManyIps = tooManyIps[user];
+    peer.location = locations[user];
+    return peer;
+}
+
+void PeerTable::restore(UserId user, const Peer& peer) {
+    IpAddress address;
+    if (IpAddress::parse(peer.ip, address)) {
+        ip[user] = address;
+        ips[user].touch(address, peer.lastTime);
+    }
+    lastTime[user] = peer.lastTime;
+    prevTime[user] = peer.prevTime;
+    online[user] = peer.online;
+    locations[user] = peer.location;
+}
+
+void PeerTable::take(UserId user, PeerTable& from, UserId source) {
+    ip[user] = from.ip[source];
+    lastTime[user] = from.lastTime[source];
+    prevTime[user] = from.prevTime[source];
+    lastTraffic[user] = from.lastTraffic[source];
+    uplinkRate[user] = from.uplinkRate[source];
+    downlinkRate[user] = from.downlinkRate[source];
+    connections[user] = from.connections[source];
+    ips[user] = std::move(from.ips[source]);
+    online[user] = from.online[source];
+    tooManyIps[user] = from.tooManyIps[source];
+    rates[user] = from.rates[source];
+    abnormalRate[user] = from.abnormalRate[source];
+    locations[user] = std::move(from.locations[source]);
+}
+
+void PeerTable::nextGeneration() {
+    if (++generation == 0) {
+        // Wrapped around: stamps of old passes could match again
+        std::fill(seenIn.begin(), seenIn.end(), 0);
+        generation = 1;
+    }
+}
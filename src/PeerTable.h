@@ -0,0 +1,111 @@
+#ifndef PEERTABLE_H
+#define PEERTABLE_H
+
+#include "Config.h"
+#include "IpSet.h"
+#include "ConnectionRate.h"
+#include "GeoIp.h"
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+
+struct Peer {
+    // Name of the xray instance, empty if there is only one
+    std::string instance;
+    std::string id;
+    std::string email;
+    std::string ip;
+    std::time_t lastTime = 0;
+    std::time_t prevTime = 0;
+    bool online = false;
+    // From the stats API, bytes per second
+    double uplinkRate = 0;
+    double downlinkRate = 0;
+    std::time_t lastTraffic = 0;
+    std::uint64_t connections = 0;
+    // Addresses seen within the IP timeout
+    IpSet ips;
+    bool tooManyIps = false;
+    // Of `ip` or of the previous session, empty without GeoIP
+    geoip::Location location;
+    // Connected from another country than in the previous session
+    bool locationChanged = false;
+};
+
+// Hash for std::string keyed maps that can be searched by a string_view
+// without building a temporary string
+struct StringHash {
+    using is_transparent = void;
+    std::size_t operator()(std::string_view s) const { return std::hash<std::string_view>{}(s); }
+};
+
+// Dense index of a configured user in PeerTable
+using UserId = std::uint32_t;
+const UserId NO_USER = UINT32_MAX;
+
+// State of every configured user as parallel arrays indexed by UserId.
+// Emails and ids are interned once from the config, so processing a log
+// line works on integers and string_views and never touches the heap.
+// A Peer record is only built for the few users that changed.
+class PeerTable {
+public:
+    PeerTable() = default;
+    PeerTable(const std::unordered_map<std::string, User>& users, const std::string& instance);
+
+    // NO_USER if the email is not in the config
+    UserId find(std::string_view email) const {
+        auto it = index.find(email);
+        return it == index.end() ? NO_USER : it->second;
+    }
+    std::size_t size() const { return emails.size(); }
+    // Seen in the access log at least once
+    bool active(UserId user) const { return lastTime[user] != 0; }
+
+    Peer peer(UserId user) const;
+    void restore(UserId user, const Peer& peer);
+    // Moves the state of `source` of another table to `user`
+    void take(UserId user, PeerTable& from, UserId source);
+
+    // Starts a pass with no user seen in it
+    void nextGeneration();
+    // True only for the first mark of the user in the pass
+    bool markSeen(UserId user) {
+        if (seenIn[user] == generation) {
+            return false;
+        }
+        seenIn[user] = generation;
+        return true;
+    }
+    bool seen(UserId user) const { return seenIn[user] == generation; }
+
+    std::string instance;
+    std::vector<std::string> emails;
+    std::vector<std::string> ids;
+    std::vector<IpAddress> ip;
+    std::vector<std::time_t> lastTime;
+    std::vector<std::time_t> prevTime;
+    std::vector<std::time_t> lastTraffic;
+    std::vector<double> uplinkRate;
+    std::vector<double> downlinkRate;
+    std::vector<std::uint64_t> connections;
+    std::vector<IpSet> ips;
+    std::vector<std::uint8_t> online;
+    std::vector<std::uint8_t> tooManyIps;
+    std::vector<ConnectionRate> rates;
+    std::vector<std::uint8_t> abnormalRate;
+    // Last known, kept over sessions
+    std::vector<geoip::Location> locations;
+
+private:
+    std::unordered_map<std::string, UserId, StringHash, std::equal_to<>> index;
+    // Generation of the last pass each user was seen in
+    std::vector<std::uint32_t> seenIn;
+    std::uint32_t generation = 1;
+};
+
+#endif
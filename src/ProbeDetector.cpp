@@ -0,0 +1,156 @@
+#include "ProbeDetector.h"
+#include <algorithm>
+#include <limits>
+
+
+// Reject reasons can be long
+const std::size_t EXAMPLE_LIMIT = 100;
+
+static std::size_t slot(const IpAddress& address, std::uint8_t prefix, std::size_t row) {
+    // Rows differ by the multiplier only, enough for a sketch
+    static const std::uint64_t seeds[ProbeDetector::DEPTH] = {
+        0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL, 0x165667B19E3779F9ULL, 0xD6E8FEB86659FD93ULL
+    };
+    std::uint64_t h = (address.hi ^ (address.lo * seeds[row]) ^ prefix) * seeds[row];
+    h ^= h >> 32;
+    return static_cast<std::size_t>(h % ProbeDetector::WIDTH);
+}
+
+ProbeDetector::ProbeDetector(unsigned int threshold) : threshold(threshold) {
+    heavy.reserve(TOP);
+}
+
+void ProbeDetector::rejected(const IpAddress& address, std::string_view reason) {
+    count(address, reason);
+}
+
+void ProbeDetector::unknownEmail(const IpAddress& address, std::string_view email) {
+    count(address, email);
+}
+
+void ProbeDetector::count(const IpAddress& address, std::string_view example) {
+    add({ address, static_cast<std::uint8_t>(address.isV4() ? 32 : 128) }, example);
+    add(network(address), example);
+}
+
+ProbeDetector::Key ProbeDetector::network(const IpAddress& address) {
+    if (address.isV4()) {
+        return { { address.hi, address.lo & ~0xffULL }, 24 };
+    }
+    return { { address.hi, 0 }, 64 };
+}
+
+void ProbeDetector::add(const Key& key, std::string_view example) {
+    // Conservative update: only the smallest counters grow, which keeps
+    // the overestimate of colliding sources down
+    std::size_t slots[DEPTH];
+    std::uint32_t estimate = std::numeric_limits<std::uint32_t>::max();
+    for (std::size_t row = 0; row < DEPTH; ++row) {
+        slots[row] = slot(key.address, key.prefix, row);
+        estimate = std::min(estimate, sketch[row][slots[row]]);
+    }
+    if (estimate == std::numeric_limits<std::uint32_t>::max()) {
+        return;
+    }
+    for (std::size_t row = 0; row < DEPTH; ++row) {
+        if (sketch[row][slots[row]] == estimate) {
+            ++sketch[row][slots[row]];
+        }
+    }
+    ++estimate;
+    if (heavy.size() == TOP && estimate < floor) {
+        // Entries have at least `floor`, so the key is not one of them
+        return;
+    }
+
+    auto it = std::find_if(heavy.begin(), heavy.end(), [&](const Entry& entry) { return entry.key == key; });
+    if (it == heavy.end()) {
+        if (heavy.size() < TOP) {
+            it = heavy.insert(heavy.end(), Entry{ key, 0, 0, {} });
+        }
+        else {
+            it = std::min_element(heavy.begin(), heavy.end(),
+                [](const Entry& a, const Entry& b) { return a.attempts < b.attempts; });
+            if (it->attempts >= estimate) {
+                floor = it->attempts;
+                return;
+            }
+            *it = Entry{ key, 0, 0, {} };
+        }
+    }
+    it->attempts = estimate;
+    it->example.assign(example.substr(0, EXAMPLE_LIMIT));
+}
+
+void ProbeDetector::decay() {
+    for (auto& row : sketch) {
+        for (auto& counter : row) {
+            counter >>= 1;
+        }
+    }
+    for (auto& entry : heavy) {
+        entry.attempts >>= 1;
+    }
+    std::erase_if(heavy, [](const Entry& entry) { return entry.attempts == 0; });
+    floor = 0;
+}
+
+std::vector<ProbeDetector::Offender> ProbeDetector::check(std::time_t now) {
+    if (decayedAt == 0) {
+        decayedAt = now;
+    }
+    else if (now - decayedAt >= DECAY) {
+        decay();
+        decayedAt = now;
+    }
+
+    std::vector<Offender> offenders;
+    if (threshold == 0) {
+        return offenders;
+    }
+    // One address of a network makes up nearly all of its attempts
+    auto dominates = [](const Entry& address, const Entry& net) {
+        return address.attempts * 10ULL >= net.attempts * 9ULL;
+    };
+    for (auto& entry : heavy) {
+        if (entry.attempts <= threshold || (entry.alertedAt != 0 && now - entry.alertedAt < ALERT_INTERVAL)) {
+            continue;
+        }
+        bool isNetwork = entry.key.prefix == 24 || entry.key.prefix == 64;
+        bool reportedOtherwise = std::any_of(heavy.begin(), heavy.end(), [&](const Entry& other) {
+            if (isNetwork) {
+                // The address is reported instead
+                return other.key.prefix != entry.key.prefix && network(other.key.address) == entry.key
+                    && dominates(other, entry);
+            }
+            // Attempts come from all over the network, it is reported instead
+            return other.key == network(entry.key.address) && other.attempts > threshold
+                && !dominates(entry, other);
+        });
+        if (reportedOtherwise) {
+            continue;
+        }
+        entry.alertedAt = now;
+        offenders.push_back({ format(entry.key), entry.attempts, entry.example });
+    }
+    return offenders;
+}
+
+std::vector<ProbeDetector::Offender> ProbeDetector::top() const {
+    std::vector<Offender> offenders;
+    offenders.reserve(heavy.size());
+    for (const auto& entry : heavy) {
+        offenders.push_back({ format(entry.key), entry.attempts, entry.example });
+    }
+    std::sort(offenders.begin(), offenders.end(),
+        [](const Offender& a, const Offender& b) { return a.attempts > b.attempts; });
+    return offenders;
+}
+
+std::string ProbeDetector::format(const Key& key) {
+    std::string text = key.address.toString();
+    if (key.prefix == 24 || key.prefix == 64) {
+        text += "/" + std::to_string(key.prefix);
+    }
+    return text;
+}
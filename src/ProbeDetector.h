@@ -0,0 +1,79 @@
+#ifndef PROBEDETECTOR_H
+#define PROBEDETECTOR_H
+
+#include "IpSet.h"
+#include <array>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+// Sources of rejected connections and of unknown emails (probing,
+// credential guessing): single addresses and their /24 (IPv4) or /64
+// (IPv6) networks. Attempts go into a count-min sketch, so a scan from
+// millions of addresses takes no more memory than one from a single host,
+// and only the heaviest sources are kept by name. Counts are halved every
+// DECAY, so they follow recent activity.
+class ProbeDetector {
+public:
+    static const std::size_t WIDTH = 4096;
+    static const std::size_t DEPTH = 4;
+    static const std::size_t TOP = 32;
+    static const std::time_t DECAY = 600;
+    // A source is alerted at most once per interval
+    static const std::time_t ALERT_INTERVAL = 3600;
+
+    struct Offender {
+        // "1.2.3.4" or "1.2.3.0/24"
+        std::string source;
+        std::uint32_t attempts = 0;
+        // Last reject reason or unknown email
+        std::string example;
+    };
+
+    // Alerts for sources over `threshold` attempts, 0 - no alerts
+    explicit ProbeDetector(unsigned int threshold);
+
+    void rejected(const IpAddress& address, std::string_view reason);
+    void unknownEmail(const IpAddress& address, std::string_view email);
+    // Decays the counts when due and returns the sources newly over the threshold.
+    // A network is left out if one of its addresses makes up nearly all of it
+    std::vector<Offender> check(std::time_t now);
+    // Heaviest sources, most attempts first
+    std::vector<Offender> top() const;
+
+private:
+    struct Key {
+        IpAddress address;
+        // Bits of the address or of the network: 32, 24, 128 or 64
+        std::uint8_t prefix = 0;
+
+        bool operator==(const Key& other) const { return address == other.address && prefix == other.prefix; }
+    };
+
+    struct Entry {
+        Key key;
+        std::uint32_t attempts = 0;
+        std::time_t alertedAt = 0;
+        std::string example;
+    };
+
+    unsigned int threshold;
+    std::array<std::array<std::uint32_t, WIDTH>, DEPTH> sketch{};
+    // Unordered, at most TOP entries
+    std::vector<Entry> heavy;
+    // At most the fewest attempts in a full `heavy`, so most sources of a
+    // scan are turned away without looking at it
+    std::uint32_t floor = 0;
+    std::time_t decayedAt = 0;
+
+    void count(const IpAddress& address, std::string_view example);
+    void add(const Key& key, std::string_view example);
+    void decay();
+    static Key network(const IpAddress& address);
+    static std::string format(const Key& key);
+};
+
+#endif
@@ -0,0 +1,122 @@
+#include "Profiler.h"
+#include "Metrics.h"
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <sys/resource.h>
+#include <unistd.h>
+
+
+static const char* STAGE_NAMES[] = { "read", "split", "parse", "timestamp", "state-diff", "message-build", "send" };
+static std::array<profiler::Histogram, static_cast<std::size_t>(profiler::Stage::Count)> g_histograms;
+// State of the previous report, the first one covers the time since start
+static auto g_lastAt = std::chrono::steady_clock::now();
+static double g_lastCpu = 0;
+static std::uint64_t g_lastLines = 0;
+static std::uint64_t g_lastBytes = 0;
+
+void profiler::Histogram::record(std::uint64_t ns) {
+    int bucket = ns == 0 ? 0 : 64 - __builtin_clzll(ns);
+    if (bucket >= BUCKETS) {
+        bucket = BUCKETS - 1;
+    }
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+    sumNs.fetch_add(ns, std::memory_order_relaxed);
+    std::uint64_t prev = maxNs.load(std::memory_order_relaxed);
+    while (ns > prev && !maxNs.compare_exchange_weak(prev, ns, std::memory_order_relaxed)) {
+    }
+}
+
+std::uint64_t profiler::Histogram::quantile(double q) const {
+    std::uint64_t n = count();
+    if (n == 0) {
+        return 0;
+    }
+    std::uint64_t rank = static_cast<std::uint64_t>(q * n);
+    std::uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; ++i) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen > rank) {
+            return std::uint64_t(1) << i;
+        }
+    }
+    return max();
+}
+
+void profiler::record(Stage stage, std::chrono::steady_clock::duration duration) {
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    g_histograms[static_cast<std::size_t>(stage)].record(ns > 0 ? static_cast<std::uint64_t>(ns) : 0);
+}
+
+const profiler::Histogram& profiler::histogram(Stage stage) {
+    return g_histograms[static_cast<std::size_t>(stage)];
+}
+
+static std::string formatNs(std::uint64_t ns) {
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(1);
+    if (ns >= 1000000000) {
+        ss << ns / 1e9 << "s";
+    }
+    else if (ns >= 1000000) {
+        ss << ns / 1e6 << "ms";
+    }
+    else if (ns >= 1000) {
+        ss << ns / 1e3 << "us";
+    }
+    else {
+        ss << std::setprecision(0) << static_cast<double>(ns) << "ns";
+    }
+    return ss.str();
+}
+
+static long residentKb() {
+    std::ifstream statm("/proc/self/statm");
+    long size = 0, resident = 0;
+    if (!(statm >> size >> resident)) {
+        return 0;
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static double cpuSeconds() {
+    struct rusage usage {};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+        usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+std::string profiler::report() {
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - g_lastAt).count();
+    double cpu = cpuSeconds();
+    std::uint64_t lines = metrics::counters().linesRead.load(std::memory_order_relaxed);
+    std::uint64_t bytes = metrics::counters().bytesRead.load(std::memory_order_relaxed);
+
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(1) << "Profile:";
+    for (std::size_t i = 0; i < g_histograms.size(); ++i) {
+        const auto& h = g_histograms[i];
+        if (h.count() == 0) {
+            continue;
+        }
+        ss << " " << STAGE_NAMES[i] << "[n=" << h.count()
+            << " avg=" << formatNs(h.sum() / h.count())
+            << " p50<" << formatNs(h.quantile(0.5))
+            << " p99<" << formatNs(h.quantile(0.99))
+            << " max=" << formatNs(h.max()) << "]";
+    }
+    if (elapsed > 0) {
+        ss << " lines/s=" << (lines - g_lastLines) / elapsed
+            << " KiB/s=" << (bytes - g_lastBytes) / 1024.0 / elapsed
+            << " cpu=" << (cpu - g_lastCpu) * 100 / elapsed << "%";
+    }
+    ss << " rss=" << residentKb() << "KiB";
+
+    g_lastAt = now;
+    g_lastCpu = cpu;
+    g_lastLines = lines;
+    g_lastBytes = bytes;
+    return ss.str();
+}
@@ -0,0 +1,57 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+
+// Self-profiling of the processing stages. Every stage has a histogram
+// of power-of-two nanosecond buckets made of atomics, so recording is
+// allocation-free and safe from the Telegram sender thread as well.
+// Per-line stages (parse, timestamp) are timed on a sample of the lines.
+namespace profiler {
+    enum class Stage { Read, Split, Parse, Timestamp, StateDiff, MessageBuild, Send, Count };
+
+    class Histogram {
+    public:
+        // Bucket i holds durations below 2^i ns
+        static const int BUCKETS = 40;
+
+        void record(std::uint64_t ns);
+        std::uint64_t count() const { return total.load(std::memory_order_relaxed); }
+        std::uint64_t sum() const { return sumNs.load(std::memory_order_relaxed); }
+        std::uint64_t max() const { return maxNs.load(std::memory_order_relaxed); }
+        // Upper bound of the bucket holding the quantile
+        std::uint64_t quantile(double q) const;
+
+    private:
+        std::array<std::atomic<std::uint64_t>, BUCKETS> buckets{};
+        std::atomic<std::uint64_t> total{ 0 };
+        std::atomic<std::uint64_t> sumNs{ 0 };
+        std::atomic<std::uint64_t> maxNs{ 0 };
+    };
+
+    void record(Stage stage, std::chrono::steady_clock::duration duration);
+    const Histogram& histogram(Stage stage);
+
+    class ScopedTimer {
+    public:
+        ScopedTimer(Stage stage) : stage(stage), started(std::chrono::steady_clock::now()) {}
+        ~ScopedTimer() { record(stage, std::chrono::steady_clock::now() - started); }
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    private:
+        Stage stage;
+        std::chrono::steady_clock::time_point started;
+    };
+
+    // Per-stage latencies since start, throughput, RSS and CPU usage
+    // since the previous report. Not thread-safe, called by the main loop.
+    std::string report();
+}
+
+#endif
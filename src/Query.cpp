@@ -0,0 +1,105 @@
+#include "Query.h"
+#include "History.h"
+#include "utils.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <boost/program_options.hpp>
+
+
+namespace po = boost::program_options;
+
+namespace {
+    // "now", a duration ago ("30m", "12h", "7d", "2w"), or local "YYYY-MM-DD[ HH:MM[:SS]]"
+    std::time_t parseTime(const std::string& text, std::time_t now) {
+        if (text == "now") {
+            return now;
+        }
+        if (text.size() >= 2 && std::isdigit(static_cast<unsigned char>(text.front())) &&
+            text.find_first_not_of("0123456789") == text.size() - 1) {
+            long long amount = std::stoll(text.substr(0, text.size() - 1));
+            switch (text.back()) {
+            case 'm': return now - amount * 60;
+            case 'h': return now - amount * 60 * 60;
+            case 'd': return now - amount * 24 * 60 * 60;
+            case 'w': return now - amount * 7 * 24 * 60 * 60;
+            }
+        }
+        std::string value = text;
+        std::replace(value.begin(), value.end(), 'T', ' ');
+        for (const char* format : { "%Y-%m-%d %H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%d" }) {
+            std::tm tm {};
+            std::istringstream in(value);
+            in >> std::get_time(&tm, format);
+            if (!in.fail() && in.peek() == std::char_traits<char>::eof()) {
+                tm.tm_isdst = -1;
+                return std::mktime(&tm);
+            }
+        }
+        throw std::runtime_error("Invalid time " + text + ", expected now, 12h, 7d or YYYY-MM-DD[ HH:MM[:SS]]");
+    }
+
+    std::string formatDuration(std::time_t seconds) {
+        std::ostringstream out;
+        if (seconds >= 24 * 60 * 60) {
+            out << seconds / (24 * 60 * 60) << "d ";
+        }
+        if (seconds >= 60 * 60) {
+            out << seconds / (60 * 60) % 24 << "h ";
+        }
+        out << seconds / 60 % 60 << "m";
+        return out.str();
+    }
+}
+
+int query::run(int argc, char* argv[]) {
+    po::options_description desc("Query options");
+    desc.add_options()
+        ("help,h", "Show help message")
+        ("history-dir", po::value<std::string>(), "Session history directory of the monitor")
+        ("user,u", po::value<std::string>(), "Email of the user")
+        ("since", po::value<std::string>()->default_value("7d"), "Start: now, 12h, 7d (ago) or YYYY-MM-DD[ HH:MM[:SS]]")
+        ("until", po::value<std::string>()->default_value("now"), "End, same format");
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+    }
+    catch (const po::error& e) {
+        throw std::runtime_error("Command line parsing error: " + std::string(e.what()));
+    }
+    if (vm.count("help")) {
+        std::cout << "Usage: xray-monitor query --history-dir <dir> --user <email> [--since 7d] [--until now]\n\n"
+            << desc << std::endl;
+        return 0;
+    }
+    if (!vm.count("history-dir") || !vm.count("user")) {
+        throw std::runtime_error("Both --history-dir and --user must be specified");
+    }
+    std::time_t now = std::time(nullptr);
+    std::time_t since = parseTime(vm["since"].as<std::string>(), now);
+    std::time_t until = parseTime(vm["until"].as<std::string>(), now);
+    std::string user = vm["user"].as<std::string>();
+
+    auto started = std::chrono::steady_clock::now();
+    HistoryReader reader(vm["history-dir"].as<std::string>());
+    auto sessions = reader.query(user, since, until);
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started);
+
+    std::time_t total = 0;
+    for (const auto& session : sessions) {
+        std::cout << utils::formatTime(session.start) << " - " << utils::formatTime(session.end)
+            << "  " << std::setw(11) << formatDuration(session.end - session.start)
+            << "  " << utils::instanceLabel(session.instance) << (session.ip.empty() ? "-" : session.ip) << "\n";
+        total += session.end - session.start;
+    }
+    std::cout << sessions.size() << " sessions of " << user << " from " << utils::formatTime(since)
+        << " to " << utils::formatTime(until) << ", " << formatDuration(total) << " online"
+        << " (" << reader.segments() << " segments, " << elapsed.count() / 1000.0 << " ms)" << std::endl;
+    return 0;
+}
@@ -0,0 +1,11 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+
+// `xray-monitor query`: sessions of a user from the history directory
+namespace query {
+    // Arguments after `query`, argv[0] is the subcommand itself
+    int run(int argc, char* argv[]);
+}
+
+#endif
@@ -0,0 +1,181 @@
+#include "Snapshot.h"
+#include "utils.h"
+#include <boost/crc.hpp>
+#include <boost/log/trivial.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+namespace {
+    const char MAGIC[4] = { 'X', 'M', 'S', 'N' };
+
+    std::uint32_t checksum(const char* data, std::size_t size) {
+        boost::crc_32_type crc;
+        crc.process_bytes(data, size);
+        return crc.checksum();
+    }
+
+    class Writer {
+    public:
+        std::string data;
+
+        template <class T>
+        void put(T value) {
+            data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+        }
+
+        void putString(const std::string& value) {
+            auto size = static_cast<std::uint16_t>(std::min<std::size_t>(value.size(), UINT16_MAX));
+            put(size);
+            data.append(value, 0, size);
+        }
+    };
+
+    class Reader {
+    public:
+        Reader(const char* data, std::size_t size) : ptr(data), end(data + size) {}
+
+        template <class T>
+        bool get(T& value) {
+            if (static_cast<std::size_t>(end - ptr) < sizeof(value)) return false;
+            std::memcpy(&value, ptr, sizeof(value));
+            ptr += sizeof(value);
+            return true;
+        }
+
+        bool getString(std::string& value) {
+            std::uint16_t size = 0;
+            if (!get(size) || static_cast<std::size_t>(end - ptr) < size) return false;
+            value.assign(ptr, size);
+            ptr += size;
+            return true;
+        }
+
+    private:
+        const char* ptr;
+        const char* end;
+    };
+}
+
+void snapshot::save(const std::string& path, const State& state) {
+    Writer w;
+    w.data.append(MAGIC, sizeof(MAGIC));
+    w.put(static_cast<std::uint32_t>(VERSION));
+    w.put(static_cast<std::int64_t>(state.savedAt));
+    w.put(static_cast<std::uint64_t>(state.device));
+    w.put(static_cast<std::uint64_t>(state.inode));
+    w.put(static_cast<std::int64_t>(state.offset));
+    w.put(static_cast<std::uint32_t>(state.peers.size()));
+    for (const auto& peer : state.peers) {
+        w.putString(peer.email);
+        w.putString(peer.id);
+        w.putString(peer.ip);
+        w.put(static_cast<std::int64_t>(peer.lastTime));
+        w.put(static_cast<std::int64_t>(peer.prevTime));
+        w.put(static_cast<std::uint8_t>(peer.online));
+        w.putString(peer.location.country);
+        w.put(static_cast<std::uint32_t>(peer.location.asn));
+        w.putString(peer.location.organization);
+    }
+    w.put(checksum(w.data.data(), w.data.size()));
+
+    utils::ensurePathExists(path);
+    std::string tmpPath = path + ".tmp";
+    int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot create " + tmpPath + ": " + std::strerror(errno));
+    }
+    const char* ptr = w.data.data();
+    std::size_t left = w.data.size();
+    while (left > 0) {
+        ssize_t n = ::write(fd, ptr, left);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            int err = errno;
+            ::close(fd);
+            ::unlink(tmpPath.c_str());
+            throw std::runtime_error("Cannot write " + tmpPath + ": " + std::strerror(err));
+        }
+        ptr += n;
+        left -= static_cast<std::size_t>(n);
+    }
+    ::fsync(fd);
+    ::close(fd);
+    if (::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        int err = errno;
+        ::unlink(tmpPath.c_str());
+        throw std::runtime_error("Cannot rename " + tmpPath + ": " + std::strerror(err));
+    }
+}
+
+bool snapshot::load(const std::string& path, State& state) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st {};
+    std::string data;
+    if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+        data.resize(static_cast<std::size_t>(st.st_size));
+        if (::read(fd, data.data(), data.size()) != static_cast<ssize_t>(data.size())) {
+            data.clear();
+        }
+    }
+    ::close(fd);
+
+    const std::size_t trailer = sizeof(std::uint32_t);
+    if (data.size() < sizeof(MAGIC) + trailer || std::memcmp(data.data(), MAGIC, sizeof(MAGIC)) != 0) {
+        BOOST_LOG_TRIVIAL(warning) << "State file " << path << " is not a snapshot";
+        return false;
+    }
+    std::uint32_t storedCrc = 0;
+    std::memcpy(&storedCrc, data.data() + data.size() - trailer, trailer);
+    if (storedCrc != checksum(data.data(), data.size() - trailer)) {
+        BOOST_LOG_TRIVIAL(warning) << "State file " << path << " is corrupt (checksum mismatch)";
+        return false;
+    }
+
+    Reader r(data.data() + sizeof(MAGIC), data.size() - sizeof(MAGIC) - trailer);
+    std::uint32_t version = 0;
+    std::int64_t savedAt = 0, offset = 0;
+    std::uint64_t device = 0, inode = 0;
+    std::uint32_t count = 0;
+    if (!r.get(version) || version == 0 || version > VERSION) {
+        BOOST_LOG_TRIVIAL(warning) << "State file " << path << " has unsupported version " << version;
+        return false;
+    }
+    if (!r.get(savedAt) || !r.get(device) || !r.get(inode) || !r.get(offset) || !r.get(count)) {
+        return false;
+    }
+    state = State{};
+    state.savedAt = static_cast<std::time_t>(savedAt);
+    state.device = static_cast<dev_t>(device);
+    state.inode = static_cast<ino_t>(inode);
+    state.offset = static_cast<off_t>(offset);
+    for (std::uint32_t i = 0; i < count; ++i) {
+        Peer peer;
+        std::int64_t lastTime = 0, prevTime = 0;
+        std::uint8_t online = 0;
+        if (!r.getString(peer.email) || !r.getString(peer.id) || !r.getString(peer.ip) ||
+            !r.get(lastTime) || !r.get(prevTime) || !r.get(online)) {
+            BOOST_LOG_TRIVIAL(warning) << "State file " << path << " is truncated";
+            return false;
+        }
+        if (version >= 2 && (!r.getString(peer.location.country) || !r.get(peer.location.asn)
+            || !r.getString(peer.location.organization))) {
+            BOOST_LOG_TRIVIAL(warning) << "State file " << path << " is truncated";
+            return false;
+        }
+        peer.lastTime = static_cast<std::time_t>(lastTime);
+        peer.prevTime = static_cast<std::time_t>(prevTime);
+        peer.online = online != 0;
+        state.peers.push_back(std::move(peer));
+    }
+    return true;
+}
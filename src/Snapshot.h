@@ -0,0 +1,32 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "XRayClient.h"
+#include <ctime>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+
+// Binary snapshot of the monitor state, so a restart continues where
+// the previous process stopped. Layout (native byte order):
+// magic "XMSN", version, header, peers, CRC-32 of all preceding bytes.
+// Version 2 adds the GeoIP location to peers, version 1 files are still read.
+namespace snapshot {
+    const unsigned int VERSION = 2;
+
+    struct State {
+        std::time_t savedAt = 0;
+        dev_t device = 0;
+        ino_t inode = 0;
+        off_t offset = 0;
+        std::vector<Peer> peers;
+    };
+
+    // Atomic: written to a temporary file which is then renamed
+    void save(const std::string& path, const State& state);
+    // False if the file is missing, of another version or corrupt
+    bool load(const std::string& path, State& state);
+}
+
+#endif
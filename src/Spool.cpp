@@ -0,0 +1,205 @@
+#include "Spool.h"
+#include "utils.h"
+#include <boost/log/trivial.hpp>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+namespace {
+    const char MAGIC[4] = { 'X', 'M', 'S', 'P' };
+    const std::size_t HEADER_SIZE = sizeof(MAGIC) + sizeof(std::uint64_t);
+    // Acknowledged records tolerated in the file before it is rewritten
+    const std::size_t COMPACT_SLACK = 1000;
+
+    bool writeAll(int fd, const char* data, std::size_t size) {
+        while (size > 0) {
+            ssize_t n = ::write(fd, data, size);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            data += n;
+            size -= static_cast<std::size_t>(n);
+        }
+        return true;
+    }
+
+    std::string record(const fleet::Event& event) {
+        std::string data(sizeof(std::uint32_t), '\0');
+        fleet::encodeEvent(data, event);
+        auto size = static_cast<std::uint32_t>(data.size() - sizeof(std::uint32_t));
+        std::memcpy(data.data(), &size, sizeof(size));
+        return data;
+    }
+}
+
+Spool::Spool(const std::string& path) : path(path) {
+    if (path.empty()) {
+        return;
+    }
+    utils::ensurePathExists(path);
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open spool " + path + ": " + std::strerror(errno));
+    }
+    load();
+}
+
+Spool::~Spool() {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+void Spool::load() {
+    struct stat st {};
+    std::string data;
+    if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+        data.resize(static_cast<std::size_t>(st.st_size));
+        if (::pread(fd, data.data(), data.size(), 0) != static_cast<ssize_t>(data.size())) {
+            data.clear();
+        }
+    }
+    if (data.size() < HEADER_SIZE || std::memcmp(data.data(), MAGIC, sizeof(MAGIC)) != 0) {
+        if (!data.empty()) {
+            BOOST_LOG_TRIVIAL(warning) << "Spool " << path << " is not valid, starting a new one";
+        }
+        compact();
+        return;
+    }
+    std::memcpy(&acked, data.data() + sizeof(MAGIC), sizeof(acked));
+    nextSeq = acked + 1;
+
+    const char* ptr = data.data() + HEADER_SIZE;
+    const char* end = data.data() + data.size();
+    while (static_cast<std::size_t>(end - ptr) >= sizeof(std::uint32_t)) {
+        std::uint32_t size = 0;
+        std::memcpy(&size, ptr, sizeof(size));
+        const char* recordEnd = ptr + sizeof(size) + size;
+        if (size > static_cast<std::size_t>(end - ptr) - sizeof(size)) {
+            break;
+        }
+        const char* eventPtr = ptr + sizeof(size);
+        fleet::Event event;
+        if (!fleet::decodeEvent(eventPtr, recordEnd, event)) {
+            break;
+        }
+        ptr = recordEnd;
+        ++fileRecords;
+        nextSeq = std::max(nextSeq, event.seq + 1);
+        if (event.seq > acked) {
+            events.push_back(std::move(event));
+        }
+    }
+    if (ptr != end) {
+        // Cut by a crash in the middle of a write
+        BOOST_LOG_TRIVIAL(warning) << "Spool " << path << " has a broken tail, it is dropped";
+        compact();
+    }
+    if (!events.empty()) {
+        BOOST_LOG_TRIVIAL(info) << "Spool " << path << ": " << events.size() << " events to send";
+    }
+}
+
+std::uint64_t Spool::push(fleet::Event event) {
+    event.seq = nextSeq++;
+    if (events.size() >= LIMIT) {
+        // Collector away for too long: the oldest events are given up
+        BOOST_LOG_TRIVIAL(warning) << "Spool is full, dropping event " << events.front().seq;
+        events.pop_front();
+    }
+    append(event);
+    events.push_back(std::move(event));
+    return nextSeq - 1;
+}
+
+std::vector<fleet::Event> Spool::after(std::uint64_t seq, std::size_t limit) const {
+    std::vector<fleet::Event> result;
+    for (const auto& event : events) {
+        if (result.size() >= limit) {
+            break;
+        }
+        if (event.seq > seq) {
+            result.push_back(event);
+        }
+    }
+    return result;
+}
+
+void Spool::ack(std::uint64_t seq) {
+    seq = std::min(seq, lastSeq());
+    if (seq <= acked) {
+        return;
+    }
+    while (!events.empty() && events.front().seq <= seq) {
+        events.pop_front();
+    }
+    acked = seq;
+    if (fd < 0) {
+        return;
+    }
+    if (events.empty()) {
+        // Everything is delivered: back to the header only
+        writeHeader();
+        if (::ftruncate(fd, HEADER_SIZE) == 0) {
+            fileRecords = 0;
+        }
+    }
+    else if (fileRecords > events.size() * 2 + COMPACT_SLACK) {
+        compact();
+    }
+    else {
+        writeHeader();
+    }
+}
+
+void Spool::append(const fleet::Event& event) {
+    if (fd < 0) {
+        return;
+    }
+    std::string data = record(event);
+    if (::lseek(fd, 0, SEEK_END) < 0 || !writeAll(fd, data.data(), data.size())) {
+        BOOST_LOG_TRIVIAL(warning)
+            << "Error writing spool " << path << ": "
+            << std::strerror(errno);
+        return;
+    }
+    ++fileRecords;
+}
+
+void Spool::writeHeader() {
+    char header[HEADER_SIZE];
+    std::memcpy(header, MAGIC, sizeof(MAGIC));
+    std::memcpy(header + sizeof(MAGIC), &acked, sizeof(acked));
+    if (::pwrite(fd, header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header))) {
+        BOOST_LOG_TRIVIAL(warning)
+            << "Error writing spool " << path << ": "
+            << std::strerror(errno);
+    }
+}
+
+void Spool::compact() {
+    std::string data(MAGIC, sizeof(MAGIC));
+    data.append(reinterpret_cast<const char*>(&acked), sizeof(acked));
+    for (const auto& event : events) {
+        data += record(event);
+    }
+    // Atomic like the state file: a crash leaves either the old or the new one
+    std::string tmpPath = path + ".tmp";
+    int tmpFd = ::open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (tmpFd < 0 || !writeAll(tmpFd, data.data(), data.size()) || ::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        BOOST_LOG_TRIVIAL(warning)
+            << "Error rewriting spool " << path << ": "
+            << std::strerror(errno);
+        if (tmpFd >= 0) {
+            ::close(tmpFd);
+            ::unlink(tmpPath.c_str());
+        }
+        return;
+    }
+    ::close(fd);
+    fd = tmpFd;
+    fileRecords = events.size();
+}
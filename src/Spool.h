@@ -0,0 +1,52 @@
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include "FleetProtocol.h"
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+
+// Events of an agent not yet acknowledged by the collector. Every event is
+// appended to the spool file as well, so they survive a restart of the agent.
+// Layout: magic "XMSP", u64 last acknowledged sequence, then records of
+// u32 length + encoded event. Not thread safe.
+class Spool {
+public:
+    static const std::size_t LIMIT = 100000;
+
+    // Kept in memory only if `path` is empty
+    explicit Spool(const std::string& path);
+    ~Spool();
+    Spool(const Spool&) = delete;
+    Spool& operator=(const Spool&) = delete;
+
+    // Assigns the next sequence number, returns it
+    std::uint64_t push(fleet::Event event);
+    // At most `limit` events with a sequence number above `seq`
+    std::vector<fleet::Event> after(std::uint64_t seq, std::size_t limit) const;
+    // Drops everything up to `seq`
+    void ack(std::uint64_t seq);
+
+    std::uint64_t lastSeq() const { return nextSeq - 1; }
+    std::uint64_t ackedSeq() const { return acked; }
+    std::size_t size() const { return events.size(); }
+
+private:
+    std::string path;
+    int fd = -1;
+    std::deque<fleet::Event> events;
+    std::uint64_t acked = 0;
+    std::uint64_t nextSeq = 1;
+    // Records in the file, including acknowledged ones
+    std::size_t fileRecords = 0;
+
+    void load();
+    void append(const fleet::Event& event);
+    void writeHeader();
+    // Rewrites the file with the unacknowledged events only
+    void compact();
+};
+
+#endif
@@ -0,0 +1,37 @@
+#include "TagTable.h"
+#include <algorithm>
+
+
+const std::uint32_t SEEDS_PER_SIZE = 1000;
+
+TagTable::TagTable(const std::vector<std::string>& tags) {
+    for (const auto& tag : tags) {
+        if (std::find(tagList.begin(), tagList.end(), tag) == tagList.end()) {
+            tagList.push_back(tag);
+        }
+    }
+    if (tagList.empty()) {
+        return;
+    }
+    // At most half full, then look for a seed without collisions;
+    // a few tries are usually enough, otherwise the table grows
+    std::size_t size = 4;
+    while (size < tagList.size() * 2) {
+        size *= 2;
+    }
+    for (;; size *= 2) {
+        mask = size - 1;
+        for (seed = 0; seed < SEEDS_PER_SIZE; ++seed) {
+            slots.assign(size, -1);
+            bool collision = false;
+            for (std::size_t i = 0; i < tagList.size() && !collision; ++i) {
+                int& slot = slots[hash(tagList[i], seed) & mask];
+                collision = slot >= 0;
+                slot = static_cast<int>(i);
+            }
+            if (!collision) {
+                return;
+            }
+        }
+    }
+}
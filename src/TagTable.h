@@ -0,0 +1,46 @@
+#ifndef TAGTABLE_H
+#define TAGTABLE_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+// Read-only set of routing tags with a collision-free (perfect) hash,
+// so a lookup is one hash, one slot and one comparison however many
+// tags are configured. Safe to share between threads once built.
+class TagTable {
+public:
+    TagTable() = default;
+    explicit TagTable(const std::vector<std::string>& tags);
+
+    // Position of the tag in tags(), -1 if it is not in the table
+    int find(std::string_view tag) const {
+        if (slots.empty()) {
+            return -1;
+        }
+        int index = slots[hash(tag, seed) & mask];
+        return index >= 0 && tagList[index] == tag ? index : -1;
+    }
+    const std::vector<std::string>& tags() const { return tagList; }
+    bool empty() const { return tagList.empty(); }
+
+private:
+    std::vector<std::string> tagList;
+    std::vector<int> slots;
+    std::uint32_t seed = 0;
+    std::size_t mask = 0;
+
+    static std::uint32_t hash(std::string_view s, std::uint32_t seed) {
+        // FNV-1a, seeded through the offset basis
+        std::uint32_t h = 2166136261u ^ seed;
+        for (char c : s) {
+            h ^= static_cast<unsigned char>(c);
+            h *= 16777619u;
+        }
+        return h ^ (h >> 15);
+    }
+};
+
+#endif
@@ -1,5 +1,8 @@
 #include "TelegramBot.h"
+#include "Metrics.h"
+#include "Profiler.h"
 #include <openssl/ssl.h>
+#include <algorithm>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/beast/http.hpp>
 #include <boost/beast/version.hpp>
@@ -14,76 +17,471 @@ namespace net = boost::asio;
 namespace ssl = net::ssl;
 using tcp = net::ip::tcp;
 
+const std::size_t QUEUE_LIMIT = 100;
+// Command answers waiting for delivery
+const std::size_t REPLY_LIMIT = 10;
+const int DELIVERY_ATTEMPTS = 3;
+const auto IO_TIMEOUT = std::chrono::seconds(10);
+const auto DNS_CACHE_TTL = std::chrono::hours(1);
+// Telegram allows about 20 messages per minute into one group or channel
+const double BUCKET_CAPACITY = 3;
+const double BUCKET_RATE = 20.0 / 60;
+// Answers to one chat: a burst for a multi-part answer, then the group rate.
+// Answers over it are dropped rather than delay notifications
+const double REPLY_CAPACITY = 5;
+const double REPLY_RATE = 20.0 / 60;
+const int RETRY_AFTER_DEFAULT = 5;
+// Seconds the server holds a getUpdates request open
+const int POLL_TIMEOUT = 25;
+const auto POLL_RETRY = std::chrono::seconds(5);
 
-TelegramBot::TelegramBot(const std::string& token, const std::string& channel) : token(token), channel(channel) {}
+namespace {
+    // Whether the chat or user has its ID or @username in the list
+    bool listed(const std::vector<std::string>& list, const boost::json::value* entity) {
+        if (!entity || !entity->is_object()) {
+            return false;
+        }
+        std::string id;
+        std::string username;
+        if (const auto* value = entity->as_object().if_contains("id"); value && value->is_int64()) {
+            id = std::to_string(value->as_int64());
+        }
+        if (const auto* value = entity->as_object().if_contains("username"); value && value->is_string()) {
+            username = "@" + std::string(value->as_string());
+        }
+        return std::find_if(list.begin(), list.end(), [&](const std::string& allowed) {
+            return (!id.empty() && allowed == id) || (!username.empty() && allowed == username);
+        }) != list.end();
+    }
+}
+
+
+TelegramBot::TelegramBot(
+    const std::string& token,
+    const std::string& channel,
+    const std::string& host,
+    const std::string& port
+) : token(token), channel(channel), host(host), port(port), sslContext(ssl::context::tlsv12_client),
+    sender(*this), bucket(BUCKET_CAPACITY, BUCKET_RATE), poller(*this) {
+    // Keep sessions on the client side for resumption on reconnect
+    SSL_CTX_set_session_cache_mode(sslContext.native_handle(), SSL_SESS_CACHE_CLIENT);
+    if (isEnabled()) {
+        worker = std::thread(&TelegramBot::run, this);
+    }
+}
+
+TelegramBot::~TelegramBot() {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopping = true;
+    }
+    queueCv.notify_all();
+    // A long poll is cut short, pending messages are still delivered
+    poller.stop();
+    if (pollingWorker.joinable()) {
+        pollingWorker.join();
+    }
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
 
 bool TelegramBot::sendMessage(const std::string& message) {
     if (!isEnabled()) {
         BOOST_LOG_TRIVIAL(warning) << "Telegram bot not configured, message not sent";
         return false;
     }
+    return enqueue({ channel, message });
+}
 
-    try {
-        net::io_context ioc;
-        tcp::resolver resolver(ioc);
-        ssl::context ctx{ ssl::context::tlsv12_client }; // or tls v1.3
-        ssl::stream<tcp::socket> ssl_stream(ioc, ctx);
+bool TelegramBot::enqueue(Outgoing message, bool reply) {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        if (reply) {
+            if (replies.size() >= REPLY_LIMIT) {
+                BOOST_LOG_TRIVIAL(warning) << "Telegram reply queue is full, answer to chat " << message.chat << " dropped";
+                return false;
+            }
+            replies.push_back(std::move(message));
+        }
+        else {
+            if (queue.size() >= QUEUE_LIMIT) {
+                BOOST_LOG_TRIVIAL(error) << "Telegram queue is full, message dropped";
+                metrics::counters().notificationsFailed.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            queue.push_back(std::move(message));
+        }
+    }
+    queueCv.notify_one();
+    return true;
+}
+
+void TelegramBot::startCommands(const std::vector<std::string>& chats, CommandHandler handler) {
+    if (!isEnabled() || pollingWorker.joinable()) {
+        return;
+    }
+    commandAdmins = chats;
+    commandChats = chats;
+    commandChats.push_back(channel);
+    commandHandler = std::move(handler);
+    pollingWorker = std::thread(&TelegramBot::poll, this);
+}
+
+void TelegramBot::run() {
+    for (;;) {
+        Outgoing message;
+        bool reply = false;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            queueCv.wait(lock, [this] { return stopping || !queue.empty() || !replies.empty(); });
+            // An answer is awaited by someone, a notification is not
+            auto& source = !replies.empty() ? replies : queue;
+            if (source.empty()) {
+                break;
+            }
+            reply = &source == &replies;
+            message = std::move(source.front());
+            source.pop_front();
+        }
+        if (reply) {
+            deliverReply(message);
+        }
+        else {
+            deliver(message, bucket);
+        }
+    }
+    sender.disconnect();
+}
 
-        auto const results = resolver.resolve("api.telegram.org", "443");
-        net::connect(ssl_stream.next_layer(), results);
+bool TelegramBot::deliverReply(const Outgoing& message) {
+    if (message.chat == channel) {
+        // Counts against the limit of the channel like a notification
+        return deliver(message, bucket);
+    }
+    auto& limit = replyBuckets.try_emplace(message.chat, REPLY_CAPACITY, REPLY_RATE).first->second;
+    if (limit.wait() > std::chrono::steady_clock::duration::zero()) {
+        BOOST_LOG_TRIVIAL(warning) << "Too many answers to chat " << message.chat << ", answer dropped";
+        return false;
+    }
+    return deliver(message, limit);
+}
 
-        // Set SNI hostname
-        SSL_set_tlsext_host_name(ssl_stream.native_handle(), "api.telegram.org");
+bool TelegramBot::deliver(const Outgoing& message, TokenBucket& limit) {
+    boost::json::object jsonBody{
+        {"chat_id", message.chat},
+        {"text", message.text},
+        {"parse_mode", "MarkdownV2"}
+    };
+    std::string jsonStr = boost::json::serialize(jsonBody);
 
-        // Make SSL handshake
-        ssl_stream.handshake(ssl::stream_base::client);
+    for (int attempt = 1; attempt <= DELIVERY_ATTEMPTS; ++attempt) {
+        try {
+            // On shutdown the wait is cut short, the message is tried anyway
+            pause(limit.wait());
+            limit.take();
+            Response res;
+            {
+                // Long polls of getUpdates are not sends
+                profiler::ScopedTimer timer(profiler::Stage::Send);
+                res = sender.post("sendMessage", jsonStr, IO_TIMEOUT);
+            }
+            if (res.status == 200) {
+                BOOST_LOG_TRIVIAL(debug) << "Telegram message sent successfully";
+                metrics::counters().notificationsSent.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+            if (res.status == 429) {
+                int retryAfter = parseRetryAfter(res.body);
+                BOOST_LOG_TRIVIAL(warning)
+                    << "Telegram rate limit hit, retrying after " << retryAfter << " s";
+                limit.block(std::chrono::seconds(retryAfter));
+                // Does not count as a failed attempt
+                --attempt;
+                if (isStopping()) {
+                    break;
+                }
+                continue;
+            }
+            BOOST_LOG_TRIVIAL(error)
+                << "Failed to send Telegram message: "
+                << std::to_string(res.status)
+                << " " << res.reason << " " << res.body;
+            metrics::counters().notificationsFailed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        catch (const std::exception& e) {
+            // A keep-alive connection may be closed by the server at any time
+            BOOST_LOG_TRIVIAL(warning)
+                << "Error sending Telegram message (attempt " << attempt << "): "
+                << std::string(e.what());
+            sender.disconnect();
+            if (attempt > 1 && !pause(std::chrono::seconds(attempt))) {
+                break;
+            }
+        }
+    }
+    BOOST_LOG_TRIVIAL(error) << "Telegram message dropped after failed attempts";
+    metrics::counters().notificationsFailed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
 
+void TelegramBot::poll() {
+    std::int64_t offset = 0;
+    while (!isStopping()) {
         boost::json::object jsonBody{
-            {"chat_id", channel},
-            {"text", message},
-            {"parse_mode", "MarkdownV2"}
+            {"timeout", POLL_TIMEOUT},
+            {"allowed_updates", boost::json::array{ "message", "channel_post" }}
         };
-        std::string jsonStr = boost::json::serialize(jsonBody);
+        if (offset != 0) {
+            jsonBody["offset"] = offset;
+        }
+        try {
+            Response res = poller.post("getUpdates", boost::json::serialize(jsonBody),
+                std::chrono::seconds(POLL_TIMEOUT) + IO_TIMEOUT);
+            if (res.status == 200) {
+                offset = handleUpdates(res.body, offset);
+                continue;
+            }
+            BOOST_LOG_TRIVIAL(warning)
+                << "Failed to get Telegram updates: "
+                << std::to_string(res.status)
+                << " " << res.reason << " " << res.body;
+            pause(res.status == 429 ? std::chrono::seconds(parseRetryAfter(res.body)) : POLL_RETRY);
+        }
+        catch (const std::exception& e) {
+            if (isStopping()) {
+                break;
+            }
+            BOOST_LOG_TRIVIAL(debug)
+                << "Error getting Telegram updates: "
+                << std::string(e.what());
+            poller.disconnect();
+            pause(POLL_RETRY);
+        }
+    }
+    poller.disconnect();
+}
 
-        http::request<http::string_body> req{
-            http::verb::post,
-            "/bot" + token + "/sendMessage",
-            11
-        };
-        req.set(http::field::host, "api.telegram.org");
-        req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
-        req.set(http::field::content_type, "application/json");
-        req.set(http::field::content_length, std::to_string(jsonStr.size()));
-        req.body() = jsonStr;
+std::int64_t TelegramBot::handleUpdates(const std::string& body, std::int64_t offset) {
+    boost::json::value value = boost::json::parse(body);
+    const auto* result = value.as_object().if_contains("result");
+    if (!result || !result->is_array()) {
+        return offset;
+    }
+    for (const auto& update : result->as_array()) {
+        const auto& object = update.as_object();
+        if (const auto* id = object.if_contains("update_id"); id && id->is_int64()) {
+            offset = std::max(offset, id->as_int64() + 1);
+        }
+        const auto* message = object.if_contains("message");
+        if (!message) {
+            message = object.if_contains("channel_post");
+        }
+        if (!message || !message->is_object()) {
+            continue;
+        }
+        const auto* text = message->as_object().if_contains("text");
+        const auto* chat = message->as_object().if_contains("chat");
+        if (!text || !text->is_string() || !chat || !chat->is_object() || !text->as_string().starts_with("/")) {
+            continue;
+        }
+        std::string chatId;
+        if (const auto* id = chat->as_object().if_contains("id"); id && id->is_int64()) {
+            chatId = std::to_string(id->as_int64());
+        }
+        std::string chatType;
+        if (const auto* type = chat->as_object().if_contains("type"); type && type->is_string()) {
+            chatType = std::string(type->as_string());
+        }
+        std::string line(text->as_string());
+        if (!listed(commandChats, chat)) {
+            BOOST_LOG_TRIVIAL(warning) << "Telegram command from chat " << chatId << " ignored: not authorized";
+            continue;
+        }
+        // Any member may write to a group, only posts of a channel are its admins'
+        if ((chatType == "group" || chatType == "supergroup")
+            && !listed(commandAdmins, message->as_object().if_contains("from"))) {
+            BOOST_LOG_TRIVIAL(warning) << "Telegram command in chat " << chatId << " ignored: sender not authorized";
+            continue;
+        }
 
-        http::write(ssl_stream, req);
+        // "/user@my_bot a@b.c" -> "user", "a@b.c"
+        std::size_t space = line.find_first_of(" \n");
+        std::string command = line.substr(1, space == std::string::npos ? std::string::npos : space - 1);
+        command = command.substr(0, command.find('@'));
+        std::string argument = space == std::string::npos ? "" : line.substr(space + 1);
+        argument.erase(0, argument.find_first_not_of(" \n"));
+        argument.erase(argument.find_last_not_of(" \n") + 1);
+        BOOST_LOG_TRIVIAL(debug) << "Telegram command /" << command << " from chat " << chatId;
+        for (auto& answer : commandHandler(command, argument)) {
+            enqueue({ chatId, std::move(answer) }, true);
+        }
+    }
+    return offset;
+}
 
-        beast::flat_buffer buffer;
-        http::response<http::string_body> res;
-        http::read(ssl_stream, buffer, res);
+bool TelegramBot::isStopping() {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    return stopping;
+}
 
-        boost::system::error_code ec;
-        ssl_stream.shutdown(ec);
-        if (ec && ec != boost::asio::ssl::error::stream_truncated) {
-            throw boost::system::system_error(ec);
-        }
+bool TelegramBot::pause(std::chrono::steady_clock::duration duration) {
+    if (duration <= std::chrono::steady_clock::duration::zero()) {
+        return true;
+    }
+    std::unique_lock<std::mutex> lock(queueMutex);
+    return !queueCv.wait_for(lock, duration, [this] { return stopping; });
+}
 
-        if (res.result() == http::status::ok) {
-            BOOST_LOG_TRIVIAL(debug) << "Telegram message sent successfully";
-            return true;
+int TelegramBot::parseRetryAfter(const std::string& body) {
+    try {
+        auto value = boost::json::parse(body);
+        const auto& parameters = value.at("parameters").as_object();
+        auto it = parameters.find("retry_after");
+        if (it != parameters.end() && it->value().is_int64() && it->value().as_int64() > 0) {
+            return static_cast<int>(it->value().as_int64());
         }
-        else {
-            BOOST_LOG_TRIVIAL(error)
-                << "Failed to send Telegram message: "
-                << std::to_string(res.result_int())
-                << " " << std::string(res.reason());
-            return false;
+    }
+    catch (const std::exception&) {
+        // Not a Bot API error object
+    }
+    return RETRY_AFTER_DEFAULT;
+}
+
+TelegramBot::TokenBucket::TokenBucket(double capacity, double rate)
+    : capacity(capacity), rate(rate), tokens(capacity), updated(std::chrono::steady_clock::now()) {}
+
+void TelegramBot::TokenBucket::refill() {
+    auto now = std::chrono::steady_clock::now();
+    if (now > updated) {
+        tokens = std::min(capacity, tokens + std::chrono::duration<double>(now - updated).count() * rate);
+        updated = now;
+    }
+}
+
+std::chrono::steady_clock::duration TelegramBot::TokenBucket::wait() {
+    refill();
+    auto blocked = updated - std::chrono::steady_clock::now();
+    if (tokens >= 1) {
+        return blocked;
+    }
+    return blocked + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>((1 - tokens) / rate));
+}
+
+void TelegramBot::TokenBucket::take() {
+    refill();
+    tokens -= 1;
+}
+
+void TelegramBot::TokenBucket::block(std::chrono::seconds duration) {
+    // Refill starts only when the server allows sending again
+    tokens = 0;
+    updated = std::chrono::steady_clock::now() + duration;
+}
+
+TelegramBot::Connection::~Connection() {
+    disconnect();
+    if (session) {
+        SSL_SESSION_free(session);
+    }
+}
+
+void TelegramBot::Connection::stop() {
+    // Checked after restart(), so a stop before the next run is not lost
+    stopped = true;
+    ioContext.stop();
+}
+
+template <class Start>
+void TelegramBot::Connection::await(Start&& start) {
+    boost::system::error_code result = net::error::operation_aborted;
+    start([&result](boost::system::error_code ec, auto&&...) { result = ec; });
+    ioContext.restart();
+    if (!stopped) {
+        ioContext.run();
+    }
+    if (result) {
+        throw boost::system::system_error(result);
+    }
+}
+void TelegramBot::Connection::connect() {
+    auto now = std::chrono::steady_clock::now();
+    if (endpoints.empty() || now - resolvedAt > DNS_CACHE_TTL) {
+        tcp::resolver resolver(ioContext);
+        endpoints = resolver.resolve(bot.host, bot.port);
+        resolvedAt = now;
+    }
+
+    stream = std::make_unique<Stream>(ioContext, bot.sslContext);
+    // Set SNI hostname
+    SSL_set_tlsext_host_name(stream->native_handle(), bot.host.c_str());
+    if (session) {
+        SSL_set_session(stream->native_handle(), session);
+    }
+
+    auto& socket = beast::get_lowest_layer(*stream);
+    socket.expires_after(IO_TIMEOUT);
+    try {
+        await([&](auto handler) { socket.async_connect(endpoints, handler); });
+    }
+    catch (const std::exception&) {
+        // The address may have changed
+        endpoints = {};
+        throw;
+    }
+    socket.expires_after(IO_TIMEOUT);
+    await([&](auto handler) { stream->async_handshake(ssl::stream_base::client, handler); });
+
+    BOOST_LOG_TRIVIAL(debug)
+        << "Connected to " << bot.host << ":" << bot.port
+        << (SSL_session_reused(stream->native_handle()) ? " (TLS session resumed)" : "");
+}
+
+void TelegramBot::Connection::disconnect() {
+    if (!stream) {
+        return;
+    }
+    boost::system::error_code ec;
+    beast::get_lowest_layer(*stream).socket().close(ec);
+    stream.reset();
+}
+
+TelegramBot::Response TelegramBot::Connection::post(const std::string& method, const std::string& body, std::chrono::seconds timeout) {
+    if (!stream) {
+        connect();
+    }
+    http::request<http::string_body> req{
+        http::verb::post,
+        "/bot" + bot.token + "/" + method,
+        11
+    };
+    req.set(http::field::host, bot.host);
+    req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+    req.set(http::field::content_type, "application/json");
+    req.keep_alive(true);
+    req.body() = body;
+    req.prepare_payload();
+
+    auto& socket = beast::get_lowest_layer(*stream);
+    socket.expires_after(IO_TIMEOUT);
+    await([&](auto handler) { http::async_write(*stream, req, handler); });
+
+    beast::flat_buffer buffer;
+    http::response<http::string_body> res;
+    socket.expires_after(timeout);
+    await([&](auto handler) { http::async_read(*stream, buffer, res, handler); });
+
+    // Session tickets of TLS 1.3 come after the handshake, so take it here
+    if (SSL_SESSION* current = SSL_get1_session(stream->native_handle())) {
+        if (session) {
+            SSL_SESSION_free(session);
         }
+        session = current;
     }
-    catch (const std::exception& e) {
-        BOOST_LOG_TRIVIAL(error)
-            << "Error sending Telegram message: "
-            << std::string(e.what());
-        return false;
+    if (!res.keep_alive()) {
+        disconnect();
     }
+    return Response{ res.result_int(), std::string(res.reason()), std::move(res.body()) };
 }
@@ -2,20 +2,146 @@
 #define TELEGRAMBOT_H
 
 #include <string>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <map>
+#include <vector>
 #include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/beast/core/tcp_stream.hpp>
 
+// Messages are delivered by a background thread over one keep-alive
+// HTTPS connection, sendMessage() only puts them into a bounded queue.
+// Commands are long polled (getUpdates) by another thread on a connection
+// of its own. Their answers wait in a small queue of their own, delivered
+// before notifications and paced per chat, so they neither wait behind nor
+// push out notifications.
 class TelegramBot {
 public:
-    TelegramBot(const std::string& token, const std::string& channel);
-    ~TelegramBot() = default;
+    // Answer messages (MarkdownV2) to a command such as "online" with its argument
+    using CommandHandler = std::function<std::vector<std::string>(const std::string& command, const std::string& argument)>;
 
+    TelegramBot(
+        const std::string& token,
+        const std::string& channel,
+        const std::string& host = "api.telegram.org",
+        const std::string& port = "443"
+    );
+    ~TelegramBot();
+    TelegramBot(const TelegramBot&) = delete;
+    TelegramBot& operator=(const TelegramBot&) = delete;
+
+    // Returns false if the bot is disabled or the queue is full
     bool sendMessage(const std::string& message);
     bool isEnabled() const { return !token.empty() && !channel.empty(); }
+    // Answers commands of the channel and of `chats` (IDs or @usernames).
+    // In a group the sender must be one of `chats` too. The handler is
+    // called from the polling thread
+    void startCommands(const std::vector<std::string>& chats, CommandHandler handler);
 
 private:
+    using Stream = boost::asio::ssl::stream<boost::beast::tcp_stream>;
+
+    struct Response {
+        unsigned int status = 0;
+        std::string reason;
+        std::string body;
+    };
+
+    struct Outgoing {
+        std::string chat;
+        std::string text;
+    };
+
+    // Keep-alive HTTPS connection to the Bot API, used by one thread
+    class Connection {
+    public:
+        explicit Connection(TelegramBot& bot) : bot(bot) {}
+        ~Connection();
+
+        // Calls a Bot API method, connects first if needed
+        Response post(const std::string& method, const std::string& body, std::chrono::seconds timeout);
+        void disconnect();
+        // Interrupts post() from another thread, for good
+        void stop();
+
+    private:
+        TelegramBot& bot;
+        boost::asio::io_context ioContext;
+        std::unique_ptr<Stream> stream;
+        boost::asio::ip::tcp::resolver::results_type endpoints;
+        std::chrono::steady_clock::time_point resolvedAt;
+        SSL_SESSION* session = nullptr;
+        std::atomic<bool> stopped{ false };
+
+        void connect();
+        template <class Start>
+        void await(Start&& start);
+    };
+
+    // Paces messages to the chat below Telegram limits
+    class TokenBucket {
+    public:
+        TokenBucket(double capacity, double rate);
+        // How long to wait before a message may be sent
+        std::chrono::steady_clock::duration wait();
+        void take();
+        // Nothing is sent for the duration (retry_after of HTTP 429)
+        void block(std::chrono::seconds duration);
+
+    private:
+        double capacity;
+        double rate;
+        double tokens;
+        std::chrono::steady_clock::time_point updated;
+
+        void refill();
+    };
+
     std::string token;
     std::string channel;
-    boost::asio::io_service ioService;
+    std::string host;
+    std::string port;
+
+    std::deque<Outgoing> queue;
+    std::deque<Outgoing> replies;
+    std::mutex queueMutex;
+    std::condition_variable queueCv;
+    bool stopping = false;
+    boost::asio::ssl::context sslContext;
+    std::thread worker;
+
+    // Used by the worker thread only
+    Connection sender;
+    TokenBucket bucket;
+    // Of chats other than the channel, by chat ID
+    std::map<std::string, TokenBucket> replyBuckets;
+
+    // Used by the polling thread only
+    Connection poller;
+    std::vector<std::string> commandChats;
+    std::vector<std::string> commandAdmins;
+    CommandHandler commandHandler;
+    std::thread pollingWorker;
+
+    void run();
+    bool enqueue(Outgoing message, bool reply = false);
+    // Paced by `limit`, the bucket of the chat
+    bool deliver(const Outgoing& message, TokenBucket& limit);
+    bool deliverReply(const Outgoing& message);
+    void poll();
+    // Returns the offset of the next update
+    std::int64_t handleUpdates(const std::string& body, std::int64_t offset);
+    bool isStopping();
+    // False if interrupted by the shutdown
+    bool pause(std::chrono::steady_clock::duration duration);
+    static int parseRetryAfter(const std::string& body);
 };
 
 #endif
@@ -0,0 +1,93 @@
+#include "TimestampDecoder.h"
+
+
+namespace {
+    // Converts `count` digits, returns -1 on non digit
+    int digits(const char* p, int count) {
+        int value = 0;
+        for (int i = 0; i < count; ++i) {
+            unsigned d = static_cast<unsigned>(p[i] - '0');
+            if (d > 9) {
+                return -1;
+            }
+            value = value * 10 + static_cast<int>(d);
+        }
+        return value;
+    }
+
+    std::time_t localEpoch(int year, int month, int day, int hour) {
+        std::tm tm = {};
+        tm.tm_year = year - 1900;
+        tm.tm_mon = month - 1;
+        tm.tm_mday = day;
+        tm.tm_hour = hour;
+        tm.tm_isdst = -1;
+        return std::mktime(&tm);
+    }
+}
+
+std::int64_t TimestampDecoder::decode(std::string_view text) {
+    // YYYY/MM/DD HH:MM:SS
+    if (text.size() < 19 || text[4] != '/' || text[7] != '/' || text[10] != ' ' ||
+        text[13] != ':' || text[16] != ':') {
+        return 0;
+    }
+    const char* p = text.data();
+    int year = digits(p, 4);
+    int month = digits(p + 5, 2);
+    int day = digits(p + 8, 2);
+    int hour = digits(p + 11, 2);
+    int minute = digits(p + 14, 2);
+    int second = digits(p + 17, 2);
+    if (year < 1970 || month < 1 || month > 12 || day < 1 || day > 31 ||
+        hour < 0 || hour > 23 || minute < 0 || minute > 59 || second < 0 || second > 60) {
+        return 0;
+    }
+
+    // Fraction is scaled to microseconds, extra digits are ignored
+    std::int64_t micros = 0;
+    if (text.size() > 20 && text[19] == '.') {
+        int scale = 100000;
+        for (std::size_t i = 20; i < text.size() && text[i] >= '0' && text[i] <= '9'; ++i) {
+            micros += (text[i] - '0') * scale;
+            scale /= 10;
+        }
+    }
+
+    int dayKey = year * 10000 + month * 100 + day;
+    if (dayKey != cachedDay) {
+        loadDay(year, month, day);
+    }
+    std::int64_t seconds;
+    if (uniformDay) {
+        seconds = dayEpoch + hour * 3600 + minute * 60 + second;
+    }
+    else {
+        if (dayKey * 100 + hour != cachedHour) {
+            loadHour(year, month, day, hour);
+        }
+        seconds = hourEpoch + minute * 60 + second;
+    }
+    return seconds * 1000000 + micros;
+}
+
+void TimestampDecoder::loadDay(int year, int month, int day) {
+    std::time_t start = localEpoch(year, month, day, 0);
+    std::time_t next = localEpoch(year, month, day + 1, 0);
+    cachedDay = year * 10000 + month * 100 + day;
+    dayEpoch = start;
+    // A day of other length contains a DST transition (or does not start at 00:00)
+    uniformDay = (next - start == 24 * 3600);
+    cachedHour = -1;
+}
+
+void TimestampDecoder::loadHour(int year, int month, int day, int hour) {
+    cachedHour = (year * 10000 + month * 100 + day) * 100 + hour;
+    hourEpoch = localEpoch(year, month, day, hour);
+    // The repeated hour after DST ends: take its first occurrence
+    std::time_t earlier = static_cast<std::time_t>(hourEpoch - 3600);
+    std::tm local = {};
+    if (localtime_r(&earlier, &local) && local.tm_hour == hour && local.tm_mday == day) {
+        hourEpoch = earlier;
+    }
+}
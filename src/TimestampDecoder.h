@@ -0,0 +1,31 @@
+#ifndef TIMESTAMPDECODER_H
+#define TIMESTAMPDECODER_H
+
+#include <cstdint>
+#include <ctime>
+#include <string_view>
+
+
+// Decoder of xray local timestamps "YYYY/MM/DD HH:MM:SS.ffffff".
+// The epoch of the local day (so its UTC offset) is computed once and reused,
+// so a line costs only digit conversion and a few additions.
+// Days with a DST transition are resolved hour by hour.
+class TimestampDecoder {
+public:
+    // Microseconds since epoch, 0 if the text is malformed
+    std::int64_t decode(std::string_view text);
+
+    static std::time_t toTime(std::int64_t micros) { return static_cast<std::time_t>(micros / 1000000); }
+
+private:
+    int cachedDay = -1;
+    std::int64_t dayEpoch = 0;
+    bool uniformDay = false;
+    int cachedHour = -1;
+    std::int64_t hourEpoch = 0;
+
+    void loadDay(int year, int month, int day);
+    void loadHour(int year, int month, int day, int hour);
+};
+
+#endif
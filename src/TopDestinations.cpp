@@ -0,0 +1,214 @@
+#include "TopDestinations.h"
+#include <algorithm>
+#include <charconv>
+
+
+// Names kept besides the ones counters refer to before compact() drops them
+const std::size_t SPARE_NAMES = 4096;
+// Index slots of an empty table
+const std::size_t INITIAL_SLOTS = 1024;
+
+template <class Key, class Number, std::size_t N>
+bool TopDestinations::SpaceSaving<Key, Number, N>::add(Key key) {
+    for (std::uint32_t i = 0; i < size; ++i) {
+        if (keys[i] == key) {
+            ++counts[i];
+            // Heavy keys move to the front, so their scans end early
+            if (i > 0 && counts[i] > counts[i - 1]) {
+                std::swap(keys[i], keys[i - 1]);
+                std::swap(counts[i], counts[i - 1]);
+                std::swap(errors[i], errors[i - 1]);
+            }
+            return false;
+        }
+    }
+    if (size < N) {
+        keys[size] = key;
+        counts[size] = 1;
+        errors[size] = 0;
+        ++size;
+        return true;
+    }
+    std::size_t smallest = std::min_element(counts.begin(), counts.end()) - counts.begin();
+    keys[smallest] = key;
+    errors[smallest] = counts[smallest];
+    ++counts[smallest];
+    return true;
+}
+
+TopDestinations::TopDestinations(std::size_t users) : users(users), hostSlots(INITIAL_SLOTS) {}
+
+void TopDestinations::add(UserId user, std::string_view destination) {
+    std::string_view host = destination;
+    std::uint16_t port = 0;
+    std::size_t colon = destination.rfind(':');
+    if (colon != std::string_view::npos && destination.find(']', colon) == std::string_view::npos) {
+        host = destination.substr(0, colon);
+        std::string_view digits = destination.substr(colon + 1);
+        std::from_chars(digits.data(), digits.data() + digits.size(), port);
+    }
+    if (host.size() > 1 && host.front() == '[' && host.back() == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+    if (host.empty()) {
+        return;
+    }
+    std::uint64_t hash = std::hash<std::string_view>{}(host);
+    User& state = users[user];
+    // Both must run, each may take over a counter
+    bool taken = state.hosts.add(hash);
+    taken |= allHosts.add(hash);
+    if (taken) {
+        remember(hash, host);
+    }
+    if (port != 0) {
+        state.ports.add(port);
+        allPorts.add(port);
+    }
+    ++state.lines;
+}
+
+void TopDestinations::remember(std::uint64_t hash, std::string_view host) {
+    const std::size_t mask = hostSlots.size() - 1;
+    std::size_t slot = hash & mask;
+    for (; hostSlots[slot] != 0; slot = (slot + 1) & mask) {
+        if (hostNames[hostSlots[slot] - 1].hash == hash) {
+            return;
+        }
+    }
+    hostNames.push_back({ hash, static_cast<std::uint32_t>(hostText.size()), static_cast<std::uint32_t>(host.size()) });
+    hostText.append(host);
+    hostSlots[slot] = static_cast<std::uint32_t>(hostNames.size());
+    // At most half full
+    if (hostNames.size() * 2 > hostSlots.size()) {
+        rehash(hostSlots.size() * 2);
+    }
+}
+
+std::string TopDestinations::name(std::uint64_t hash) const {
+    const std::size_t mask = hostSlots.size() - 1;
+    for (std::size_t slot = hash & mask; hostSlots[slot] != 0; slot = (slot + 1) & mask) {
+        const Name& name = hostNames[hostSlots[slot] - 1];
+        if (name.hash == hash) {
+            return hostText.substr(name.offset, name.length);
+        }
+    }
+    return "?";
+}
+
+void TopDestinations::index(std::uint32_t id) {
+    const std::size_t mask = hostSlots.size() - 1;
+    std::size_t slot = hostNames[id].hash & mask;
+    while (hostSlots[slot] != 0) {
+        slot = (slot + 1) & mask;
+    }
+    hostSlots[slot] = id + 1;
+}
+
+void TopDestinations::rehash(std::size_t size) {
+    hostSlots.assign(size, 0);
+    for (std::uint32_t id = 0; id < hostNames.size(); ++id) {
+        index(id);
+    }
+}
+
+void TopDestinations::compact() {
+    // Each compaction drops at least half of the names, so it is cheap per added one
+    const std::size_t referenced = users.size() * USER_HOSTS + HOSTS;
+    if (hostNames.size() <= referenced * 2 + SPARE_NAMES) {
+        return;
+    }
+    std::string text;
+    std::vector<Name> kept;
+    kept.reserve(referenced);
+    std::vector<std::uint32_t> slots(INITIAL_SLOTS);
+    while (slots.size() < referenced * 2) {
+        slots.resize(slots.size() * 2);
+    }
+    auto keep = [&](const auto& counters) {
+        for (std::uint32_t i = 0; i < counters.size; ++i) {
+            std::uint64_t hash = counters.keys[i];
+            const std::size_t mask = slots.size() - 1;
+            std::size_t slot = hash & mask;
+            while (slots[slot] != 0 && kept[slots[slot] - 1].hash != hash) {
+                slot = (slot + 1) & mask;
+            }
+            if (slots[slot] != 0) {
+                continue;
+            }
+            std::string host = name(hash);
+            kept.push_back({ hash, static_cast<std::uint32_t>(text.size()), static_cast<std::uint32_t>(host.size()) });
+            text += host;
+            slots[slot] = static_cast<std::uint32_t>(kept.size());
+        }
+    };
+    keep(allHosts);
+    for (const auto& user : users) {
+        keep(user.hosts);
+    }
+    hostText = std::move(text);
+    hostNames = std::move(kept);
+    hostSlots = std::move(slots);
+}
+
+void TopDestinations::clear() {
+    for (auto& user : users) {
+        user = User{};
+    }
+    allHosts = {};
+    allPorts = {};
+    hostText.clear();
+    hostNames.clear();
+    hostSlots.assign(INITIAL_SLOTS, 0);
+}
+
+void TopDestinations::remap(const std::vector<UserId>& previous) {
+    std::vector<User> table(previous.size());
+    for (std::size_t user = 0; user < previous.size(); ++user) {
+        if (previous[user] != NO_USER) {
+            table[user] = users[previous[user]];
+        }
+    }
+    users = std::move(table);
+}
+
+std::vector<UserId> TopDestinations::busiest(std::size_t count) const {
+    std::vector<UserId> result;
+    for (UserId user = 0; user < users.size(); ++user) {
+        if (users[user].lines > 0) {
+            result.push_back(user);
+        }
+    }
+    count = std::min(count, result.size());
+    std::partial_sort(result.begin(), result.begin() + count, result.end(),
+        [this](UserId a, UserId b) { return users[a].lines > users[b].lines; });
+    result.resize(count);
+    return result;
+}
+
+template <class Key, class Number, std::size_t N, class Naming>
+std::vector<TopDestinations::Count> TopDestinations::sorted(const SpaceSaving<Key, Number, N>& counters, Naming&& name) {
+    std::vector<Count> result;
+    result.reserve(counters.size);
+    for (std::uint32_t i = 0; i < counters.size; ++i) {
+        result.push_back({ name(counters.keys[i]), counters.counts[i], counters.errors[i] });
+    }
+    std::sort(result.begin(), result.end(), [](const Count& a, const Count& b) { return a.count > b.count; });
+    return result;
+}
+
+std::vector<TopDestinations::Count> TopDestinations::hosts() const {
+    return sorted(allHosts, [this](std::uint64_t hash) { return name(hash); });
+}
+
+std::vector<TopDestinations::Count> TopDestinations::ports() const {
+    return sorted(allPorts, [](std::uint16_t port) { return std::to_string(port); });
+}
+
+std::vector<TopDestinations::Count> TopDestinations::hosts(UserId user) const {
+    return sorted(users[user].hosts, [this](std::uint64_t hash) { return name(hash); });
+}
+
+std::vector<TopDestinations::Count> TopDestinations::ports(UserId user) const {
+    return sorted(users[user].ports, [](std::uint16_t port) { return std::to_string(port); });
+}
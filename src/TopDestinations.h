@@ -0,0 +1,98 @@
+#ifndef TOPDESTINATIONS_H
+#define TOPDESTINATIONS_H
+
+#include "PeerTable.h"
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+// Heaviest destinations (hosts and ports of accepted connections) of every
+// user and of the whole instance by Space-Saving: a fixed number of
+// counters each, a destination not counted yet takes over the smallest
+// counter and inherits its count as an error bound. A line costs a scan of
+// a few counters whatever the number of distinct destinations. Counters
+// hold a hash of the host; the name is interned into one buffer with an
+// open addressing index only when the host takes over a counter, so a
+// line of a counted host does no lookup. Every new host appends its name:
+// growth of the buffer is amortized and bounded by compact().
+class TopDestinations {
+public:
+    static const std::size_t USER_HOSTS = 8;
+    static const std::size_t USER_PORTS = 4;
+    static const std::size_t HOSTS = 64;
+    static const std::size_t PORTS = 32;
+
+    struct Count {
+        std::string name;
+        std::uint64_t count = 0;
+        // The count may be overestimated by this much
+        std::uint64_t error = 0;
+    };
+
+    explicit TopDestinations(std::size_t users = 0);
+
+    // "host:port", "[2001:db8::1]:443" or just "host"
+    void add(UserId user, std::string_view destination);
+    // Forgets the names no counter refers to once there are many of them
+    void compact();
+    // Starts counting over, users are kept
+    void clear();
+    // previous[user] is the id of the user in the old table or NO_USER
+    void remap(const std::vector<UserId>& previous);
+
+    // Most counted first
+    std::vector<Count> hosts() const;
+    std::vector<Count> ports() const;
+    std::vector<Count> hosts(UserId user) const;
+    std::vector<Count> ports(UserId user) const;
+    // Lines of the user since the last clear()
+    std::uint64_t lines(UserId user) const { return users[user].lines; }
+    // Users with the most lines, most first
+    std::vector<UserId> busiest(std::size_t count) const;
+    std::size_t names() const { return hostNames.size(); }
+
+private:
+    template <class Key, class Number, std::size_t N>
+    struct SpaceSaving {
+        std::array<Key, N> keys{};
+        std::array<Number, N> counts{};
+        std::array<Number, N> errors{};
+        std::uint32_t size = 0;
+
+        // True if the key took over a counter
+        bool add(Key key);
+    };
+
+    struct User {
+        SpaceSaving<std::uint64_t, std::uint32_t, USER_HOSTS> hosts;
+        SpaceSaving<std::uint16_t, std::uint32_t, USER_PORTS> ports;
+        std::uint64_t lines = 0;
+    };
+
+    std::vector<User> users;
+    SpaceSaving<std::uint64_t, std::uint64_t, HOSTS> allHosts;
+    SpaceSaving<std::uint16_t, std::uint64_t, PORTS> allPorts;
+    struct Name {
+        std::uint64_t hash;
+        std::uint32_t offset;
+        std::uint32_t length;
+    };
+
+    // Interned hosts one after another
+    std::string hostText;
+    std::vector<Name> hostNames;
+    // Index + 1 into hostNames by hash, 0 if free; a power of two in size
+    std::vector<std::uint32_t> hostSlots;
+
+    void remember(std::uint64_t hash, std::string_view host);
+    std::string name(std::uint64_t hash) const;
+    void index(std::uint32_t id);
+    void rehash(std::size_t size);
+    template <class Key, class Number, std::size_t N, class Naming>
+    static std::vector<Count> sorted(const SpaceSaving<Key, Number, N>& counters, Naming&& name);
+};
+
+#endif
@@ -1,13 +1,112 @@
 #include "XRayClient.h"
-#include "utils.h"
+#include "Backfill.h"
+#include "Snapshot.h"
+#include "Metrics.h"
+#include "Profiler.h"
 #include <boost/log/trivial.hpp>
-#include <regex>
+#include <chrono>
+#include <algorithm>
 
 
-const int LINES_COUNT = 100; // @TODO: move number line to options
 const int TIME_DIFF_LIMIT = 60 * 60 * 2; // 2 hours @TODO: to options
+// Lines timed for the profiler, 1 of that many (a power of 2): clock reads and
+// shared atomics on every line would cost more than parsing a short one
+const std::uint64_t PROFILE_SAMPLE = 64;
 
-XRayClient::XRayClient(const Config& config) : config(config) {}
+XRayClient::XRayClient(const Config& config, const GeoIp* geoIp)
+    : config(config), logReader(config.accessLogPath),
+    peers(config.users, config.instance), probes(config.maxProbes), destinations(peers.size()), inboundTable(config.userInbounds), outboundTable(config.outboundTags),
+    inboundCounts(inboundTable.tags().size()), geoCache(geoIp ? std::make_unique<GeoCache>(*geoIp) : nullptr) {}
+
+void XRayClient::backfill() {
+    if (config.accessLogPath.empty()) {
+        return;
+    }
+    const auto now = std::chrono::system_clock::now();
+    const std::int64_t sinceUs = (std::chrono::system_clock::to_time_t(now) - TIME_DIFF_LIMIT) * 1000000LL;
+    const auto started = std::chrono::steady_clock::now();
+
+    backfill::Result result;
+    try {
+        result = backfill::scan(config.accessLogPath, sinceUs,
+            [this](const accesslog::Entry& entry) { return isUserConnection(entry); });
+    }
+    catch (const std::exception& e) {
+        BOOST_LOG_TRIVIAL(warning)
+            << "Access log backfill failed: "
+            << std::string(e.what());
+        return;
+    }
+
+    std::size_t online = 0;
+    for (auto& [email, event] : result.latest) {
+        UserId user = peers.find(email);
+        if (user == NO_USER) {
+            // Reported by the first pass, which is the next one
+            suspiciousCounts[email].pass = pass + 1;
+            continue;
+        }
+        Peer peer;
+        peer.ip = std::move(event.ip);
+        peer.lastTime = TimestampDecoder::toTime(event.time);
+        peer.online = true;
+        peers.restore(user, peer);
+        ++online;
+    }
+    logReader.resume(result.device, result.inode, result.endOffset);
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    double mib = result.bytes / (1024.0 * 1024.0);
+    BOOST_LOG_TRIVIAL(info)
+        << "Access log backfill: " << result.lines << " lines, "
+        << mib << " MiB in " << seconds * 1000 << " ms ("
+        << (seconds > 0 ? mib / seconds : 0) << " MiB/s), "
+        << online << " users online";
+}
+
+bool XRayClient::loadState(const std::string& path) {
+    snapshot::State state;
+    if (!snapshot::load(path, state)) {
+        return false;
+    }
+    const std::time_t nowTs = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    if (std::difftime(nowTs, state.savedAt) > TIME_DIFF_LIMIT) {
+        BOOST_LOG_TRIVIAL(info) << "State file " << path << " is stale, rescanning access log";
+        return false;
+    }
+    std::size_t restored = 0;
+    for (const auto& peer : state.peers) {
+        UserId user = peers.find(peer.email);
+        if (user == NO_USER) {
+            // Removed from xray config meanwhile
+            continue;
+        }
+        peers.restore(user, peer);
+        ++restored;
+    }
+    if (!logReader.resume(state.device, state.inode, state.offset)) {
+        // Rotated while we were down: the new file is read from its beginning
+        BOOST_LOG_TRIVIAL(debug) << "Saved access log position is not valid anymore";
+    }
+    BOOST_LOG_TRIVIAL(info)
+        << "State restored from " << path << ": "
+        << restored << " peers, access log offset " << logReader.getOffset();
+    return true;
+}
+
+void XRayClient::saveState(const std::string& path) {
+    snapshot::State state;
+    state.savedAt = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    state.device = logReader.getDevice();
+    state.inode = logReader.getInode();
+    state.offset = logReader.getCommittedOffset();
+    for (UserId user = 0; user < peers.size(); ++user) {
+        if (peers.active(user)) {
+            state.peers.push_back(peers.peer(user));
+        }
+    }
+    snapshot::save(path, state);
+}
 
 void XRayClient::processAccessLog() {
     if (config.accessLogPath.empty()) {
@@ -17,38 +116,51 @@ void XRayClient::processAccessLog() {
         return;
     }
     
-    std::vector<std::string> lines = parseTailAccessLog();
-    if (lines.empty()) {
-        return;
-    }
+    readAccessLog();
 
-    const std::regex logPattern(
-        R"((\d{4}/\d{2}/\d{2} \d{2}:\d{2}:\d{2}\.\d+) )"
-        R"(from (\d{1,3}\.\d{1,3}\.\d{1,3}\.\d{1,3}):\d+ )"
-        R"(accepted [^\s]+ (\[vless_tls >> direct\]) )"
-        R"(email: ([^\s]+))"
-    );
-    const int logPatCount = 5;
     const std::time_t nowTs = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-    std::unordered_set<std::string> processedEmails;
+    peers.nextGeneration();
+    ++pass;
 
     connected.clear();
     disconnected.clear();
-    suspicious.clear();
 
+    std::uint64_t parsedCount = 0;
+    std::uint64_t rejectedCount = 0;
     for (auto it = lines.rbegin(); it != lines.rend(); ++it) {
-        std::smatch matches;
-        if (std::regex_search(*it, matches, logPattern) && matches.size() == logPatCount) {
-            std::time_t logTs = utils::parseDate(matches[1]);
-            std::string ip = matches[2];
-            std::string type = matches[3];
-            std::string email = matches[4];
-            std::string id = "";
-            if (type != "[vless_tls >> direct]") {
-                continue;
+        accesslog::Entry entry;
+        bool sampled = ((parsedCount + rejectedCount) & (PROFILE_SAMPLE - 1)) == 0;
+        bool parsed;
+        if (sampled) {
+            auto parseStarted = std::chrono::steady_clock::now();
+            parsed = accesslog::parseLine(*it, entry);
+            profiler::record(profiler::Stage::Parse, std::chrono::steady_clock::now() - parseStarted);
+        }
+        else {
+            parsed = accesslog::parseLine(*it, entry);
+        }
+        parsed ? ++parsedCount : ++rejectedCount;
+        if (parsed && !entry.accepted) {
+            IpAddress address;
+            if (IpAddress::parse(entry.ip, address)) {
+                probes.rejected(address, entry.reason);
+            }
+            continue;
+        }
+        int inbound = parsed ? matchInbound(entry) : -1;
+        if (inbound >= 0) {
+            ++inboundCounts[inbound];
+            std::time_t logTs;
+            if (sampled) {
+                auto decodeStarted = std::chrono::steady_clock::now();
+                logTs = TimestampDecoder::toTime(timestampDecoder.decode(entry.timestamp));
+                profiler::record(profiler::Stage::Timestamp, std::chrono::steady_clock::now() - decodeStarted);
+            }
+            else {
+                logTs = TimestampDecoder::toTime(timestampDecoder.decode(entry.timestamp));
             }
             if (logTs == 0) {
-                BOOST_LOG_TRIVIAL(debug) << "Not parsed datetime: " << matches[1];
+                BOOST_LOG_TRIVIAL(debug) << "Not parsed datetime: " << entry.timestamp;
                 continue;
             }
             double diffSeconds = std::difftime(nowTs, logTs);
@@ -56,87 +168,290 @@ void XRayClient::processAccessLog() {
                 // Because lines are reverse reading and rest lines are also later
                 break;
             }
-            auto userIt = config.users.find(email);
-            if (userIt == config.users.end()) {
+            UserId user = peers.find(entry.email);
+            IpAddress address;
+            bool hasAddress = IpAddress::parse(entry.ip, address);
+            if (user == NO_USER) {
                 // Unknown user
-                suspicious.insert(email);
+                countSuspicious(entry.email);
+                if (hasAddress) {
+                    probes.unknownEmail(address, entry.email);
+                }
                 continue;
             }
-            else {
-                id = userIt->second.id;
+            // Only the newest line of the user in this run updates the peer ("each user only once"),
+            // older ones just add their addresses
+            if (peers.markSeen(user)) {
+                if (hasAddress) {
+                    peers.ip[user] = address;
+                }
+                peers.prevTime[user] = peers.lastTime[user];
+                peers.lastTime[user] = logTs;
             }
-            // Skip if already processed this user in this run (ensure "each user only once")
-            if (processedEmails.count(email)) {
-                continue;
+            if (hasAddress) {
+                peers.ips[user].touch(address, logTs);
             }
-            processedEmails.insert(email);
+            // Every line counts, not only the newest one
+            peers.rates[user].add(logTs);
+            destinations.add(user, entry.destination);
+        }
+    }
 
-            std::unordered_map<std::string, Peer>::iterator peerIt = peers.find(email);
-            if (peerIt == peers.end()) {
-                Peer peer{ id, email, ip, logTs, 0 };
-                peers.emplace(email, std::move(peer));
-            }
-            else {
-                // Update existing peer: only if this log entry is newer (should be, but safe-guard)
-                peerIt->second.ip = ip;
-                peerIt->second.prevTime = peerIt->second.lastTime;
-                peerIt->second.lastTime = logTs;
+    profiler::ScopedTimer timer(profiler::Stage::StateDiff);
+    concurrent.clear();
+    abnormalRates.clear();
+    for (UserId user = 0; user < peers.size(); ++user) {
+        if (!peers.active(user)) {
+            continue;
+        }
+        updateIps(user, nowTs);
+        updateRate(user, nowTs);
+        if (peers.seen(user)) {
+            if (!peers.online[user]) {
+                peers.online[user] = true;
+                ++peers.connections[user];
+                Peer peer = peers.peer(user);
+                if (geoCache && peers.ip[user] != IpAddress{}) {
+                    locate(user, peer);
+                }
+                connected.push_back(std::move(peer));
             }
         }
+        else if (peers.online[user] && isInactive(user, nowTs)) {
+            peers.online[user] = false;
+            disconnected.push_back(peers.peer(user));
+        }
+    }
+
+    probeAlerts = probes.check(nowTs);
+    destinations.compact();
+
+    auto& counters = metrics::counters();
+    counters.linesRead.fetch_add(lines.size(), std::memory_order_relaxed);
+    counters.linesParsed.fetch_add(parsedCount, std::memory_order_relaxed);
+    counters.linesRejected.fetch_add(rejectedCount, std::memory_order_relaxed);
+    counters.connections.fetch_add(connected.size(), std::memory_order_relaxed);
+    counters.disconnections.fetch_add(disconnected.size(), std::memory_order_relaxed);
+}
+
+void XRayClient::updateTraffic(const std::vector<UserTraffic>& traffic) {
+    const std::time_t nowTs = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    for (const auto& usage : traffic) {
+        UserId user = peers.find(usage.email);
+        if (user == NO_USER || !peers.active(user)) {
+            continue;
+        }
+        peers.uplinkRate[user] = usage.uplinkRate;
+        peers.downlinkRate[user] = usage.downlinkRate;
+        if (usage.uplinkRate > 0 || usage.downlinkRate > 0) {
+            peers.lastTraffic[user] = nowTs;
+        }
+    }
+}
+
+std::vector<Peer> XRayClient::reloadUsers(const UsersDiff& diff) {
+    // Removed users who are online end their sessions now
+    std::vector<Peer> removed;
+    for (UserId user = 0; user < peers.size(); ++user) {
+        if (peers.online[user] && !config.users.count(peers.emails[user])) {
+            peers.online[user] = false;
+            removed.push_back(peers.peer(user));
+        }
+    }
+
+    PeerTable table(config.users, config.instance);
+    std::vector<UserId> previousIds(table.size(), NO_USER);
+    for (UserId user = 0; user < table.size(); ++user) {
+        UserId previous = peers.find(table.emails[user]);
+        if (previous != NO_USER) {
+            table.take(user, peers, previous);
+            previousIds[user] = previous;
+        }
+    }
+    peers = std::move(table);
+    destinations.remap(previousIds);
+
+    // Counters of inbounds that are still there are kept
+    TagTable inbounds(config.userInbounds);
+    std::vector<std::uint64_t> counts(inbounds.tags().size());
+    for (std::size_t i = 0; i < inboundCounts.size(); ++i) {
+        int index = inbounds.find(inboundTable.tags()[i]);
+        if (index >= 0) {
+            counts[index] = inboundCounts[i];
+        }
+    }
+    inboundTable = std::move(inbounds);
+    inboundCounts = std::move(counts);
+    outboundTable = TagTable(config.outboundTags);
+
+    // Not suspicious anymore
+    for (const auto& user : diff.added) {
+        suspiciousCounts.erase(user.email);
+    }
+    return removed;
+}
+
+void XRayClient::countSuspicious(std::string_view email) {
+    auto it = suspiciousCounts.find(email);
+    if (it == suspiciousCounts.end()) {
+        it = suspiciousCounts.emplace(std::string(email), Suspicious{}).first;
+    }
+    ++it->second.lines;
+    it->second.pass = pass;
+}
+
+void XRayClient::updateIps(UserId user, std::time_t nowTs) {
+    IpSet& ips = peers.ips[user];
+    ips.expire(nowTs - config.ipTimeout);
+    if (config.maxIps == 0) {
+        return;
+    }
+    if (ips.size() <= config.maxIps) {
+        peers.tooManyIps[user] = false;
+    }
+    else if (!peers.tooManyIps[user]) {
+        // Once until the number goes down again
+        peers.tooManyIps[user] = true;
+        concurrent.push_back(peers.peer(user));
+    }
+}
+
+void XRayClient::updateRate(UserId user, std::time_t nowTs) {
+    ConnectionRate& rate = peers.rates[user];
+    rate.advance(nowTs);
+    const RateAlert windows[] = {
+        { {}, "1m", rate.lastMinute(), config.maxConnections1m },
+        { {}, "5m", rate.lastMinutes(5), config.maxConnections5m },
+        { {}, "1h", rate.lastHour(), config.maxConnections1h },
+    };
+    const RateAlert* over = std::find_if(std::begin(windows), std::end(windows),
+        [](const RateAlert& window) { return window.limit > 0 && window.connections > window.limit; });
+    if (over == std::end(windows)) {
+        peers.abnormalRate[user] = false;
     }
+    else if (!peers.abnormalRate[user]) {
+        // Once until the user is under every limit again
+        peers.abnormalRate[user] = true;
+        abnormalRates.push_back({ peers.peer(user), over->window, over->connections, over->limit });
+    }
+}
 
-    for (auto& [email, peer] : peers) {
-        if (processedEmails.count(peer.email) == 0) {
-            peer.lastTime = 0;
+void XRayClient::locate(UserId user, Peer& peer) {
+    const geoip::Location& location = geoCache->lookup(peers.ip[user]);
+    if (location.empty()) {
+        // E.g. a private address: the last known location stays
+        return;
+    }
+    peer.locationChanged = geoip::moved(peers.locations[user], location);
+    peers.locations[user] = location;
+    peer.location = location;
+}
+
+bool XRayClient::isInactive(UserId user, std::time_t nowTs) const {
+    const std::time_t lastTime = peers.lastTime[user];
+    const std::time_t lastTraffic = peers.lastTraffic[user];
+    // Nothing from the user for the whole window
+    if (std::difftime(nowTs, lastTime) > TIME_DIFF_LIMIT) {
+        return true;
+    }
+    // Much earlier if the stats API shows no traffic
+    if (config.idleTimeout > 0 && lastTraffic > 0) {
+        std::time_t lastActivity = std::max(lastTime, lastTraffic);
+        return std::difftime(nowTs, lastActivity) > config.idleTimeout;
+    }
+    return false;
+}
+
+void XRayClient::collectMetrics(metrics::Snapshot& snapshot) const {
+    for (UserId user = 0; user < peers.size(); ++user) {
+        if (!peers.active(user)) {
+            continue;
         }
-        if (peer.lastTime == 0 && peer.prevTime != 0) {
-            peer.prevTime = 0;
-            disconnected.emplace_back(peer);
+        metrics::UserState state;
+        state.instance = config.instance;
+        state.email = peers.emails[user];
+        state.id = peers.ids[user];
+        if (peers.ip[user] != IpAddress{}) {
+            state.ip = peers.ip[user].toString();
         }
-        else if (peer.lastTime != 0 && peer.prevTime == 0) {
-            connected.emplace_back(peer);
+        state.lastTime = peers.lastTime[user];
+        state.online = peers.online[user] != 0;
+        state.connections = peers.connections[user];
+        state.ips = peers.ips[user].size();
+        state.uplinkRate = peers.uplinkRate[user];
+        state.downlinkRate = peers.downlinkRate[user];
+        state.connections1m = peers.rates[user].lastMinute();
+        state.connections5m = peers.rates[user].lastMinutes(5);
+        state.connections1h = peers.rates[user].lastHour();
+        state.location = geoip::format(peers.locations[user]);
+        peers.ips[user].forEach([&](const IpAddress& address, std::time_t) {
+            state.addresses.push_back(address);
+        });
+        for (auto& host : destinations.hosts(user)) {
+            state.hosts.push_back({ std::move(host.name), host.count });
         }
-        else if (peer.lastTime != 0 && peer.prevTime != 0 &&
-            peer.lastTime - peer.prevTime > TIME_DIFF_LIMIT) {
-            disconnected.emplace_back(peer);
+        for (auto& port : destinations.ports(user)) {
+            state.ports.push_back({ std::move(port.name), port.count });
         }
+        snapshot.users.push_back(std::move(state));
+    }
+    for (const auto& [email, suspicious] : suspiciousCounts) {
+        snapshot.suspicious.push_back({ config.instance, email, suspicious.lines });
+    }
+    for (auto& host : destinations.hosts()) {
+        snapshot.hosts.push_back({ config.instance, std::move(host.name), host.count });
+    }
+    for (auto& port : destinations.ports()) {
+        snapshot.ports.push_back({ config.instance, std::move(port.name), port.count });
+    }
+    for (const auto& offender : probes.top()) {
+        snapshot.probes.push_back({ config.instance, offender.source, offender.attempts });
+    }
+    for (std::size_t i = 0; i < inboundCounts.size(); ++i) {
+        snapshot.inbounds.push_back({ config.instance, inboundTable.tags()[i], inboundCounts[i] });
     }
 }
 
-std::vector<std::string> XRayClient::parseTailAccessLog() {
-    std::string output = "";
-    std::vector<std::string> lines;
+void XRayClient::readAccessLog() {
+    lines.clear();
     try {
-        std::string command = "tail -n " + std::to_string(LINES_COUNT) + " " + config.accessLogPath;
-        output = utils::executeCommand(command);
-        if (output.empty()) {
-            BOOST_LOG_TRIVIAL(debug) << "Error reading XRay log, file empty";
-            return lines;
-        }
+        logReader.readLines(lines);
     }
     catch (const std::exception& e) {
         BOOST_LOG_TRIVIAL(debug)
             << "Error reading XRay log: "
             << std::string(e.what());
-        return lines;
-    }
-    std::istringstream iss(output);
-    std::string line;
-    while (std::getline(iss, line)) {
-        lines.push_back(line);
     }
-    return lines;
 }
 
 
-std::vector<Peer> XRayClient::getConnected() {
-    return connected;
+int XRayClient::matchInbound(const accesslog::Entry& entry) const {
+    if (!entry.accepted || entry.email.empty()) {
+        return -1;
+    }
+    // Without tagged outbounds in the config any route counts
+    if (!outboundTable.empty() && !entry.outboundTag.empty() && outboundTable.find(entry.outboundTag) < 0) {
+        return -1;
+    }
+    return inboundTable.find(entry.inboundTag);
 }
 
-std::vector<Peer> XRayClient::getDisconnected() {
-    return disconnected;
+std::vector<Peer> XRayClient::getOnline() const {
+    std::vector<Peer> online;
+    for (UserId user = 0; user < peers.size(); ++user) {
+        if (peers.online[user]) {
+            online.push_back(peers.peer(user));
+        }
+    }
+    return online;
 }
 
-std::unordered_set<std::string> XRayClient::getSuspicious() {
-    return suspicious;
+std::vector<std::string_view> XRayClient::getSuspicious() const {
+    std::vector<std::string_view> emails;
+    for (const auto& [email, suspicious] : suspiciousCounts) {
+        if (suspicious.pass == pass) {
+            emails.push_back(email);
+        }
+    }
+    return emails;
 }
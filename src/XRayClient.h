@@ -2,36 +2,103 @@
 #define XRAYCLIENT_H
 
 #include "Config.h"
+#include "LogReader.h"
+#include "TimestampDecoder.h"
+#include "accesslog.h"
+#include "XRayStatsClient.h"
+#include "TagTable.h"
+#include "IpSet.h"
+#include "PeerTable.h"
+#include "ProbeDetector.h"
+#include "TopDestinations.h"
+#include "GeoIp.h"
+#include "Metrics.h"
+#include <memory>
+#include <span>
 #include <string>
+#include <string_view>
 #include <unordered_map>
-#include <unordered_set>
 #include <vector>
 #include <ctime>
+#include <cstdint>
 
 
-struct Peer {
-    std::string id;
-    std::string email;
-    std::string ip;
-    std::time_t lastTime = 0;
-    std::time_t prevTime = 0;
+// A user over one of the connection rate limits
+struct RateAlert {
+    Peer peer;
+    // "1m", "5m" or "1h"
+    const char* window;
+    std::uint32_t connections;
+    unsigned int limit;
 };
 
 class XRayClient {
 public:
-    XRayClient(const Config& config);
+    // Connections are located with `geoIp` if given, it must outlive the client
+    XRayClient(const Config& config, const GeoIp* geoIp = nullptr);
+    void backfill();
+    bool loadState(const std::string& path);
+    void saveState(const std::string& path);
     void processAccessLog();
-    std::vector<Peer> getConnected();
-    std::vector<Peer> getDisconnected();
-    std::unordered_set<std::string> getSuspicious();
+    void updateTraffic(const std::vector<UserTraffic>& traffic);
+    // Rebuilds the user tables from the config after its users have been reloaded.
+    // Users left in the config keep their state. Returns the removed users who were online
+    std::vector<Peer> reloadUsers(const UsersDiff& diff);
+    std::vector<Peer> getOnline() const;
+    // Views of the last run, valid until the next processAccessLog()
+    std::span<const Peer> getConnected() const { return connected; }
+    std::span<const Peer> getDisconnected() const { return disconnected; }
+    // Users who went over the concurrent IPs limit in the last run
+    std::span<const Peer> getConcurrent() const { return concurrent; }
+    // Users who went over a connection rate limit in the last run
+    std::span<const RateAlert> getAbnormalRates() const { return abnormalRates; }
+    // Sources that went over the probes limit in the last run
+    std::span<const ProbeDetector::Offender> getProbes() const { return probeAlerts; }
+    // Unknown emails of the last run
+    std::vector<std::string_view> getSuspicious() const;
+    // Counted since the last clearDestinations()
+    const TopDestinations& getDestinations() const { return destinations; }
+    const std::string& getEmail(UserId user) const { return peers.emails[user]; }
+    void clearDestinations() { destinations.clear(); }
+    // Adds the state of this instance for the metrics endpoint
+    void collectMetrics(metrics::Snapshot& snapshot) const;
 
 private:
     const Config& config;
-    std::unordered_map<std::string, Peer> peers;
+    LogReader logReader;
+    TimestampDecoder timestampDecoder;
+    PeerTable peers;
+    // Kept between runs, so their capacity is reused
+    std::vector<std::string_view> lines;
     std::vector<Peer> connected;
     std::vector<Peer> disconnected;
-    std::unordered_set<std::string> suspicious;
-    std::vector<std::string> parseTailAccessLog();
+    std::vector<Peer> concurrent;
+    std::vector<RateAlert> abnormalRates;
+    ProbeDetector probes;
+    TopDestinations destinations;
+    std::vector<ProbeDetector::Offender> probeAlerts;
+    struct Suspicious {
+        std::uint64_t lines = 0;
+        // Last run the email was seen in
+        std::uint64_t pass = 0;
+    };
+    std::unordered_map<std::string, Suspicious, StringHash, std::equal_to<>> suspiciousCounts;
+    std::uint64_t pass = 1;
+    TagTable inboundTable;
+    TagTable outboundTable;
+    // Connection lines per inbound, indexed as inboundTable.tags()
+    std::vector<std::uint64_t> inboundCounts;
+    // Looked up once a connection, never for every line
+    std::unique_ptr<GeoCache> geoCache;
+    void readAccessLog();
+    // Index of the user inbound of the line, -1 if it is not a user connection
+    int matchInbound(const accesslog::Entry& entry) const;
+    bool isUserConnection(const accesslog::Entry& entry) const { return matchInbound(entry) >= 0; }
+    void countSuspicious(std::string_view email);
+    bool isInactive(UserId user, std::time_t nowTs) const;
+    void updateIps(UserId user, std::time_t nowTs);
+    void updateRate(UserId user, std::time_t nowTs);
+    void locate(UserId user, Peer& peer);
 };
 
 #endif
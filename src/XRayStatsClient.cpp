@@ -0,0 +1,398 @@
+#include "XRayStatsClient.h"
+#include <stdexcept>
+#include <boost/log/trivial.hpp>
+
+
+namespace beast = boost::beast;
+namespace net = boost::asio;
+using tcp = net::ip::tcp;
+
+const auto IO_TIMEOUT = std::chrono::seconds(5);
+const char* QUERY_STATS_PATH = "/xray.app.stats.command.StatsService/QueryStats";
+const std::string USER_PREFIX = "user>>>";
+const std::string TRAFFIC_INFIX = ">>>traffic>>>";
+
+// HTTP/2 frame types and flags (RFC 9113)
+const std::uint8_t FRAME_DATA = 0x0;
+const std::uint8_t FRAME_HEADERS = 0x1;
+const std::uint8_t FRAME_RST_STREAM = 0x3;
+const std::uint8_t FRAME_SETTINGS = 0x4;
+const std::uint8_t FRAME_PING = 0x6;
+const std::uint8_t FRAME_GOAWAY = 0x7;
+const std::uint8_t FRAME_WINDOW_UPDATE = 0x8;
+const std::uint8_t FRAME_CONTINUATION = 0x9;
+const std::uint8_t FLAG_END_STREAM = 0x1;
+const std::uint8_t FLAG_ACK = 0x1;
+const std::uint8_t FLAG_END_HEADERS = 0x4;
+const std::uint8_t FLAG_PADDED = 0x8;
+const std::uint32_t MAX_WINDOW = 0x7fffffff;
+const std::uint32_t DEFAULT_WINDOW = 65535;
+const std::uint32_t MAX_FRAME = 1 << 24;
+const std::uint32_t STREAM_ID_MASK = 0x7fffffff;
+
+static void putUint32(std::string& out, std::uint32_t value) {
+    out += static_cast<char>(value >> 24);
+    out += static_cast<char>(value >> 16);
+    out += static_cast<char>(value >> 8);
+    out += static_cast<char>(value);
+}
+
+static std::uint32_t getUint32(const char* p) {
+    auto b = reinterpret_cast<const unsigned char*>(p);
+    return (std::uint32_t(b[0]) << 24) | (std::uint32_t(b[1]) << 16) | (std::uint32_t(b[2]) << 8) | b[3];
+}
+
+// HPACK integer with an N-bit prefix (RFC 7541, 5.1)
+static void putHpackInt(std::string& out, std::uint8_t first, unsigned int bits, std::size_t value) {
+    const std::size_t max = (1u << bits) - 1;
+    if (value < max) {
+        out += static_cast<char>(first | value);
+        return;
+    }
+    out += static_cast<char>(first | max);
+    value -= max;
+    while (value >= 128) {
+        out += static_cast<char>(value % 128 + 128);
+        value /= 128;
+    }
+    out += static_cast<char>(value);
+}
+
+// Literal header field without indexing and without Huffman coding,
+// so there is no dynamic table state to keep
+static void putHeader(std::string& out, const std::string& name, const std::string& value) {
+    putHpackInt(out, 0x00, 4, 0);
+    putHpackInt(out, 0x00, 7, name.size());
+    out += name;
+    putHpackInt(out, 0x00, 7, value.size());
+    out += value;
+}
+
+namespace proto {
+    const int WIRE_VARINT = 0;
+    const int WIRE_FIXED64 = 1;
+    const int WIRE_BYTES = 2;
+    const int WIRE_FIXED32 = 5;
+
+    static void putVarint(std::string& out, std::uint64_t value) {
+        while (value >= 0x80) {
+            out += static_cast<char>(value | 0x80);
+            value >>= 7;
+        }
+        out += static_cast<char>(value);
+    }
+
+    static void putString(std::string& out, int field, const std::string& value) {
+        putVarint(out, (field << 3) | WIRE_BYTES);
+        putVarint(out, value.size());
+        out += value;
+    }
+
+    static bool getVarint(const std::string& in, std::size_t& pos, std::uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64 && pos < in.size(); shift += 7) {
+            auto byte = static_cast<unsigned char>(in[pos++]);
+            value |= std::uint64_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Reads the next field; for WIRE_BYTES `bytes` gets the content
+    static bool next(const std::string& in, std::size_t& pos, int& field, int& wire, std::uint64_t& value, std::string& bytes) {
+        std::uint64_t tag;
+        if (!getVarint(in, pos, tag)) {
+            return false;
+        }
+        field = static_cast<int>(tag >> 3);
+        wire = static_cast<int>(tag & 7);
+        switch (wire) {
+        case WIRE_VARINT:
+            return getVarint(in, pos, value);
+        case WIRE_FIXED64:
+            pos += 8;
+            return pos <= in.size();
+        case WIRE_FIXED32:
+            pos += 4;
+            return pos <= in.size();
+        case WIRE_BYTES:
+            if (!getVarint(in, pos, value) || value > in.size() - pos) {
+                return false;
+            }
+            bytes.assign(in, pos, value);
+            pos += value;
+            return true;
+        default:
+            return false;
+        }
+    }
+}
+
+
+XRayStatsClient::XRayStatsClient(const std::string& host, unsigned int port)
+    : host(host), port(std::to_string(port)) {}
+
+XRayStatsClient::~XRayStatsClient() {
+    disconnect();
+}
+
+std::vector<UserTraffic> XRayStatsClient::queryUserTraffic() {
+    // QueryStatsRequest { string pattern = 1; bool reset = 2; }
+    std::string request;
+    proto::putString(request, 1, USER_PREFIX);
+    std::string response = call(QUERY_STATS_PATH, request);
+    auto now = std::chrono::steady_clock::now();
+
+    // QueryStatsResponse { repeated Stat stat = 1; }, Stat { string name = 1; int64 value = 2; }
+    std::unordered_map<std::string, Counters> current;
+    std::size_t pos = 0;
+    int field, wire;
+    std::uint64_t value;
+    std::string stat;
+    while (pos < response.size()) {
+        if (!proto::next(response, pos, field, wire, value, stat)) {
+            throw std::runtime_error("Malformed QueryStats response");
+        }
+        if (field != 1 || wire != proto::WIRE_BYTES) {
+            continue;
+        }
+        std::string name;
+        std::int64_t counter = 0;
+        std::size_t statPos = 0;
+        std::string bytes;
+        while (statPos < stat.size()) {
+            if (!proto::next(stat, statPos, field, wire, value, bytes)) {
+                throw std::runtime_error("Malformed stat in QueryStats response");
+            }
+            if (field == 1 && wire == proto::WIRE_BYTES) {
+                name = std::move(bytes);
+            }
+            else if (field == 2 && wire == proto::WIRE_VARINT) {
+                counter = static_cast<std::int64_t>(value);
+            }
+        }
+        // user>>>{email}>>>traffic>>>{uplink|downlink}
+        if (name.compare(0, USER_PREFIX.size(), USER_PREFIX) != 0) {
+            continue;
+        }
+        std::size_t infix = name.find(TRAFFIC_INFIX, USER_PREFIX.size());
+        if (infix == std::string::npos) {
+            continue;
+        }
+        auto& counters = current[name.substr(USER_PREFIX.size(), infix - USER_PREFIX.size())];
+        std::string direction = name.substr(infix + TRAFFIC_INFIX.size());
+        if (direction == "uplink") {
+            counters.uplink = counter;
+        }
+        else if (direction == "downlink") {
+            counters.downlink = counter;
+        }
+    }
+
+    double elapsed = std::chrono::duration<double>(now - previousAt).count();
+    std::vector<UserTraffic> traffic;
+    traffic.reserve(current.size());
+    for (const auto& [email, counters] : current) {
+        UserTraffic user{ email, counters.uplink, counters.downlink };
+        auto prevIt = previous.find(email);
+        if (prevIt != previous.end() && elapsed > 0) {
+            // Counters start from zero again after a restart of xray
+            auto up = counters.uplink >= prevIt->second.uplink ? counters.uplink - prevIt->second.uplink : counters.uplink;
+            auto down = counters.downlink >= prevIt->second.downlink ? counters.downlink - prevIt->second.downlink : counters.downlink;
+            user.uplinkRate = up / elapsed;
+            user.downlinkRate = down / elapsed;
+        }
+        traffic.push_back(std::move(user));
+    }
+    previous = std::move(current);
+    previousAt = now;
+    return traffic;
+}
+
+std::string XRayStatsClient::call(const std::string& path, const std::string& message) {
+    try {
+        if (!stream) {
+            connect();
+        }
+        std::uint32_t streamId = nextStreamId;
+        nextStreamId += 2;
+
+        std::string headers;
+        putHeader(headers, ":method", "POST");
+        putHeader(headers, ":scheme", "http");
+        putHeader(headers, ":path", path);
+        putHeader(headers, ":authority", host + ":" + port);
+        putHeader(headers, "content-type", "application/grpc");
+        putHeader(headers, "te", "trailers");
+        writeFrame(FRAME_HEADERS, FLAG_END_HEADERS, streamId, headers);
+
+        // Length-prefixed message, not compressed
+        std::string body(1, '\0');
+        putUint32(body, static_cast<std::uint32_t>(message.size()));
+        body += message;
+        writeFrame(FRAME_DATA, FLAG_END_STREAM, streamId, body);
+
+        std::string data;
+        std::uint32_t received = 0;
+        bool ended = false;
+        while (!ended) {
+            std::uint8_t type, flags;
+            std::uint32_t frameStream;
+            std::string payload;
+            readFrame(type, flags, frameStream, payload);
+            switch (type) {
+            case FRAME_SETTINGS:
+                if (!(flags & FLAG_ACK)) {
+                    writeFrame(FRAME_SETTINGS, FLAG_ACK, 0, "");
+                }
+                break;
+            case FRAME_PING:
+                if (!(flags & FLAG_ACK)) {
+                    writeFrame(FRAME_PING, FLAG_ACK, 0, payload);
+                }
+                break;
+            case FRAME_GOAWAY:
+                throw std::runtime_error("Stats API closed the connection");
+            case FRAME_RST_STREAM:
+                if (frameStream == streamId) {
+                    throw std::runtime_error("Stats API reset the request");
+                }
+                break;
+            case FRAME_DATA:
+                if (frameStream == streamId) {
+                    received += static_cast<std::uint32_t>(payload.size());
+                    if (flags & FLAG_PADDED) {
+                        std::size_t padding = payload.empty() ? 0 : static_cast<unsigned char>(payload[0]);
+                        if (payload.size() < 1 + padding) {
+                            throw std::runtime_error("Malformed HTTP/2 DATA frame");
+                        }
+                        payload = payload.substr(1, payload.size() - 1 - padding);
+                    }
+                    data += payload;
+                    ended = flags & FLAG_END_STREAM;
+                }
+                break;
+            case FRAME_HEADERS:
+            case FRAME_CONTINUATION:
+                // Response headers and trailers; grpc-status is not decoded,
+                // a failed call is recognized by the missing message
+                if (frameStream == streamId) {
+                    ended = flags & FLAG_END_STREAM;
+                }
+                break;
+            default:
+                break;
+            }
+        }
+        if (received > 0) {
+            std::string increment;
+            putUint32(increment, received);
+            writeFrame(FRAME_WINDOW_UPDATE, 0, 0, increment);
+        }
+        if (nextStreamId > STREAM_ID_MASK / 2) {
+            // Stream identifiers cannot be reused, start a new connection
+            disconnect();
+        }
+
+        if (data.size() < 5) {
+            throw std::runtime_error("Stats API call failed (is StatsService enabled?)");
+        }
+        if (data[0] != 0) {
+            throw std::runtime_error("Compressed gRPC messages are not supported");
+        }
+        std::uint32_t length = getUint32(data.data() + 1);
+        if (data.size() - 5 < length) {
+            throw std::runtime_error("Truncated gRPC message");
+        }
+        return data.substr(5, length);
+    }
+    catch (...) {
+        disconnect();
+        throw;
+    }
+}
+
+template <class Start>
+void XRayStatsClient::await(Start&& start) {
+    boost::system::error_code result;
+    start([&result](boost::system::error_code ec, auto&&...) { result = ec; });
+    ioContext.restart();
+    ioContext.run();
+    if (result) {
+        throw boost::system::system_error(result);
+    }
+}
+
+void XRayStatsClient::connect() {
+    tcp::resolver resolver(ioContext);
+    auto endpoints = resolver.resolve(host, port);
+    stream = std::make_unique<beast::tcp_stream>(ioContext);
+    stream->expires_after(IO_TIMEOUT);
+    await([&](auto handler) { stream->async_connect(endpoints, handler); });
+    nextStreamId = 1;
+
+    std::string preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+    stream->expires_after(IO_TIMEOUT);
+    await([&](auto handler) { net::async_write(*stream, net::buffer(preface), handler); });
+
+    // SETTINGS_ENABLE_PUSH = 0, SETTINGS_INITIAL_WINDOW_SIZE = max
+    std::string settings;
+    settings += '\0';
+    settings += '\x02';
+    putUint32(settings, 0);
+    settings += '\0';
+    settings += '\x04';
+    putUint32(settings, MAX_WINDOW);
+    writeFrame(FRAME_SETTINGS, 0, 0, settings);
+
+    // Connection window, so large responses do not stall
+    std::string increment;
+    putUint32(increment, MAX_WINDOW - DEFAULT_WINDOW);
+    writeFrame(FRAME_WINDOW_UPDATE, 0, 0, increment);
+
+    BOOST_LOG_TRIVIAL(debug) << "Connected to stats API " << host << ":" << port;
+}
+
+void XRayStatsClient::disconnect() {
+    if (!stream) {
+        return;
+    }
+    boost::system::error_code ec;
+    stream->socket().close(ec);
+    stream.reset();
+}
+
+void XRayStatsClient::writeFrame(std::uint8_t type, std::uint8_t flags, std::uint32_t streamId, const std::string& payload) {
+    std::string frame;
+    frame.reserve(9 + payload.size());
+    frame += static_cast<char>(payload.size() >> 16);
+    frame += static_cast<char>(payload.size() >> 8);
+    frame += static_cast<char>(payload.size());
+    frame += static_cast<char>(type);
+    frame += static_cast<char>(flags);
+    putUint32(frame, streamId);
+    frame += payload;
+    stream->expires_after(IO_TIMEOUT);
+    await([&](auto handler) { net::async_write(*stream, net::buffer(frame), handler); });
+}
+
+void XRayStatsClient::readFrame(std::uint8_t& type, std::uint8_t& flags, std::uint32_t& streamId, std::string& payload) {
+    char header[9];
+    stream->expires_after(IO_TIMEOUT);
+    await([&](auto handler) { net::async_read(*stream, net::buffer(header), handler); });
+    auto b = reinterpret_cast<const unsigned char*>(header);
+    std::uint32_t length = (std::uint32_t(b[0]) << 16) | (std::uint32_t(b[1]) << 8) | b[2];
+    if (length >= MAX_FRAME) {
+        throw std::runtime_error("HTTP/2 frame is too large");
+    }
+    type = b[3];
+    flags = b[4];
+    streamId = getUint32(header + 5) & STREAM_ID_MASK;
+    payload.resize(length);
+    if (length > 0) {
+        stream->expires_after(IO_TIMEOUT);
+        await([&](auto handler) { net::async_read(*stream, net::buffer(payload), handler); });
+    }
+}
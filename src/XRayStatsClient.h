@@ -0,0 +1,60 @@
+#ifndef XRAYSTATSCLIENT_H
+#define XRAYSTATSCLIENT_H
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/beast/core/tcp_stream.hpp>
+
+
+struct UserTraffic {
+    std::string email;
+    std::int64_t uplink = 0;
+    std::int64_t downlink = 0;
+    // Bytes per second since the previous query
+    double uplinkRate = 0;
+    double downlinkRate = 0;
+};
+
+// Client of the xray StatsService API (gRPC QueryStats). gRPC runs over
+// cleartext HTTP/2 with prior knowledge; only the frames needed for one
+// unary call at a time are implemented. The connection is kept between
+// queries and reopened after an error.
+class XRayStatsClient {
+public:
+    XRayStatsClient(const std::string& host, unsigned int port);
+    ~XRayStatsClient();
+    XRayStatsClient(const XRayStatsClient&) = delete;
+    XRayStatsClient& operator=(const XRayStatsClient&) = delete;
+
+    // One `user>>>` pattern request for all users; throws on errors
+    std::vector<UserTraffic> queryUserTraffic();
+
+private:
+    struct Counters {
+        std::int64_t uplink = 0;
+        std::int64_t downlink = 0;
+    };
+
+    std::string host;
+    std::string port;
+    boost::asio::io_context ioContext;
+    std::unique_ptr<boost::beast::tcp_stream> stream;
+    std::uint32_t nextStreamId = 1;
+    std::unordered_map<std::string, Counters> previous;
+    std::chrono::steady_clock::time_point previousAt;
+
+    std::string call(const std::string& path, const std::string& message);
+    void connect();
+    void disconnect();
+    void writeFrame(std::uint8_t type, std::uint8_t flags, std::uint32_t streamId, const std::string& payload);
+    void readFrame(std::uint8_t& type, std::uint8_t& flags, std::uint32_t& streamId, std::string& payload);
+    template <class Start>
+    void await(Start&& start);
+};
+
+#endif
@@ -0,0 +1,154 @@
+#include "accesslog.h"
+
+
+namespace {
+    bool isDigit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    bool isHex(char c) {
+        return isDigit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+    }
+
+    bool consume(std::string_view& s, std::string_view prefix) {
+        if (s.substr(0, prefix.size()) != prefix) {
+            return false;
+        }
+        s.remove_prefix(prefix.size());
+        return true;
+    }
+
+    void skipSpaces(std::string_view& s) {
+        std::size_t i = 0;
+        while (i < s.size() && s[i] == ' ') ++i;
+        s.remove_prefix(i);
+    }
+
+    std::string_view token(std::string_view& s) {
+        std::size_t end = s.find(' ');
+        std::string_view result = s.substr(0, end);
+        s.remove_prefix(result.size());
+        return result;
+    }
+
+    // "YYYY/MM/DD HH:MM:SS" with optional ".ffffff"
+    bool parseTimestamp(std::string_view& s, std::string_view& out) {
+        static constexpr std::string_view mask = "dddd/dd/dd dd:dd:dd";
+        if (s.size() < mask.size()) {
+            return false;
+        }
+        for (std::size_t i = 0; i < mask.size(); ++i) {
+            if (mask[i] == 'd' ? !isDigit(s[i]) : s[i] != mask[i]) {
+                return false;
+            }
+        }
+        std::size_t len = mask.size();
+        if (len < s.size() && s[len] == '.') {
+            ++len;
+            while (len < s.size() && isDigit(s[len])) ++len;
+        }
+        out = s.substr(0, len);
+        s.remove_prefix(len);
+        return true;
+    }
+
+    // "1.2.3.4:5678", "[2001:db8::1]:5678", "2001:db8::1:5678", optionally "tcp:"/"udp:" prefixed
+    bool parseSource(std::string_view source, std::string_view& ip, std::string_view& port) {
+        if (!consume(source, "tcp:")) {
+            consume(source, "udp:");
+        }
+        if (!source.empty() && source.front() == '[') {
+            std::size_t close = source.find(']');
+            if (close == std::string_view::npos || source.substr(close + 1, 1) != ":") {
+                return false;
+            }
+            ip = source.substr(1, close - 1);
+            port = source.substr(close + 2);
+        }
+        else {
+            std::size_t colon = source.rfind(':');
+            if (colon == std::string_view::npos) {
+                return false;
+            }
+            ip = source.substr(0, colon);
+            port = source.substr(colon + 1);
+        }
+        if (ip.empty() || port.empty()) {
+            return false;
+        }
+        for (char c : port) {
+            if (!isDigit(c)) return false;
+        }
+        for (char c : ip) {
+            if (!isHex(c) && c != '.' && c != ':') return false;
+        }
+        return true;
+    }
+
+    // "[inbound >> outbound]" or "[inbound -> outbound]"
+    bool parseRoute(std::string_view& s, std::string_view& inbound, std::string_view& outbound) {
+        if (s.empty() || s.front() != '[') {
+            return false;
+        }
+        std::size_t close = s.find(']');
+        if (close == std::string_view::npos) {
+            return false;
+        }
+        std::string_view route = s.substr(1, close - 1);
+        s.remove_prefix(close + 1);
+        std::size_t sep = route.find(" >> ");
+        if (sep == std::string_view::npos) {
+            sep = route.find(" -> ");
+        }
+        if (sep == std::string_view::npos) {
+            inbound = route;
+            outbound = {};
+        }
+        else {
+            inbound = route.substr(0, sep);
+            outbound = route.substr(sep + 4);
+        }
+        return true;
+    }
+}
+
+bool accesslog::parseLine(std::string_view line, Entry& entry) {
+    if (!line.empty() && line.back() == '\r') {
+        line.remove_suffix(1);
+    }
+    entry = Entry{};
+    if (!parseTimestamp(line, entry.timestamp) || !consume(line, " from ")) {
+        return false;
+    }
+    if (!parseSource(token(line), entry.ip, entry.port)) {
+        return false;
+    }
+    skipSpaces(line);
+    if (consume(line, "rejected")) {
+        skipSpaces(line);
+        entry.reason = line;
+        return true;
+    }
+    if (!consume(line, "accepted ")) {
+        return false;
+    }
+    entry.accepted = true;
+
+    std::string_view target = token(line);
+    std::size_t colon = target.find(':');
+    if (colon == std::string_view::npos) {
+        entry.destination = target;
+    }
+    else {
+        entry.network = target.substr(0, colon);
+        entry.destination = target.substr(colon + 1);
+    }
+    skipSpaces(line);
+    if (parseRoute(line, entry.inboundTag, entry.outboundTag)) {
+        skipSpaces(line);
+    }
+    if (consume(line, "email: ")) {
+        entry.email = token(line);
+    }
+    return true;
+}
@@ -0,0 +1,28 @@
+#ifndef ACCESSLOG_H
+#define ACCESSLOG_H
+
+#include <string_view>
+
+
+namespace accesslog {
+    // One line of the xray access log, all fields point into the source line:
+    // 2025/01/02 03:04:05.123456 from 1.2.3.4:5678 accepted tcp:host:443 [in >> out] email: user
+    // 2025/01/02 03:04:05.123456 from [2001:db8::1]:5678 rejected  reason
+    struct Entry {
+        std::string_view timestamp;
+        std::string_view ip;
+        std::string_view port;
+        bool accepted = false;
+        std::string_view network;
+        std::string_view destination;
+        std::string_view inboundTag;
+        std::string_view outboundTag;
+        std::string_view email;
+        std::string_view reason;
+    };
+
+    // Single pass, allocation free. Returns false if the line is not a connection record.
+    bool parseLine(std::string_view line, Entry& entry);
+}
+
+#endif
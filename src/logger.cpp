@@ -1,17 +1,16 @@
 #include <boost/log/trivial.hpp>
 #include <boost/log/support/date_time.hpp>
-#include <boost/log/utility/setup/file.hpp>
-#include <boost/log/utility/setup/console.hpp>
+#include <boost/log/sinks/unlocked_frontend.hpp>
 #include <boost/log/utility/setup/common_attributes.hpp>
 #include <boost/log/expressions.hpp>
 #include <boost/dll/runtime_symbol_info.hpp>
-#include <ios>
+#include <boost/make_shared.hpp>
+#include <vector>
 #include "logger.h"
 #include "utils.h"
 
 
 namespace logging = boost::log;
-namespace keywords = boost::log::keywords;
 namespace expr = boost::log::expressions;
 
 static logging::trivial::severity_level stringToSeverity(const std::string& levelStr) {
@@ -24,30 +23,41 @@ static logging::trivial::severity_level stringToSeverity(const std::string& leve
     return logging::trivial::info;
 }
 
-void initLogging(const std::string filePath, const std::string level) {
+namespace {
+    using Frontend = logging::sinks::unlocked_sink<LogSink>;
+    std::vector<boost::shared_ptr<Frontend>> sinks;
+}
+
+void initLogging(const std::string& level, const LogSink::Options& file) {
     logging::add_common_attributes();
-    // to console
-    auto consoleHandler = logging::add_console_log();
     logging::trivial::severity_level levelSeverity = stringToSeverity(level);
-    consoleHandler->set_filter(logging::trivial::severity >= levelSeverity);
+    // to console
+    LogSink::Options console;
+    console.blockOnOverflow = file.blockOnOverflow;
+    auto consoleSink = boost::make_shared<Frontend>(boost::make_shared<LogSink>(console));
+    consoleSink->set_filter(logging::trivial::severity >= levelSeverity);
+    sinks.push_back(consoleSink);
     // to file
-    if (filePath != "") {
-        utils::ensurePathExists(filePath);
-        auto fileHandler = logging::add_file_log(
-            keywords::file_name = filePath,
-            keywords::auto_flush = true,
-            keywords::open_mode = std::ios::app,
-            // @TODO: add smart method making filePath with placeholder
-            // then log rotation may on back
-            //keywords::rotation_size = 10 * 1024 * 1024,
-            //keywords::max_size = 50 * 1024 * 1024,
-            keywords::format = (
-                expr::stream
-                << expr::format_date_time< boost::posix_time::ptime >("TimeStamp", "%Y-%m-%d %H:%M:%S")
-                << " [" << logging::trivial::severity
-                << "] " << expr::smessage
-            )
+    if (!file.path.empty()) {
+        auto fileSink = boost::make_shared<Frontend>(boost::make_shared<LogSink>(file));
+        fileSink->set_formatter(
+            expr::stream
+            << expr::format_date_time< boost::posix_time::ptime >("TimeStamp", "%Y-%m-%d %H:%M:%S")
+            << " [" << logging::trivial::severity
+            << "] " << expr::smessage
         );
-        fileHandler->set_filter(logging::trivial::severity >= levelSeverity);
+        fileSink->set_filter(logging::trivial::severity >= levelSeverity);
+        sinks.push_back(fileSink);
+    }
+    for (const auto& sink : sinks) {
+        logging::core::get()->add_sink(sink);
+    }
+}
+
+void stopLogging() {
+    for (const auto& sink : sinks) {
+        logging::core::get()->remove_sink(sink);
+        sink->locked_backend()->stop();
     }
+    sinks.clear();
 }
@@ -1,6 +1,12 @@
 #ifndef LOGGER_H
 #define LOGGER_H
 
-void initLogging(const std::string fileName="", const std::string level="debug");
+#include "LogSink.h"
+#include <string>
+
+// Records of `level` and above to the console and, if `file.path` is set, to the file
+void initLogging(const std::string& level, const LogSink::Options& file);
+// Writes out the queued records and detaches the sinks, before exit
+void stopLogging();
 
 #endif
@@ -1,16 +1,28 @@
 #include <iostream>
 #include "Config.h"
 #include "App.h"
+#include "Query.h"
+#include "logger.h"
 
 
 int main(int argc, char* argv[]) {
 	try {
+		if (argc > 1 && std::string(argv[1]) == "query") {
+			return query::run(argc - 1, argv + 1);
+		}
 		Config config = Config::parseCommandLine(argc, argv);
 		config.validate();
-		App app(config);
-		return app.run();
+		int code = 0;
+		{
+			App app(config);
+			code = app.run();
+		}
+		// Queued log records are written out before exit
+		stopLogging();
+		return code;
 	}
 	catch (const std::exception& e) {
+		stopLogging();
 		std::cerr << "Fatal error: " << e.what() << std::endl;
 		return 1;
 	}
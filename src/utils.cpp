@@ -17,6 +17,43 @@ std::string utils::formatTime(time_t time) {
     return ss.str();
 }
 
+std::string utils::formatBytes(double bytes) {
+    static const char* units[] = { "B", "KB", "MB", "GB", "TB" };
+    std::size_t unit = 0;
+    while (bytes >= 1024 && unit + 1 < std::size(units)) {
+        bytes /= 1024;
+        ++unit;
+    }
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(unit == 0 ? 0 : 1) << bytes << " " << units[unit];
+    return ss.str();
+}
+
+std::string utils::instanceLabel(const std::string& instance) {
+    return instance.empty() ? "" : "[" + instance + "] ";
+}
+
+std::pair<std::string, unsigned short> utils::splitHostPort(const std::string& address) {
+    std::size_t colon = address.rfind(':');
+    if (colon == std::string::npos || colon + 1 == address.size()) {
+        throw std::runtime_error("Address must be host:port, got " + address);
+    }
+    std::string host = address.substr(0, colon);
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+    int port = 0;
+    try {
+        port = std::stoi(address.substr(colon + 1));
+    }
+    catch (const std::exception&) {
+    }
+    if (port <= 0 || port > 65535) {
+        throw std::runtime_error("Invalid port in " + address);
+    }
+    return { host, static_cast<unsigned short>(port) };
+}
+
 std::string utils::toLower(const std::string& input) {
     std::string result = input;
     std::transform(result.begin(), result.end(), result.begin(), [](unsigned char c) {
@@ -84,14 +121,3 @@ std::string utils::escapeMDv2(const std::string& text) {
     }
     return result;
 }
-
-std::time_t utils::parseDate(const std::string datetime, const std::string format) {
-    std::tm tm = {};
-    std::istringstream ss(datetime);
-    ss >> std::get_time(&tm, format.c_str());
-    if (ss.fail()) {
-        return 0;
-    }
-    // as local time
-    return std::mktime(&tm);
-}
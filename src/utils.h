@@ -3,6 +3,7 @@
 
 #include <string>
 #include <ctime>
+#include <utility>
 #include <boost/json.hpp>
 
 
@@ -10,16 +11,17 @@ namespace json = boost::json;
 
 namespace utils {
     std::string formatTime(time_t time);
+    std::string formatBytes(double bytes);
+    // "[name] " to prefix message lines of an xray instance, empty without a name
+    std::string instanceLabel(const std::string& instance);
+    // Host and port of "host:port", an IPv6 host in brackets. Throws std::runtime_error
+    std::pair<std::string, unsigned short> splitHostPort(const std::string& address);
     std::string toLower(const std::string& input);
     std::string readFile(const std::string& filepath);
     json::value parseJsonFile(const std::string& filepath);
     std::string executeCommand(const std::string& command);
     void ensurePathExists(const std::string& filePath);
     std::string escapeMDv2(const std::string& text);
-    std::time_t parseDate(
-        const std::string datetime,
-        const std::string format="%Y/%m/%d %H:%M:%S"
-    );
 }
 
 #endif